@@ -13,8 +13,10 @@
 #define B1B_H_INCLUDED
 
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <time.h>
 
 #include <net/if.h>
 
@@ -23,6 +25,26 @@
 
 
 struct b1b_bond_session;
+struct b1b_global_session;
+struct b1b_event_src;
+struct b1b_garp_slot;
+struct json_tokener;
+struct json_object;
+struct b1b_uring;
+struct b1b_worker;
+struct b1b_ovs_port;
+struct b1b_ofconn;
+struct b1b_metrics;
+struct b1b_control;
+
+/* Called from the main loop when an event source's file descriptor is ready */
+typedef void (*b1b_event_cb)(struct b1b_global_session *gs,
+			     struct b1b_event_src *src, uint32_t events);
+
+struct b1b_event_src {
+	b1b_event_cb cb;
+	int fd;
+};
 
 enum __attribute__((packed)) b1b_br_type {
 	B1B_BR_TYPE_NONE = 0,
@@ -39,14 +61,99 @@ enum __attribute__((packed)) b1b_if_type {
 };
 _Static_assert(sizeof(enum b1b_if_type) == sizeof(_Bool), "b1b_if_type size");
 
+/* Failover stages, timed from receipt of the failover notification */
+enum b1b_stage {
+	B1B_STAGE_FDB = 0,  /* forwarding database acquired */
+	B1B_STAGE_FIRST,  /* first gratuitous ARP sent */
+	B1B_STAGE_LAST,  /* last gratuitous ARP sent */
+	B1B_STAGE_COUNT
+};
+
+/* Log-linear latency histogram (nanoseconds); see stats.c */
+#define B1B_HIST_SUB_BITS	2
+#define B1B_HIST_BUCKETS	(64 << B1B_HIST_SUB_BITS)
+
+struct b1b_hist {
+	uint64_t buckets[B1B_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+};
+
+/* Per-bond statistics; updated atomically (possibly by worker threads) */
+struct b1b_bond_stats {
+	struct b1b_hist hist[B1B_STAGE_COUNT];
+	struct b1b_hist burst;  /* duration of burst (FDB acquired to last) */
+	struct b1b_hist size;  /* destinations per burst (not nanoseconds) */
+	uint64_t failovers;
+	uint64_t frames;  /* gratuitous ARPs sent */
+	uint64_t errors;  /* gratuitous ARPs that could not be sent */
+	uint64_t dsts;  /* destinations (FDB entries) */
+	uint64_t fdb_bytes;  /* bytes received to get FDBs */
+};
+
+/* Progress of b1b_json_frame() through a partially received JSON value */
+struct b1b_json_frame {
+	size_t pos;  /* bytes scanned so far */
+	unsigned int depth;
+	_Bool in_string;
+	_Bool escape;
+};
+
+/* Transmit context (one per thread that sends frames) */
+struct b1b_xmit {
+	struct b1b_uring *uring;  /* NULL if not using io_uring */
+	struct b1b_garp_slot *slots;  /* io_uring frame arena */
+	unsigned int inflight;  /* io_uring requests not yet completed */
+	int sock;  /* ARP socket */
+};
+
 struct b1b_global_session {
 	struct mnl_socket *nlsock;  /* request/response netlink socket */
 	struct mnl_socket *mcsock;  /* multicast netlink socket */
+	struct mnl_socket *gensock;  /* generic netlink (OVS datapath) */
+	uint16_t ovs_flow_family;  /* generic netlink family IDs */
+	uint16_t ovs_vport_family;
 	char *ovssock_path;
+	struct json_tokener *ovstok;  /* reused for every JSON-RPC response */
+	struct b1b_event_src ovswatch_ev;  /* inotify (ovs-vswitchd restarts) */
+	struct b1b_event_src prefetch_ev;  /* OVS FDB prefetch timer */
+	struct b1b_event_src portmap_ev;  /* OVS port map refresh timer */
+	struct b1b_event_src ovsretry_ev;  /* ovs-vswitchd reconnect timer */
+	unsigned int ovsretries;  /* failed connection attempts; 0 = idle */
+	struct b1b_ovs_port *ovsports;  /* port map (from dpif/show) */
+	char *ovsportbuf;  /* dpif/show output; holds names in port map */
+	unsigned int ovspcount;  /* number of ports in port map */
+	unsigned int portmap_gen;  /* ovsgen when port map was loaded */
+	uint64_t portmap_req;  /* ID of dpif/show request; 0 if none */
+	char *ovsrbuf;  /* JSON-RPC responses (grows as needed) */
+	size_t ovsrsize;  /* size of ovsrbuf */
+	size_t ovsrlen;  /* bytes received into ovsrbuf */
+	size_t ovsrnext;  /* start of bytes after the last response */
+	struct b1b_json_frame ovsframe;  /* progress through next response */
+	struct b1b_event_src ovssock_ev;  /* ovs-vswitchd socket (background) */
+	unsigned int prefetches;  /* outstanding prefetch requests */
+	struct json_object *ovsjson;  /* last response, if parsed by json-c */
+	pid_t ovspid;  /* PID of ovs-vswitchd at last connection */
+	unsigned int ovsgen;  /* incremented when ovs-vswitchd PID changes */
+	uint64_t rxbytes;  /* netlink & JSON-RPC bytes received */
+	uint64_t nl_overflows;  /* multicast socket receive buffer overruns */
+	struct b1b_hist ovs_rpc;  /* ovs-vswitchd JSON-RPC latency */
+	struct timespec mc_time;  /* receipt of current multicast message(s) */
 	struct b1b_bond_session *bonds;  /* sorted array or linked list */
 	unsigned int bcount;  /* number of bonds */
 	size_t bufsize;
-	int arpsock;
+	struct b1b_event_src mc_ev;  /* multicast netlink socket */
+	struct b1b_event_src arp_ev;  /* ARP socket (only when blocked) */
+	struct b1b_event_src retry_ev;  /* ARP retry timer (after ENOBUFS) */
+	struct b1b_event_src uring_ev;  /* io_uring completions (if enabled) */
+	struct b1b_xmit xmit;
+	struct b1b_worker *workers;  /* transmit worker threads (if any) */
+	struct b1b_metrics *metrics;  /* metrics endpoint (if enabled) */
+	struct b1b_control *control;  /* control socket (if enabled) */
+	unsigned int wcount;  /* number of workers */
+	unsigned int pending;  /* number of suspended bursts */
+	int epfd;
 	int ovssock;
 	union {
 		struct nlmsghdr nlmsg;
@@ -56,6 +163,42 @@ struct b1b_global_session {
 	};
 };
 
+/* Parsed JSON-RPC response; strings point into the response buffer */
+struct b1b_jsonrpc_resp {
+	uint64_t id;
+	const char *result;  /* NULL if error response */
+	const char *error;  /* NULL if successful response */
+	size_t len;  /* length of result */
+};
+
+/* OVS datapath flow dump (see ovsdp.c) */
+struct b1b_ovsdp_dump {
+	struct b1b_bond_session *bs;
+	const uint32_t *ports;  /* datapath ports of bond's bridge (sorted) */
+	unsigned int nports;
+	uint32_t bond_port;  /* bond's datapath port */
+	uint32_t local_port;  /* bridge's internal port (if found) */
+	unsigned int count;  /* number of flows parsed */
+};
+
+/* State of an in-progress (possibly suspended) burst of gratuitous ARPs */
+struct b1b_burst {
+	struct timespec event;  /* failover notification received */
+	struct timespec start;  /* FDB acquired */
+	struct timespec first;  /* first frame sent */
+	struct savl_node *fdbtree;  /* destinations (owned by the burst) */
+	struct savl_node *next;  /* next destination; NULL if not in progress */
+	unsigned int sent;
+	unsigned int errors;  /* frames that could not be sent */
+	unsigned int dsts;  /* number of destinations */
+	size_t fdb_bytes;  /* bytes received to get FDB */
+	unsigned int retries;  /* consecutive retries of next destination */
+	unsigned int inflight;  /* io_uring requests not yet completed */
+	int32_t ifindex;  /* bond or active slave */
+	uint16_t pvid;  /* copied from bond session when burst starts */
+	char brname[IFNAMSIZ];  /* ditto; bs->brname can change (see ovs.c) */
+};
+
 struct b1b_bond_session {
 	char *brname;
 	char *ifname;
@@ -65,9 +208,22 @@ struct b1b_bond_session {
 		struct savl_node *fdbtree;
 		struct b1b_bond_session *next;
 	};
+	struct b1b_burst burst;
+	struct savl_node *fdbcache;  /* prefetched OVS FDB (if enabled) */
+	struct timespec cache_time;  /* when fdbcache was fetched */
+	struct timespec event_time;  /* when failover notification received */
+	struct b1b_bond_stats *stats;
+	size_t fdb_bytes;  /* FDB bytes received by b1b_ovs_pipeline_fdb() */
 	int32_t ifindex;  /* interface index of bond */
 	int32_t brindex;  /* index of bridge to which bond is attached */
 	uint32_t ofport;  /* only if bond is attached to an OVS switch */
+	struct b1b_ofconn *ofconn;  /* OpenFlow connection to bond's bridge */
+	unsigned int ovsgen;  /* gs->ovsgen when ofport was looked up */
+	uint64_t ovsreq;  /* ID of pipelined fdb/show request; 0 if none */
+	uint64_t prefetch_req;  /* ID of prefetch request; 0 if none */
+	_Bool fdb_ready;  /* fdbtree already filled by b1b_ovs_pipeline_fdb() */
+	int32_t active_slave;  /* from last RTM_NEWLINK; 0 if unknown */
+	uint16_t pvid;  /* bond's native (PVID & untagged) VLAN; 0 if none */
 	enum b1b_br_type brtype;
 	uint8_t mode;  /* must be 1 */
 	union {
@@ -95,6 +251,30 @@ struct b1b_dst_node {
 };
 
 
+/*
+ *
+ *	Command line options (set by main.c)
+ *
+ */
+
+extern _Bool b1b_slave_xmit;  /* send directly via the new active slave */
+extern _Bool b1b_qdisc_bypass;  /* set PACKET_QDISC_BYPASS on ARP socket */
+extern unsigned int b1b_nworkers;  /* transmit worker threads; 0 = none */
+extern _Bool b1b_io_uring;  /* send gratuitous ARPs via io_uring */
+extern unsigned int b1b_ovs_prefetch;  /* OVS FDB prefetch interval (secs) */
+extern _Bool b1b_ovs_datapath;  /* get OVS FDBs from kernel datapath flows */
+extern _Bool b1b_ovs_openflow;  /* send OVS GARPs via OpenFlow packet-out */
+extern const char *b1b_ovs_rundir;  /* ovs-vswitchd PID file & socket dir */
+extern const char *b1b_control_path;  /* control socket (or NULL) */
+extern const char *b1b_metrics_path;  /* metrics UNIX socket (or NULL) */
+extern unsigned int b1b_metrics_port;  /* metrics loopback TCP port (or 0) */
+extern const char *b1b_trace_path;  /* record netlink messages (or NULL) */
+extern const char *b1b_replay_path;  /* replay netlink messages (or NULL) */
+extern _Bool b1b_null_xmit;  /* don't actually send frames */
+extern _Bool b1b_dry_run;  /* announce every bond once (null xmit), exit */
+extern const char *b1b_pcap_path;  /* write frames to pcap (or NULL) */
+
+
 /*
  *
  *	Logging
@@ -102,6 +282,36 @@ struct b1b_dst_node {
  */
 
 extern _Bool b1b_debug;
+extern _Bool b1b_use_syslog;  /* prepend syslog-style priorities */
+extern _Bool b1b_log_json;  /* one JSON object per message */
+
+/* Structured fields of a message (only output in JSON mode) */
+enum b1b_log_ftype {
+	B1B_LOGF_TYPE_STR = 0,
+	B1B_LOGF_TYPE_UINT,
+	B1B_LOGF_TYPE_INT
+};
+
+struct b1b_log_field {
+	const char *key;  /* not escaped */
+	enum b1b_log_ftype type;
+	union {
+		const char *str;
+		uint64_t uint;
+		int64_t sint;
+	};
+};
+
+#define B1B_LOGF_STR(k, v)	\
+		{ .key = k, .type = B1B_LOGF_TYPE_STR, .str = v }
+#define B1B_LOGF_UINT(k, v)	\
+		{ .key = k, .type = B1B_LOGF_TYPE_UINT, .uint = v }
+#define B1B_LOGF_INT(k, v)	\
+		{ .key = k, .type = B1B_LOGF_TYPE_INT, .sint = v }
+
+void b1b_log_start(void);
+void b1b_log_stop(void);
+uint64_t b1b_log_dropped(void);
 
 __attribute__((format(printf, 4, 0)))
 void b1b_vlog(const char *restrict file, int line, int level,
@@ -109,11 +319,24 @@ void b1b_vlog(const char *restrict file, int line, int level,
 __attribute__((format(printf, 4, 5)))
 void b1b_log(const char *restrict file, int line, int level,
 	     const char *restrict format, ...);
+__attribute__((format(printf, 6, 7)))
+void b1b_log_fields(const char *restrict file, int line, int level,
+		    const struct b1b_log_field *fields, unsigned int count,
+		    const char *restrict format, ...);
+void b1b_log_garp(const char *restrict file, int line, int level,
+		  const char *what, const char *bond, const char *bridge,
+		  struct b1b_dst dst, int err);
 
 
 #define B1B_LOG(lvl, fmt, ...)	\
 		b1b_log(__FILE__, __LINE__, lvl, fmt, ##__VA_ARGS__)
 
+/* fields must be an array (not a pointer) */
+#define B1B_LOG_FIELDS(lvl, fields, fmt, ...)				\
+		b1b_log_fields(__FILE__, __LINE__, lvl, fields,		\
+			       sizeof fields / sizeof fields[0],	\
+			       fmt, ##__VA_ARGS__)
+
 #define B1B_ALERT(fmt, ...)	B1B_LOG(LOG_ALERT, fmt, ##__VA_ARGS__)
 #define B1B_CRIT(fmt, ...)	B1B_LOG(LOG_CRIT, fmt, ##__VA_ARGS__)
 #define B1B_ERR(fmt, ...)	B1B_LOG(LOG_ERR, fmt, ##__VA_ARGS__)
@@ -138,6 +361,25 @@ void b1b_log(const char *restrict file, int line, int level,
 		} while (0)
 
 
+/*
+ *
+ *	USDT probes (see ../bpftrace)
+ *
+ */
+
+/*
+ * Probes are a single nop instruction unless a tracer is attached.  They are
+ * built in if <sys/sdt.h> (systemtap-sdt-devel or systemtap-sdt-dev) is
+ * available, unless B1B_NO_USDT is defined.
+ */
+#if !defined(B1B_NO_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define B1B_PROBE(...)		STAP_PROBEV(b1b, __VA_ARGS__)
+#else
+#define B1B_PROBE(...)		do { } while (0)
+#endif
+
+
 /*
  *
  *	Memory allocation
@@ -158,14 +400,29 @@ int b1b_asprintf(const char *restrict file, const int line,
 		b1b_asprintf(__FILE__, __LINE__, sp, fmt, ##__VA_ARGS__)
 
 
+/*
+ *
+ *	Event loop
+ *
+ */
+
+void b1b_ev_add(struct b1b_global_session *gs, struct b1b_event_src *src,
+		uint32_t events);
+void b1b_ev_mod(struct b1b_global_session *gs, struct b1b_event_src *src,
+		uint32_t events);
+
+
 /*
  *	netlink.c
  */
 
 int b1b_bs_ifindex_cmp(const void *e1, const void *e2);
 void b1b_nlsock_open(struct b1b_global_session *gs);
+void b1b_gensock_open(struct b1b_global_session *gs);
 void b1b_mcsock_open(struct b1b_global_session *gs);
 int b1b_nlmsg_req(struct b1b_global_session *gs, mnl_cb_t msg_cb, void *data);
+int b1b_genmsg_req(struct b1b_global_session *gs, mnl_cb_t msg_cb, void *data);
+uint16_t b1b_genl_family(struct b1b_global_session *gs, const char *name);
 void b1b_mcast_process(struct b1b_global_session *gs);
 int b1b_getlink(struct b1b_global_session *gs, const char *restrict ifname,
 		int32_t ifindex, mnl_cb_t msg_cb, void *data);
@@ -174,12 +431,50 @@ int b1b_getlink(struct b1b_global_session *gs, const char *restrict ifname,
  *	bridge.c
  */
 void b1b_br_get_fdb(struct b1b_global_session *gs, struct b1b_bond_session *bs);
+int b1b_br_fdb_msg_cb(const struct nlmsghdr *nlmsg, void *data);
+void b1b_br_get_pvid(struct b1b_global_session *gs,
+		     struct b1b_bond_session *bs);
+int b1b_br_port_pvid(struct b1b_bond_session *bs,
+		     const struct nlmsghdr *nlmsg);
 
 /*
  *	ovs.c
  */
 void b1b_get_ovs_info(struct b1b_global_session *gs,
 		      struct b1b_bond_session *bs);
+void b1b_ovs_close(struct b1b_global_session *gs);
+void b1b_ovs_pipeline_fdb(struct b1b_global_session *gs);
+int b1b_ovs_parse_fdb(struct b1b_bond_session *bs, const char *p, size_t len);
+unsigned int b1b_ovs_br_dpports(const struct b1b_global_session *gs,
+				const char *brname, uint32_t **dpports);
+
+/*
+ *	jsonrpc.c
+ */
+size_t b1b_jsonrpc_req(char *buf, size_t size, uint64_t id,
+		       const char *restrict method, const char *restrict param);
+int b1b_json_frame(struct b1b_json_frame *frame, const char *buf, size_t len);
+int b1b_jsonrpc_scan(char *buf, size_t len, struct b1b_jsonrpc_resp *resp);
+
+/*
+ *	openflow.c
+ */
+struct b1b_ofconn *b1b_of_connect(const char *brname);
+void b1b_of_close(struct b1b_ofconn **conn);
+_Bool b1b_of_queue(struct b1b_ofconn *conn, uint16_t port, const void *frame,
+		   size_t len);
+int b1b_of_flush(struct b1b_ofconn *conn);
+int b1b_of_barrier(struct b1b_ofconn *conn);
+const uint32_t *b1b_of_rejected(const struct b1b_ofconn *conn);
+uint32_t b1b_of_next_xid(const struct b1b_ofconn *conn);
+_Bool b1b_of_port_ok(uint32_t ofport);
+
+/*
+ *	ovsdp.c
+ */
+int b1b_ovsdp_get_fdb(struct b1b_global_session *gs,
+		      struct b1b_bond_session *bs);
+int b1b_ovsdp_flow_msg_cb(const struct nlmsghdr *nlmsg, void *data);
 
 /*
  *	bond.c
@@ -188,16 +483,97 @@ void b1b_detect_bonds(struct b1b_global_session *gs);
 void b1b_parse_bonds(struct b1b_global_session *gs, const int argc,
 		     char **argv, int bindex);
 
+/*
+ *	control.c
+ */
+void b1b_control_open(struct b1b_global_session *gs);
+void b1b_control_close(struct b1b_global_session *gs);
+
 /*
  *	fdbtree.c
  */
 void b1b_fdb_add(struct b1b_bond_session *bs, union b1b_fdb_dst dst);
-void b1b_fdb_free(struct b1b_bond_session *bs);
+void b1b_fdb_free(struct savl_node **fdbtree);
 
 /*
  *	garp.c
  */
+void b1b_xmit_init(struct b1b_xmit *xmit);
+void b1b_xmit_fini(struct b1b_xmit *xmit);
+void b1b_xmit_wait(struct b1b_xmit *xmit, int reason);
 void b1b_arpsock_open(struct b1b_global_session *gs);
+int b1b_garp_burst(struct b1b_xmit *xmit, const struct b1b_bond_session *bs,
+		   struct b1b_burst *burst);
+void b1b_garp_orphan(struct b1b_xmit *xmit, const struct b1b_burst *burst);
 void b1b_send_garps(struct b1b_global_session *gs, struct b1b_bond_session *bs);
 
+/*
+ *	metrics.c
+ */
+void b1b_metrics_open(struct b1b_global_session *gs);
+void b1b_metrics_close(struct b1b_global_session *gs);
+
+/*
+ *	pcap.c
+ */
+void b1b_pcap_open(void);
+void b1b_pcap_close(void);
+void b1b_pcap_write(const void *frame, size_t len);
+
+/*
+ *	trace.c
+ */
+enum b1b_trace_src {
+	B1B_TRACE_MCAST = 0,
+	B1B_TRACE_ROUTE,
+	B1B_TRACE_GENL,
+	B1B_TRACE_SRC_COUNT
+};
+void b1b_trace_open(void);
+void b1b_trace_close(void);
+void b1b_trace_record(enum b1b_trace_src src, _Bool batch,
+		      const struct timespec *time, const void *buf,
+		      ssize_t len);
+ssize_t b1b_trace_read(struct b1b_global_session *gs, enum b1b_trace_src src,
+		       _Bool first);
+void b1b_trace_replay(struct b1b_global_session *gs);
+
+/*
+ *	stats.c
+ */
+int64_t b1b_ns_between(const struct timespec *start,
+		       const struct timespec *end);
+const char *b1b_stage_name(enum b1b_stage stage);
+unsigned int b1b_hist_bucket(uint64_t ns);
+uint64_t b1b_hist_lower(unsigned int bucket);
+void b1b_hist_add(struct b1b_hist *hist, int64_t ns);
+void b1b_stats_init(struct b1b_global_session *gs);
+void b1b_stats_free(struct b1b_global_session *gs);
+void b1b_stats_burst(const struct b1b_bond_session *bs,
+		     const struct b1b_burst *burst,
+		     const struct timespec *end);
+void b1b_stats_print(FILE *f, const struct b1b_global_session *gs);
+void b1b_stats_log(const struct b1b_global_session *gs);
+
+/*
+ *	uring.c
+ */
+struct b1b_uring *b1b_uring_new(unsigned int entries, int sock);
+void b1b_uring_free(struct b1b_uring *ring);
+int b1b_uring_fd(const struct b1b_uring *ring);
+void b1b_uring_sendmsg(struct b1b_uring *ring, const struct msghdr *msg,
+		       uint64_t user_data);
+void b1b_uring_submit(struct b1b_uring *ring, _Bool wait);
+_Bool b1b_uring_reap(struct b1b_uring *ring, uint64_t *user_data,
+		     int32_t *res);
+
+/*
+ *	worker.c
+ */
+void b1b_workers_start(struct b1b_global_session *gs);
+void b1b_workers_stop(struct b1b_global_session *gs);
+_Bool b1b_worker_submit(struct b1b_global_session *gs,
+			const struct b1b_bond_session *bs,
+			const struct b1b_burst *burst);
+
 #endif  /* B1B_H_INCLUDED */
@@ -142,6 +142,7 @@ static _Bool b1b_get_bridge_info(struct b1b_global_session *const gs,
 
 	if (bs->brtype == B1B_BR_TYPE_LINUX) {
 		bs->getfdb = b1b_br_get_fdb;
+		b1b_br_get_pvid(gs, bs);
 		return 1;
 	}
 	else if (bs->brtype == B1B_BR_TYPE_OVS) {
@@ -477,8 +478,10 @@ void b1b_detect_bonds(struct b1b_global_session *const gs)
 	gs->bonds = B1B_ZALLOC(gs->bcount * sizeof *gs->bonds);
 
 	for (i = 0, bs = list; bs != NULL; bs = bs->next) {
-		if (bs->on_bridge)
-			gs->bonds[i++] = *bs;
+		if (bs->on_bridge) {
+			gs->bonds[i] = *bs;
+			gs->bonds[i++].fdbtree = NULL;  /* was bs->next */
+		}
 	}
 
 	for (bs = list; bs != NULL; bs = next) {
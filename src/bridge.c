@@ -13,9 +13,128 @@
 
 #include <string.h>
 
+#include <linux/if_bridge.h>
 #include <linux/rtnetlink.h>
 
 
+/*
+ *
+ *	Get the native VLAN (PVID) of a bond's Linux bridge port
+ *
+ */
+
+static int b1b_br_vlan_attr_cb(const struct nlattr *const attr,
+			       void *const data)
+{
+	static const uint16_t native_flags =
+		BRIDGE_VLAN_INFO_PVID | BRIDGE_VLAN_INFO_UNTAGGED;
+
+	struct b1b_bond_session *const bs = data;
+	const struct bridge_vlan_info *vinfo;
+
+	if (attr->nla_type != IFLA_BRIDGE_VLAN_INFO)
+		return MNL_CB_OK;
+
+	if (mnl_attr_get_payload_len(attr) < sizeof *vinfo)
+		return MNL_CB_ERROR;
+
+	vinfo = mnl_attr_get_payload(attr);
+
+	/*
+	 * Frames in the PVID are only sent untagged if the port is also an
+	 * untagged member of that VLAN.  (Otherwise, the switch will see
+	 * untagged frames as belonging to a different VLAN.)
+	 */
+	if ((vinfo->flags & native_flags) == native_flags) {
+		bs->pvid = vinfo->vid;
+		return MNL_CB_STOP;
+	}
+
+	return MNL_CB_OK;
+}
+
+static int b1b_br_port_attr_cb(const struct nlattr *const attr,
+			       void *const data)
+{
+	if (attr->nla_type == IFLA_AF_SPEC)
+		return mnl_attr_parse_nested(attr, b1b_br_vlan_attr_cb, data);
+
+	return MNL_CB_OK;
+}
+
+/*
+ * Set the bond's PVID from an AF_BRIDGE RTM_NEWLINK message for its bridge port
+ * (a dump reply or a notification).  Returns MNL_CB_ERROR if the message can't
+ * be parsed.
+ */
+int b1b_br_port_pvid(struct b1b_bond_session *const bs,
+		     const struct nlmsghdr *const nlmsg)
+{
+	uint16_t pvid;
+	int result;
+
+	pvid = bs->pvid;
+	bs->pvid = 0;
+
+	result = mnl_attr_parse(nlmsg, MNL_ALIGN(sizeof(struct ifinfomsg)),
+				b1b_br_port_attr_cb, bs);
+	if (result <= MNL_CB_ERROR)
+		return MNL_CB_ERROR;
+
+	if (bs->pvid != pvid) {
+		B1B_DEBUG("Native VLAN of %s is %" PRIu16 " (was %" PRIu16 ")",
+			  bs->ifname, bs->pvid, pvid);
+	}
+
+	return MNL_CB_OK;
+}
+
+static int b1b_br_port_msg_cb(const struct nlmsghdr *const nlmsg,
+			      void *const data)
+{
+	struct b1b_bond_session *const bs = data;
+	const struct ifinfomsg *ifi;
+
+	if (nlmsg->nlmsg_type != RTM_NEWLINK)
+		return MNL_CB_OK;
+
+	B1B_ASSERT(nlmsg->nlmsg_len >= MNL_NLMSG_HDRLEN + sizeof *ifi);
+	ifi = mnl_nlmsg_get_payload(nlmsg);
+
+	/* Bridge port dumps can't be filtered by the kernel */
+	if (ifi->ifi_index != bs->ifindex)
+		return MNL_CB_OK;
+
+	return b1b_br_port_pvid(bs, nlmsg);
+}
+
+/*
+ * Called once, when the bond is set up.  The bridge notifies RTNLGRP_LINK
+ * listeners (with an AF_BRIDGE RTM_NEWLINK message) whenever the port's VLAN
+ * configuration changes, so the PVID is kept up to date by b1b_mc_msg_cb(),
+ * rather than dumping every bridge port on the system during a failover.
+ */
+void b1b_br_get_pvid(struct b1b_global_session *const gs,
+		     struct b1b_bond_session *const bs)
+{
+	struct ifinfomsg *ifi;
+
+	bs->pvid = 0;
+
+	mnl_nlmsg_put_header(gs->buf);
+	gs->nlmsg.nlmsg_type = RTM_GETLINK;
+	gs->nlmsg.nlmsg_flags = NLM_F_DUMP;
+	ifi = mnl_nlmsg_put_extra_header(&gs->nlmsg, sizeof *ifi);
+	ifi->ifi_family = AF_BRIDGE;
+	mnl_attr_put_u32(&gs->nlmsg, IFLA_EXT_MASK, RTEXT_FILTER_BRVLAN);
+
+	if (b1b_nlmsg_req(gs, b1b_br_port_msg_cb, bs) < 0) {
+		B1B_FATAL("Failed to get VLAN information for bridge port: %s",
+			  bs->ifname);
+	}
+}
+
+
 /*
  *
  *	Get the forwarding database of a Linux bridge
@@ -37,8 +156,7 @@ static int b1b_br_fdb_attr_cb(const struct nlattr *const attr, void *const data)
 	return MNL_CB_OK;
 }
 
-static int b1b_br_fdb_msg_cb(const struct nlmsghdr *const nlmsg,
-			     void *const data)
+int b1b_br_fdb_msg_cb(const struct nlmsghdr *const nlmsg, void *const data)
 {
 	static const union b1b_fdb_dst mac_mask = {
 		.dst = {
@@ -0,0 +1,649 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	control.c - runtime control socket (-c/--control)
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#define _GNU_SOURCE  /* for open_memstream() */
+
+#include "b1b.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+/*
+ * A line-oriented protocol on a UNIX socket.  Each command is a single line;
+ * its response is zero or more lines of output, followed by a line that is
+ * either "OK" or "ERROR: <reason>".  Commands are handled in the main event
+ * loop, one line at a time, and the socket is non-blocking, so a slow client
+ * can't stall the daemon.  (Commands that send gratuitous ARPs or fetch
+ * forwarding databases take as long as they would during a failover.)
+ *
+ *   help                  list commands
+ *   bonds                 show monitored bonds
+ *   fdb BOND              show destinations (prefetched, if available)
+ *   announce BOND|all     send gratuitous ARPs now
+ *   debug on|off          enable or disable debug logging
+ *   stats                 show statistics
+ *   quit                  close the connection
+ */
+
+/* Maximum number of simultaneous connections; the oldest is dropped */
+#define B1B_CTL_MAX_CONNS	4
+
+/* Maximum length of a command line (including newline) */
+#define B1B_CTL_LINE_MAX	256
+
+struct b1b_ctl_conn {
+	struct b1b_event_src ev;  /* must be first; cb is NULL if not in use */
+	struct timespec accepted;
+	char *out;  /* response bytes not yet sent */
+	size_t out_len;
+	size_t out_sent;
+	size_t in_len;
+	uint32_t events;  /* EPOLLIN or EPOLLOUT */
+	_Bool quit;  /* close after sending output */
+	char in[B1B_CTL_LINE_MAX];
+};
+
+struct b1b_control {
+	struct b1b_event_src listen_ev;
+	struct b1b_ctl_conn conns[B1B_CTL_MAX_CONNS];
+};
+
+
+/*
+ *
+ *	Commands
+ *
+ */
+
+static const char *const b1b_ctl_brtypes[] = {
+	[B1B_BR_TYPE_NONE]	= "none",
+	[B1B_BR_TYPE_LINUX]	= "linux",
+	[B1B_BR_TYPE_OVS]	= "ovs",
+	[B1B_BR_TYPE_OTHER]	= "other"
+};
+
+static struct b1b_bond_session *b1b_ctl_find(
+				struct b1b_global_session *const gs,
+				const char *const ifname)
+{
+	unsigned int i;
+
+	for (i = 0; i < gs->bcount; ++i) {
+		if (strcmp(gs->bonds[i].ifname, ifname) == 0)
+			return gs->bonds + i;
+	}
+
+	return NULL;
+}
+
+static const char *b1b_ctl_help(FILE *const f,
+				struct b1b_global_session *const gs
+						__attribute__((unused)),
+				const char *const arg __attribute__((unused)))
+{
+	fputs("help\n"
+	      "bonds\n"
+	      "fdb BOND\n"
+	      "announce BOND|all\n"
+	      "debug on|off\n"
+	      "stats\n"
+	      "quit\n", f);
+
+	return NULL;
+}
+
+static const char *b1b_ctl_bonds(FILE *const f,
+				 struct b1b_global_session *const gs,
+				 const char *const arg __attribute__((unused)))
+{
+	const struct b1b_bond_session *bs;
+	struct timespec now;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (i = 0; i < gs->bcount; ++i) {
+
+		bs = gs->bonds + i;
+
+		fprintf(f, "%s: index %" PRId32 ", bridge %s (index %" PRId32
+				", %s), active slave %" PRId32
+				", pvid %" PRIu16,
+			bs->ifname, bs->ifindex, bs->brname, bs->brindex,
+			b1b_ctl_brtypes[bs->brtype], bs->active_slave,
+			bs->pvid);
+
+		if (bs->brtype == B1B_BR_TYPE_OVS) {
+			fprintf(f, ", ofport %" PRIu32 ", openflow %s",
+				bs->ofport,
+				bs->ofconn != NULL ? "connected" : "no");
+		}
+
+		if (bs->fdbcache != NULL) {
+			fprintf(f, ", fdb cache age %" PRId64 " ms",
+				b1b_ns_between(&bs->cache_time, &now)
+					/ 1000000);
+		}
+
+		if (bs->burst.next != NULL || bs->burst.inflight != 0) {
+			fprintf(f, ", burst suspended (%u sent)",
+				bs->burst.sent);
+		}
+
+		fputc('\n', f);
+	}
+
+	return NULL;
+}
+
+/* Returns the number of destinations */
+static unsigned int b1b_ctl_print_fdb(FILE *const f,
+				      struct savl_node *const fdbtree)
+{
+	const struct b1b_dst_node *dn;
+	struct savl_node *node;
+	unsigned int count;
+
+	for (node = savl_first(fdbtree), count = 0; node != NULL;
+					node = savl_next(node), ++count) {
+
+		dn = SAVL_NODE_CONTAINER(node, struct b1b_dst_node, avl);
+
+		fprintf(f, "%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
+				":%02" PRIx8 ":%02" PRIx8 " vlan %" PRIu16 "\n",
+			dn->dst.dst.mac[0], dn->dst.dst.mac[1],
+			dn->dst.dst.mac[2], dn->dst.dst.mac[3],
+			dn->dst.dst.mac[4], dn->dst.dst.mac[5],
+			dn->dst.dst.vlan);
+	}
+
+	fprintf(f, "%u destination(s)\n", count);
+
+	return count;
+}
+
+/*
+ * Show the prefetched OVS FDB if there is one; otherwise fetch the FDB, just
+ * as a failover would (without using up a prefetched result), and show how
+ * long that took.
+ */
+static const char *b1b_ctl_fdb(FILE *const f,
+			       struct b1b_global_session *const gs,
+			       const char *const arg)
+{
+	struct b1b_bond_session *bs;
+	struct timespec start, end;
+	unsigned int count;
+	uint64_t rxbytes;
+	int64_t ns;
+
+	if (arg == NULL)
+		return "Missing bond name";
+
+	if ((bs = b1b_ctl_find(gs, arg)) == NULL)
+		return "Unknown bond";
+
+	if (bs->fdbcache != NULL) {
+		fputs("(prefetched)\n", f);
+		b1b_ctl_print_fdb(f, bs->fdbcache);
+		return NULL;
+	}
+
+	rxbytes = gs->rxbytes;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bs->getfdb(gs, bs);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	count = b1b_ctl_print_fdb(f, bs->fdbtree);
+	b1b_fdb_free(&bs->fdbtree);
+
+	/* Same accounting as b1b_send_garps() */
+	rxbytes = bs->fdb_bytes + (gs->rxbytes - rxbytes);
+	bs->fdb_bytes = 0;
+	ns = b1b_ns_between(&start, &end);
+
+	fprintf(f, "Fetched in %" PRId64 " us, %" PRIu64 " byte(s)", ns / 1000,
+		rxbytes);
+
+	if (count != 0) {
+		fprintf(f, ", %" PRId64 " ns/destination, %" PRIu64
+				" byte(s)/destination",
+			ns / count, rxbytes / count);
+	}
+
+	fputc('\n', f);
+
+	return NULL;
+}
+
+/* Counted (in statistics) as a failover, timed from receipt of the command */
+static void b1b_ctl_announce_bond(struct b1b_global_session *const gs,
+				  struct b1b_bond_session *const bs)
+{
+	B1B_INFO("Sending gratuitous ARPs for %s (control socket)", bs->ifname);
+	clock_gettime(CLOCK_MONOTONIC, &bs->event_time);
+	b1b_send_garps(gs, bs);
+}
+
+static const char *b1b_ctl_announce(FILE *const f,
+				    struct b1b_global_session *const gs,
+				    const char *const arg)
+{
+	struct b1b_bond_session *bs;
+	unsigned int i;
+
+	if (arg == NULL)
+		return "Missing bond name";
+
+	if (strcmp(arg, "all") == 0) {
+		for (i = 0; i < gs->bcount; ++i)
+			b1b_ctl_announce_bond(gs, gs->bonds + i);
+		fprintf(f, "%u bond(s)\n", gs->bcount);
+		return NULL;
+	}
+
+	if ((bs = b1b_ctl_find(gs, arg)) == NULL)
+		return "Unknown bond";
+
+	b1b_ctl_announce_bond(gs, bs);
+
+	return NULL;
+}
+
+static const char *b1b_ctl_debug(FILE *const f __attribute__((unused)),
+				 struct b1b_global_session *const gs
+						__attribute__((unused)),
+				 const char *const arg)
+{
+	if (arg == NULL)
+		return "Missing argument (on|off)";
+
+	if (strcmp(arg, "on") == 0)
+		b1b_debug = 1;
+	else if (strcmp(arg, "off") == 0)
+		b1b_debug = 0;
+	else
+		return "Invalid argument (must be on|off)";
+
+	B1B_INFO("Debug logging %s (control socket)", arg);
+
+	return NULL;
+}
+
+static const char *b1b_ctl_stats(FILE *const f,
+				 struct b1b_global_session *const gs,
+				 const char *const arg __attribute__((unused)))
+{
+	b1b_stats_print(f, gs);
+
+	if (gs->nl_overflows != 0) {
+		fprintf(f, "Netlink multicast overruns: %" PRIu64 "\n",
+			gs->nl_overflows);
+	}
+
+	return NULL;
+}
+
+static const struct {
+	const char *name;
+	const char *(*fn)(FILE *f, struct b1b_global_session *gs,
+			  const char *arg);
+} b1b_ctl_cmds[] = {
+	{ "help",	b1b_ctl_help },
+	{ "bonds",	b1b_ctl_bonds },
+	{ "fdb",	b1b_ctl_fdb },
+	{ "announce",	b1b_ctl_announce },
+	{ "debug",	b1b_ctl_debug },
+	{ "stats",	b1b_ctl_stats }
+};
+
+/* Execute a command line, and append its response to the connection's output */
+static void b1b_ctl_exec(struct b1b_global_session *const gs,
+			 struct b1b_ctl_conn *const conn, char *const line)
+{
+	const char *cmd, *arg, *err;
+	char *saveptr, *buf;
+	unsigned int i;
+	size_t len;
+	FILE *f;
+
+	if ((cmd = strtok_r(line, " \t\r", &saveptr)) == NULL)
+		return;
+
+	arg = strtok_r(NULL, " \t\r", &saveptr);
+
+	if (strcmp(cmd, "quit") == 0) {
+		conn->quit = 1;
+		return;
+	}
+
+	if ((f = open_memstream(&buf, &len)) == NULL)
+		B1B_FATAL("Failed to create memory stream: %m");
+
+	for (i = 0; i < sizeof b1b_ctl_cmds / sizeof b1b_ctl_cmds[0]; ++i) {
+		if (strcmp(cmd, b1b_ctl_cmds[i].name) == 0)
+			break;
+	}
+
+	if (i == sizeof b1b_ctl_cmds / sizeof b1b_ctl_cmds[0])
+		err = "Unknown command";
+	else
+		err = b1b_ctl_cmds[i].fn(f, gs, arg);
+
+	if (err != NULL)
+		fprintf(f, "ERROR: %s\n", err);
+	else
+		fputs("OK\n", f);
+
+	if (fclose(f) != 0)
+		B1B_FATAL("Failed to format control response: %m");
+
+	conn->out = realloc(conn->out, conn->out_len + len);
+	if (conn->out == NULL)
+		B1B_FATAL("Cannot allocate %zu bytes: %m", conn->out_len + len);
+
+	memcpy(conn->out + conn->out_len, buf, len);
+	conn->out_len += len;
+	free(buf);
+}
+
+
+/*
+ *
+ *	Connections
+ *
+ */
+
+static void b1b_ctl_drop(struct b1b_ctl_conn *const conn)
+{
+	if (close(conn->ev.fd) < 0)
+		B1B_ERR("Failed to close control connection: %m");
+
+	free(conn->out);
+	conn->out = NULL;
+	conn->ev.cb = NULL;
+}
+
+/*
+ * Execute any complete lines in the input buffer.  Returns false if the
+ * connection should be dropped.
+ */
+static _Bool b1b_ctl_lines(struct b1b_global_session *const gs,
+			   struct b1b_ctl_conn *const conn)
+{
+	char *nl;
+	size_t len;
+
+	while (!conn->quit
+		&& (nl = memchr(conn->in, '\n', conn->in_len)) != NULL) {
+
+		*nl = 0;
+		len = nl + 1 - conn->in;
+		b1b_ctl_exec(gs, conn, conn->in);
+
+		memmove(conn->in, conn->in + len, conn->in_len - len);
+		conn->in_len -= len;
+	}
+
+	if (conn->in_len == sizeof conn->in) {
+		B1B_DEBUG("Control command too long");
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Read and execute commands until there is output to send (returns 1), no more
+ * input is available (returns 0), or the connection should be dropped (returns
+ * -1).
+ */
+static int b1b_ctl_read(struct b1b_global_session *const gs,
+			struct b1b_ctl_conn *const conn)
+{
+	ssize_t bytes;
+
+	/* Don't read more commands until the output has been sent */
+	while (conn->out_len == 0 && !conn->quit) {
+
+		bytes = recv(conn->ev.fd, conn->in + conn->in_len,
+			     sizeof conn->in - conn->in_len, 0);
+
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			B1B_DEBUG("Failed to read control command: %m");
+			return -1;
+		}
+
+		if (bytes == 0)
+			return -1;
+
+		conn->in_len += bytes;
+
+		if (!b1b_ctl_lines(gs, conn))
+			return -1;
+	}
+
+	return 1;
+}
+
+/* Returns false if the connection failed */
+static _Bool b1b_ctl_write(struct b1b_ctl_conn *const conn)
+{
+	ssize_t bytes;
+
+	while (conn->out_sent < conn->out_len) {
+
+		bytes = send(conn->ev.fd, conn->out + conn->out_sent,
+			     conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 1;
+			B1B_DEBUG("Failed to send control response: %m");
+			return 0;
+		}
+
+		conn->out_sent += bytes;
+	}
+
+	free(conn->out);
+	conn->out = NULL;
+	conn->out_len = conn->out_sent = 0;
+
+	return 1;
+}
+
+static void b1b_ctl_conn_cb(struct b1b_global_session *const gs,
+			    struct b1b_event_src *const src,
+			    const uint32_t events __attribute__((unused)))
+{
+	struct b1b_ctl_conn *const conn = (struct b1b_ctl_conn *)src;
+	uint32_t wanted;
+	int result;
+
+	while (1) {
+
+		/* Commands that arrived while output was pending come first */
+		if (!b1b_ctl_lines(gs, conn)
+				|| (result = b1b_ctl_read(gs, conn)) < 0
+				|| !b1b_ctl_write(conn)) {
+			b1b_ctl_drop(conn);
+			return;
+		}
+
+		if (conn->out_len != 0)
+			break;  /* socket buffer is full */
+
+		if (conn->quit) {
+			b1b_ctl_drop(conn);
+			return;
+		}
+
+		if (result == 0)
+			break;  /* no more input */
+	}
+
+	wanted = conn->out_len != 0 ? EPOLLOUT : EPOLLIN;
+
+	if (wanted != conn->events) {
+		b1b_ev_mod(gs, &conn->ev, wanted);
+		conn->events = wanted;
+	}
+}
+
+static void b1b_ctl_accept_cb(struct b1b_global_session *const gs,
+			      struct b1b_event_src *const src,
+			      const uint32_t events __attribute__((unused)))
+{
+	struct b1b_control *const ctl = gs->control;
+	struct b1b_ctl_conn *conn;
+	unsigned int i;
+	int fd;
+
+	while (1) {
+
+		fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN) {
+				B1B_ERR("Failed to accept control connection: "
+						"%m");
+			}
+			return;
+		}
+
+		/* Use a free slot, or the oldest connection's slot */
+		for (i = 0, conn = ctl->conns; i < B1B_CTL_MAX_CONNS; ++i) {
+
+			if (ctl->conns[i].ev.cb == NULL) {
+				conn = ctl->conns + i;
+				break;
+			}
+
+			if (b1b_ns_between(&ctl->conns[i].accepted,
+					   &conn->accepted) > 0) {
+				conn = ctl->conns + i;
+			}
+		}
+
+		if (conn->ev.cb != NULL) {
+			B1B_DEBUG("Too many control connections; "
+					"dropping oldest");
+			b1b_ctl_drop(conn);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &conn->accepted);
+		conn->in_len = 0;
+		conn->out_len = conn->out_sent = 0;
+		conn->quit = 0;
+		conn->events = EPOLLIN;
+		conn->ev.cb = b1b_ctl_conn_cb;
+		conn->ev.fd = fd;
+		b1b_ev_add(gs, &conn->ev, EPOLLIN);
+	}
+}
+
+
+/*
+ *
+ *	Open & close the socket
+ *
+ */
+
+void b1b_control_open(struct b1b_global_session *const gs)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct b1b_control *ctl;
+	struct stat st;
+	mode_t mask;
+	int sock;
+
+	if (b1b_control_path == NULL)
+		return;
+
+	if (strlen(b1b_control_path) >= sizeof sun.sun_path)
+		B1B_FATAL("Control socket path too long: %s", b1b_control_path);
+
+	strcpy(sun.sun_path, b1b_control_path);
+
+	/* Remove a stale socket from a previous run (but nothing else) */
+	if (lstat(b1b_control_path, &st) == 0 && S_ISSOCK(st.st_mode)
+			&& unlink(b1b_control_path) < 0) {
+		B1B_FATAL("Failed to remove stale control socket: %s: %m",
+			  b1b_control_path);
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		B1B_FATAL("Failed to create control socket: %m");
+
+	/* Commands can send frames, so only the owner may connect */
+	mask = umask(0077);
+
+	if (bind(sock, (struct sockaddr *)&sun, sizeof sun) < 0) {
+		B1B_FATAL("Failed to bind control socket: %s: %m",
+			  b1b_control_path);
+	}
+
+	umask(mask);
+
+	if (listen(sock, B1B_CTL_MAX_CONNS) < 0)
+		B1B_FATAL("Failed to listen on control socket: %m");
+
+	ctl = B1B_ZALLOC(sizeof *ctl);
+	ctl->listen_ev.cb = b1b_ctl_accept_cb;
+	ctl->listen_ev.fd = sock;
+	gs->control = ctl;
+	b1b_ev_add(gs, &ctl->listen_ev, EPOLLIN);
+
+	B1B_INFO("Listening for control connections on %s", b1b_control_path);
+}
+
+void b1b_control_close(struct b1b_global_session *const gs)
+{
+	struct b1b_control *const ctl = gs->control;
+	unsigned int i;
+
+	if (ctl == NULL)
+		return;
+
+	for (i = 0; i < B1B_CTL_MAX_CONNS; ++i) {
+		if (ctl->conns[i].ev.cb != NULL)
+			b1b_ctl_drop(ctl->conns + i);
+	}
+
+	if (close(ctl->listen_ev.fd) < 0)
+		B1B_ERR("Failed to close control socket: %m");
+
+	if (unlink(b1b_control_path) < 0) {
+		B1B_ERR("Failed to remove control socket: %s: %m",
+			b1b_control_path);
+	}
+
+	free(ctl);
+	gs->control = NULL;
+}
@@ -17,24 +17,34 @@
 #endif
 
 
+/*
+ * Destinations are ordered by VLAN first, so that each VLAN's destinations are
+ * contiguous when the tree is walked by b1b_send_garps().
+ */
 static int b1b_fdb_cmp_cb(const union savl_key key,
 			  const struct savl_node *const node)
 {
 	const struct b1b_dst_node *dn;
-	uint64_t k64;
+	union b1b_fdb_dst k;
 
 	dn = SAVL_NODE_CONTAINER(node, struct b1b_dst_node, avl);
 
 #ifdef B1B_DST_IN_KEY
-	k64 = key.u;
+	k.u64 = key.u;
 #else
-	k64 = *(const uint64_t *)key.p;
+	k.u64 = *(const uint64_t *)key.p;
 #endif
 
-	if (k64 < dn->dst.u64)
+	if (k.dst.vlan < dn->dst.dst.vlan)
 		return -1;
 
-	if (k64 > dn->dst.u64)
+	if (k.dst.vlan > dn->dst.dst.vlan)
+		return 1;
+
+	if (k.u64 < dn->dst.u64)
+		return -1;
+
+	if (k.u64 > dn->dst.u64)
 		return 1;
 
 	return 0;
@@ -50,6 +60,8 @@ void b1b_fdb_add(struct b1b_bond_session *const bs, const union b1b_fdb_dst dst)
 	struct b1b_dst_node *dn;
 	union savl_key key;
 
+	B1B_PROBE(fdb__add, bs->ifname, dst.dst.mac, dst.dst.vlan);
+
 	dn = B1B_ZALLOC(sizeof *dn);
 	dn->dst = dst;
 
@@ -71,10 +83,10 @@ void b1b_fdb_add(struct b1b_bond_session *const bs, const union b1b_fdb_dst dst)
 	}
 }
 
-void b1b_fdb_free(struct b1b_bond_session *const bs)
+void b1b_fdb_free(struct savl_node **const fdbtree)
 {
-	if (bs->fdbtree != NULL) {
-		savl_free(&bs->fdbtree, b1b_fdb_free_cb);
-		bs->fdbtree = NULL;
+	if (*fdbtree != NULL) {
+		savl_free(fdbtree, b1b_fdb_free_cb);
+		*fdbtree = NULL;
 	}
 }
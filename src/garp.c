@@ -11,7 +11,18 @@
 
 #include "b1b.h"
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include <netinet/ip.h>
 #include <net/ethernet.h>
@@ -30,6 +41,18 @@
 #error "__BYTE_ORDER__ is not __ORDER_BIG_ENDIAN__ or __ORDER_LITTLE_ENDIAN__"
 #endif
 
+/* Requested ARP socket send buffer size; enough for a few thousand frames */
+#define B1B_ARP_SNDBUF		(4 * 1024 * 1024)
+
+/* Delay before retrying after ENOBUFS (qdisc or driver queue full) */
+#define B1B_GARP_RETRY_NS	1000000
+
+/* Give up on a destination after this many consecutive retries */
+#define B1B_GARP_MAX_RETRIES	100
+
+/* Number of frames that can be in flight at once when using io_uring */
+#define B1B_URING_SLOTS		256
+
 
 /* First 12 bytes of ARP frame */
 struct b1b_eth_macs {
@@ -62,26 +85,58 @@ __attribute__((packed));
 _Static_assert(sizeof(struct b1b_arp) == 30, "struct b1b_arp size");
 
 
-void b1b_arpsock_open(struct b1b_global_session *const gs)
-{
-	if ((gs->arpsock = socket(AF_PACKET, SOCK_RAW, 0)) < 0)
-		B1B_FATAL("Failed to create ARP socket: %m");
-}
+/*
+ *
+ *	Frame construction
+ *
+ */
 
-static void b1b_send_garp(const struct b1b_global_session *const gs,
-			  const struct b1b_bond_session *const bs,
-			  const struct b1b_dst dst)
-{
-	/* .src will be set dynamically */
-	static struct b1b_eth_macs macs = {
-		.dst = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }
+/*
+ * A complete gratuitous ARP frame.  The frame is built once per VLAN (by
+ * b1b_garp_tmpl_init()), after which only the source MAC addresses need to be
+ * changed for each destination.
+ */
+struct b1b_garp_frame {
+	struct b1b_eth_macs macs;
+	union {
+		struct {
+			struct b1b_vlan_hdr vlan;
+			struct b1b_arp arp;
+		}
+		__attribute__((packed)) tagged;
+		struct b1b_arp untagged;
 	};
+};
+_Static_assert(sizeof(struct b1b_garp_frame) == 46,
+	       "struct b1b_garp_frame size");
+
+/*
+ * io_uring frame arena slot.  Each in-flight frame needs its own copy of the
+ * frame, address, and message header, since they are read asynchronously.
+ */
+struct b1b_garp_slot {
+	struct b1b_garp_frame frame;
+	struct sockaddr_ll sll;
+	struct iovec iov;
+	struct msghdr msg;
+	const struct b1b_bond_session *bs;
+	struct b1b_burst *burst;  /* NULL if burst abandoned */
+	struct b1b_dst dst;  /* for logging */
+	unsigned int retries;
+	enum { B1B_SLOT_FREE = 0, B1B_SLOT_INFLIGHT, B1B_SLOT_RETRY } state;
+};
 
-	/* .vid will be set dynamically */
-	static struct b1b_vlan_hdr vlan = { .etype = B1B_HTONS(ETH_P_8021Q) };
+/* Frame template plus the information needed to send it */
+struct b1b_garp_tmpl {
+	struct b1b_garp_frame frame;
+	struct b1b_arp *arp;  /* &frame.tagged.arp or &frame.untagged */
+	size_t len;
+};
 
-	/* .sha will be set dynamically */
-	static struct b1b_arp arp = {
+static void b1b_garp_tmpl_init(struct b1b_garp_tmpl *const tmpl,
+			       const uint16_t vlan, const _Bool tagged)
+{
+	static const struct b1b_arp arp = {
 		.etype = B1B_HTONS(ETH_P_ARP),
 		.htype = B1B_HTONS(ARPHRD_ETHER),
 		.ptype = B1B_HTONS(ETH_P_IP),
@@ -93,81 +148,895 @@ static void b1b_send_garp(const struct b1b_global_session *const gs,
 		.tpa = { .s_addr = 0 }
 	};
 
+	memset(tmpl->frame.macs.dst, 0xff, sizeof tmpl->frame.macs.dst);
+
+	if (tagged) {
+		tmpl->frame.tagged.vlan.etype = B1B_HTONS(ETH_P_8021Q);
+		tmpl->frame.tagged.vlan.vid = htons(vlan);
+		tmpl->arp = &tmpl->frame.tagged.arp;
+		tmpl->len = sizeof tmpl->frame;
+	}
+	else {
+		tmpl->arp = &tmpl->frame.untagged;
+		tmpl->len = sizeof tmpl->frame.macs
+				+ sizeof tmpl->frame.untagged;
+	}
+
+	memcpy(tmpl->arp, &arp, sizeof arp);
+}
+
+
+/*
+ *
+ *	Transmit context setup
+ *
+ */
+
+static void b1b_arpsock_cb(struct b1b_global_session *gs,
+			   struct b1b_event_src *src, uint32_t events);
+static void b1b_retry_cb(struct b1b_global_session *gs,
+			 struct b1b_event_src *src, uint32_t events);
+static void b1b_uring_cb(struct b1b_global_session *gs,
+			 struct b1b_event_src *src, uint32_t events);
+
+/*
+ * Set up a transmit context (ARP socket and, if enabled and available, an
+ * io_uring instance with its frame arena).  Each thread that sends frames has
+ * its own transmit context.
+ */
+void b1b_xmit_init(struct b1b_xmit *const xmit)
+{
+	static const int one = 1;
+	static const int sndbuf = B1B_ARP_SNDBUF;
+
+	int fd, flags;
+
+	/*
+	 * Frames aren't sent (see b1b_garp_sendto()), but the socket is still
+	 * polled, so use one that doesn't need CAP_NET_RAW.
+	 */
+	if (b1b_null_xmit) {
+		fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			    0);
+		if (fd < 0)
+			B1B_FATAL("Failed to create placeholder socket: %m");
+		xmit->sock = fd;
+		xmit->uring = NULL;
+		xmit->slots = NULL;
+		return;
+	}
+
+	fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		B1B_FATAL("Failed to create ARP socket: %m");
+
+	/* SO_SNDBUFFORCE requires CAP_NET_ADMIN; SO_SNDBUF is capped */
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE,
+		       &sndbuf, sizeof sndbuf) < 0
+			&& setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+				      &sndbuf, sizeof sndbuf) < 0) {
+		B1B_FATAL("Failed to set ARP socket send buffer size: %m");
+	}
+
+	if (b1b_qdisc_bypass && setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS,
+					   &one, sizeof one) < 0) {
+		B1B_FATAL("Failed to enable qdisc bypass on ARP socket: %m");
+	}
+
+	xmit->sock = fd;
+	xmit->uring = NULL;
+	xmit->slots = NULL;
+
+	if (!b1b_io_uring)
+		return;
+
+	if ((xmit->uring = b1b_uring_new(B1B_URING_SLOTS, fd)) == NULL) {
+		B1B_WARN("Falling back to sendmsg()");
+		return;
+	}
+
 	/*
-	 * .sll_protocol, .sll_hatype, and .sll_pkttype are not set;
-	 * .sll_ifindex will be set dynamically
+	 * With io_uring, the socket is blocking, so that the kernel waits for
+	 * send buffer space (rather than completing requests with EAGAIN).
 	 */
-	static struct sockaddr_ll sll = {
+	if ((flags = fcntl(fd, F_GETFL)) < 0
+			|| fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+		B1B_FATAL("Failed to make ARP socket blocking: %m");
+	}
+
+	xmit->slots = B1B_ZALLOC(B1B_URING_SLOTS * sizeof *xmit->slots);
+}
+
+void b1b_xmit_fini(struct b1b_xmit *const xmit)
+{
+	if (xmit->uring != NULL)
+		b1b_uring_free(xmit->uring);
+
+	free(xmit->slots);
+
+	if (close(xmit->sock) < 0)
+		B1B_ERR("Failed to close ARP socket: %m");
+}
+
+void b1b_arpsock_open(struct b1b_global_session *const gs)
+{
+	int fd;
+
+	b1b_xmit_init(&gs->xmit);
+
+	/* Only interested in EPOLLOUT when a burst is blocked */
+	gs->arp_ev.cb = b1b_arpsock_cb;
+	gs->arp_ev.fd = gs->xmit.sock;
+	b1b_ev_add(gs, &gs->arp_ev, 0);
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		B1B_FATAL("Failed to create ARP retry timer: %m");
+
+	gs->retry_ev.cb = b1b_retry_cb;
+	gs->retry_ev.fd = fd;
+	b1b_ev_add(gs, &gs->retry_ev, EPOLLIN);
+
+	/* io_uring fd is readable when completions are available */
+	if (gs->xmit.uring != NULL) {
+		gs->uring_ev.cb = b1b_uring_cb;
+		gs->uring_ev.fd = b1b_uring_fd(gs->xmit.uring);
+		b1b_ev_add(gs, &gs->uring_ev, EPOLLIN);
+	}
+}
+
+
+/*
+ *
+ *	Frame transmission
+ *
+ */
+
+static void b1b_garp_log_mac(const int level, const char *const what,
+			     const struct b1b_bond_session *const bs,
+			     const struct b1b_burst *const burst,
+			     const struct b1b_dst dst, const int err)
+{
+	/* Called once with the result of each frame */
+	B1B_PROBE(frame, bs->ifname, dst.mac, dst.vlan, err);
+
+	/* Formatted by the logging thread */
+	b1b_log_garp(__FILE__, __LINE__, level, what, bs->ifname,
+		     burst->brname, dst, err);
+}
+
+/* Count a frame as sent, noting the time of the first frame */
+static void b1b_garp_sent(struct b1b_burst *const burst)
+{
+	if (burst->sent++ == 0)
+		clock_gettime(CLOCK_MONOTONIC, &burst->first);
+}
+
+/*
+ * sendto(), or pretend that the frame was sent (b1b_null_xmit), after writing
+ * it to the pcap file, if any
+ */
+static ssize_t b1b_garp_sendto(const int sock,
+			       const struct b1b_garp_tmpl *const tmpl,
+			       const struct sockaddr_ll *const sll)
+{
+	if (b1b_null_xmit) {
+		b1b_pcap_write(&tmpl->frame, tmpl->len);
+		return tmpl->len;
+	}
+
+	return sendto(sock, &tmpl->frame, tmpl->len, 0,
+		      (const struct sockaddr *)sll, sizeof *sll);
+}
+
+/*
+ * Returns 0 if the frame was sent (or could not be sent for a reason that
+ * won't be fixed by retrying), or EAGAIN or ENOBUFS if the frame should be
+ * retried later.
+ */
+static int b1b_send_garp(const int sock,
+			 const struct b1b_bond_session *const bs,
+			 struct b1b_burst *const burst,
+			 struct b1b_garp_tmpl *const tmpl,
+			 struct sockaddr_ll *const sll,
+			 const struct b1b_dst dst)
+{
+	ssize_t result;
+
+	memcpy(tmpl->frame.macs.src, dst.mac, sizeof dst.mac);
+	memcpy(tmpl->arp->sha, dst.mac, sizeof dst.mac);
+
+	result = b1b_garp_sendto(sock, tmpl, sll);
+
+	/*
+	 * If we're sending directly via the active slave, and it has gone away
+	 * (or gone down), fall back to the bond for the rest of this burst.
+	 */
+	if (result < 0 && sll->sll_ifindex != bs->ifindex
+			&& (errno == ENODEV || errno == ENXIO
+					|| errno == ENETDOWN)) {
+		B1B_WARN("Cannot send via active slave of %s (index %d): %m: "
+				"Falling back to bond",
+			 bs->ifname, sll->sll_ifindex);
+		sll->sll_ifindex = bs->ifindex;
+		burst->ifindex = bs->ifindex;
+		result = b1b_garp_sendto(sock, tmpl, sll);
+	}
+
+	if (result < 0) {
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return EAGAIN;
+
+		if (errno == ENOBUFS)
+			return ENOBUFS;
+
+		b1b_garp_log_mac(LOG_ERR, "Failed to send", bs, burst, dst,
+				 errno);
+		++burst->errors;
+		return 0;
+	}
+
+	b1b_garp_log_mac(LOG_DEBUG, "Sent", bs, burst, dst, 0);
+	b1b_garp_sent(burst);
+
+	return 0;
+}
+
+/* Log the burst timing, record its statistics, and free its destination tree */
+static void b1b_garp_burst_done(const struct b1b_bond_session *const bs,
+				struct b1b_burst *const burst)
+{
+	struct timespec end;
+	int64_t nsec;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	B1B_PROBE(burst__done, bs->ifname, burst->sent, burst->errors,
+		  b1b_ns_between(&burst->event, &end));
+
+	if (burst->sent != 0) {
+		nsec = b1b_ns_between(&burst->start, &end);
+		B1B_DEBUG("Sent %u gratuitous ARP(s) via %s in %" PRId64
+				" ns (%" PRId64 " ns/frame)",
+			  burst->sent, bs->ifname, nsec, nsec / burst->sent);
+	}
+
+	b1b_stats_burst(bs, burst, &end);
+	b1b_fdb_free(&burst->fdbtree);
+}
+
+/* Per-frame sendto() version of b1b_garp_burst() */
+static int b1b_garp_sendto_burst(const int sock,
+				 const struct b1b_bond_session *const bs,
+				 struct b1b_burst *const burst)
+{
+	/* .sll_protocol, .sll_hatype, and .sll_pkttype are not set */
+	struct sockaddr_ll sll = {
 		.sll_family = AF_PACKET,
+		.sll_ifindex = burst->ifindex,
 		.sll_halen = ETH_ALEN,
 		.sll_addr = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }
 	};
 
-	/* [1] and (possibly) [2] will by set dynamically */
-	static struct iovec iovs[3] = {
-		[0] = { .iov_base = &macs, .iov_len = sizeof macs }
-	};
+	struct b1b_garp_tmpl tmpl;
+	struct b1b_dst_node *dn;
+	int32_t vlan;
+	_Bool tagged;
+	int result;
 
 	/*
-	 * .msg_control, .msg_controllen, and .msg_flags are not set;
-	 * .msg_iovlen will be set dynamically
+	 * The FDB tree is ordered by VLAN (see b1b_fdb_cmp_cb()), so a new
+	 * frame template is only needed when the VLAN changes.
 	 */
-	static struct msghdr msg = {
-		.msg_name = &sll,
-		.msg_namelen = sizeof sll,
-		.msg_iov = iovs
+	vlan = -1;
+
+	while (burst->next != NULL) {
+
+		dn = SAVL_NODE_CONTAINER(burst->next, struct b1b_dst_node, avl);
+
+		if (dn->dst.dst.vlan != vlan) {
+			vlan = dn->dst.dst.vlan;
+			tagged = (vlan != 0 && vlan != burst->pvid);
+			b1b_garp_tmpl_init(&tmpl, vlan, tagged);
+			B1B_DEBUG("Sending %s frames for VLAN %" PRId32
+					" via %s",
+				  tagged ? "tagged" : "untagged", vlan,
+				  bs->ifname);
+		}
+
+		result = b1b_send_garp(sock, bs, burst, &tmpl, &sll,
+				       dn->dst.dst);
+
+		if (result != 0) {
+
+			if (++burst->retries <= B1B_GARP_MAX_RETRIES)
+				return result;
+
+			b1b_garp_log_mac(LOG_ERR, "Giving up on", bs, burst,
+					 dn->dst.dst, result);
+			++burst->errors;
+		}
+
+		burst->retries = 0;
+		burst->next = savl_next(burst->next);
+	}
+
+	b1b_garp_burst_done(bs, burst);
+
+	return 0;
+}
+
+/* Process io_uring completions, for any burst */
+static void b1b_garp_uring_reap(struct b1b_xmit *const xmit)
+{
+	struct b1b_garp_slot *slot;
+	uint64_t index;
+	int32_t res;
+	int err;
+
+	while (b1b_uring_reap(xmit->uring, &index, &res)) {
+
+		B1B_ASSERT(index < B1B_URING_SLOTS);
+		slot = xmit->slots + index;
+		B1B_ASSERT(slot->state == B1B_SLOT_INFLIGHT);
+		--xmit->inflight;
+
+		if (slot->burst == NULL) {  /* burst was abandoned */
+			slot->state = B1B_SLOT_FREE;
+			continue;
+		}
+
+		err = res < 0 ? -res : 0;
+
+		/* See b1b_send_garp() */
+		if ((err == ENODEV || err == ENXIO || err == ENETDOWN)
+				&& slot->sll.sll_ifindex != slot->bs->ifindex) {
+			B1B_WARN("Cannot send via active slave of %s "
+					"(index %d): %s: Falling back to bond",
+				 slot->bs->ifname, slot->sll.sll_ifindex,
+				 strerror(err));
+			slot->burst->ifindex = slot->bs->ifindex;
+			slot->sll.sll_ifindex = slot->bs->ifindex;
+			slot->state = B1B_SLOT_RETRY;
+			continue;
+		}
+
+		if ((err == EAGAIN || err == ENOBUFS)
+				&& ++slot->retries <= B1B_GARP_MAX_RETRIES) {
+			slot->state = B1B_SLOT_RETRY;
+			continue;
+		}
+
+		if (err == 0) {
+			b1b_garp_sent(slot->burst);
+			b1b_garp_log_mac(LOG_DEBUG, "Sent", slot->bs,
+					 slot->burst, slot->dst, 0);
+		}
+		else {
+			b1b_garp_log_mac(LOG_ERR, "Failed to send", slot->bs,
+					 slot->burst, slot->dst, err);
+			++slot->burst->errors;
+		}
+
+		--slot->burst->inflight;
+		slot->state = B1B_SLOT_FREE;
+	}
+}
+
+static void b1b_garp_uring_submit(struct b1b_xmit *const xmit,
+				  struct b1b_garp_slot *const slot)
+{
+	b1b_uring_sendmsg(xmit->uring, &slot->msg, slot - xmit->slots);
+	slot->state = B1B_SLOT_INFLIGHT;
+	++xmit->inflight;
+}
+
+/*
+ * io_uring version of b1b_garp_burst().  Frames are copied into free arena
+ * slots and submitted in a single batch.  Returns EINPROGRESS if frames are
+ * in flight (or no slots are free), or ENOBUFS if all of the frames that
+ * need to be retried are waiting for a delay.
+ */
+static int b1b_garp_uring_burst(struct b1b_xmit *const xmit,
+				const struct b1b_bond_session *const bs,
+				struct b1b_burst *const burst)
+{
+	struct b1b_garp_tmpl tmpl;
+	struct b1b_garp_slot *slot;
+	struct b1b_dst_node *dn;
+	unsigned int i;
+	int32_t vlan;
+	_Bool tagged, retry;
+
+	/* Resubmit frames that failed in a previous round (of any burst) */
+	for (i = 0; i < B1B_URING_SLOTS; ++i) {
+		slot = xmit->slots + i;
+		if (slot->state != B1B_SLOT_RETRY)
+			continue;
+		if (slot->burst == NULL)
+			slot->state = B1B_SLOT_FREE;
+		else
+			b1b_garp_uring_submit(xmit, slot);
+	}
+
+	b1b_garp_uring_reap(xmit);
+
+	vlan = -1;
+
+	for (i = 0; i < B1B_URING_SLOTS && burst->next != NULL; ++i) {
+
+		slot = xmit->slots + i;
+		if (slot->state != B1B_SLOT_FREE)
+			continue;
+
+		dn = SAVL_NODE_CONTAINER(burst->next, struct b1b_dst_node, avl);
+
+		if (dn->dst.dst.vlan != vlan) {
+			vlan = dn->dst.dst.vlan;
+			tagged = (vlan != 0 && vlan != burst->pvid);
+			b1b_garp_tmpl_init(&tmpl, vlan, tagged);
+		}
+
+		memcpy(tmpl.frame.macs.src, dn->dst.dst.mac, ETH_ALEN);
+		memcpy(tmpl.arp->sha, dn->dst.dst.mac, ETH_ALEN);
+		memcpy(&slot->frame, &tmpl.frame, tmpl.len);
+
+		slot->sll.sll_family = AF_PACKET;
+		slot->sll.sll_ifindex = burst->ifindex;
+		slot->sll.sll_halen = ETH_ALEN;
+		memset(slot->sll.sll_addr, 0xff, ETH_ALEN);
+
+		slot->iov.iov_base = &slot->frame;
+		slot->iov.iov_len = tmpl.len;
+		slot->msg.msg_name = &slot->sll;
+		slot->msg.msg_namelen = sizeof slot->sll;
+		slot->msg.msg_iov = &slot->iov;
+		slot->msg.msg_iovlen = 1;
+
+		slot->bs = bs;
+		slot->burst = burst;
+		slot->dst = dn->dst.dst;
+		slot->retries = 0;
+
+		b1b_garp_uring_submit(xmit, slot);
+		++burst->inflight;
+
+		burst->next = savl_next(burst->next);
+	}
+
+	b1b_uring_submit(xmit->uring, 0);
+
+	if (burst->next == NULL && burst->inflight == 0) {
+		b1b_garp_burst_done(bs, burst);
+		return 0;
+	}
+
+	if (xmit->inflight != 0)
+		return EINPROGRESS;
+
+	/* Nothing in flight, so there must be frames waiting to be retried */
+	for (i = 0, retry = 0; i < B1B_URING_SLOTS; ++i)
+		retry |= (xmit->slots[i].state == B1B_SLOT_RETRY);
+	B1B_ASSERT(retry);
+
+	return ENOBUFS;
+}
+
+/*
+ * Send (or continue sending) a burst.  Returns 0 if the burst is complete (in
+ * which case its destination tree has been freed), or EAGAIN (wait for the
+ * socket to become writable), ENOBUFS (retry after a delay), or EINPROGRESS
+ * (wait for io_uring completions) if the burst has been suspended.
+ *
+ * NOTE: This is also called by worker threads, so it must not touch the global
+ *	 session.
+ */
+int b1b_garp_burst(struct b1b_xmit *const xmit,
+		   const struct b1b_bond_session *const bs,
+		   struct b1b_burst *const burst)
+{
+	if (xmit->uring != NULL)
+		return b1b_garp_uring_burst(xmit, bs, burst);
+	else
+		return b1b_garp_sendto_burst(xmit->sock, bs, burst);
+}
+
+/* Detach an abandoned burst from any io_uring slots that it owns */
+void b1b_garp_orphan(struct b1b_xmit *const xmit,
+			    const struct b1b_burst *const burst)
+{
+	unsigned int i;
+
+	if (xmit->uring == NULL)
+		return;
+
+	for (i = 0; i < B1B_URING_SLOTS; ++i) {
+		if (xmit->slots[i].burst == burst)
+			xmit->slots[i].burst = NULL;
+	}
+}
+
+/*
+ * Wait until a suspended burst can make progress, in a thread that can block
+ * (i.e. a worker thread)
+ */
+void b1b_xmit_wait(struct b1b_xmit *const xmit, const int reason)
+{
+	static const struct timespec retry = {
+		.tv_sec = 0, .tv_nsec = B1B_GARP_RETRY_NS
 	};
 
-	memcpy(macs.src, dst.mac, sizeof dst.mac);
-	memcpy(arp.sha, dst.mac, sizeof dst.mac);
-	sll.sll_ifindex = bs->ifindex;
+	struct pollfd pfd = { .fd = xmit->sock, .events = POLLOUT };
 
-	if (dst.vlan != 0) {
-		vlan.vid = dst.vlan;
-		iovs[1].iov_base = &vlan;
-		iovs[1].iov_len = sizeof vlan;
-		iovs[2].iov_base = &arp;
-		iovs[2].iov_len = sizeof arp;
-		msg.msg_iovlen = 3;
+	if (reason == EAGAIN) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			B1B_FATAL("Failed to wait for ARP socket: %m");
+	}
+	else if (reason == EINPROGRESS) {
+		b1b_uring_submit(xmit->uring, 1);
 	}
 	else {
-		iovs[1].iov_base = &arp;
-		iovs[2].iov_len = sizeof arp;
-		msg.msg_iovlen = 2;
+		/* ENOBUFS - socket is still writable */
+		nanosleep(&retry, NULL);
+	}
+}
+
+
+/*
+ *
+ *	Suspended bursts (main thread only)
+ *
+ */
+
+static _Bool b1b_burst_active(const struct b1b_burst *const burst)
+{
+	return burst->next != NULL || burst->inflight != 0;
+}
+
+/*
+ * Arrange for suspended bursts to be resumed, after b1b_garp_burst() returns
+ * EAGAIN (socket send buffer full) or ENOBUFS (frame dropped by qdisc/driver).
+ * (Nothing needs to be done for EINPROGRESS; the io_uring fd is always
+ * monitored.)
+ */
+static void b1b_garp_block(struct b1b_global_session *const gs,
+			   const int err)
+{
+	static const struct itimerspec retry = {
+		.it_value = { .tv_sec = 0, .tv_nsec = B1B_GARP_RETRY_NS }
+	};
+
+	if (err == EAGAIN) {
+		b1b_ev_mod(gs, &gs->arp_ev, EPOLLOUT);
+	}
+	else if (err == ENOBUFS) {
+		/* Socket is still writable, so EPOLLOUT won't help */
+		if (timerfd_settime(gs->retry_ev.fd, 0, &retry, NULL) < 0)
+			B1B_FATAL("Failed to arm ARP retry timer: %m");
+	}
+}
+
+/* Resume suspended bursts, in bond order, until the socket blocks again */
+static void b1b_garp_resume(struct b1b_global_session *const gs)
+{
+	struct b1b_bond_session *bs;
+	unsigned int i;
+	int result;
+
+	if (gs->xmit.uring == NULL)
+		b1b_ev_mod(gs, &gs->arp_ev, 0);
+
+	for (i = 0; i < gs->bcount && gs->pending != 0; ++i) {
+
+		bs = gs->bonds + i;
+
+		if (!b1b_burst_active(&bs->burst))
+			continue;
+
+		if ((result = b1b_garp_burst(&gs->xmit, bs, &bs->burst))) {
+			b1b_garp_block(gs, result);
+			break;
+		}
+
+		--gs->pending;
+	}
+}
+
+static void b1b_arpsock_cb(struct b1b_global_session *const gs,
+			   struct b1b_event_src *const src
+						__attribute__((unused)),
+			   const uint32_t events)
+{
+	if (events & ~EPOLLOUT) {
+		B1B_FATAL("Unexpected event type(s) on ARP socket: %04" PRIx32,
+			  events);
+	}
+
+	b1b_garp_resume(gs);
+}
+
+static void b1b_retry_cb(struct b1b_global_session *const gs,
+			 struct b1b_event_src *const src,
+			 const uint32_t events __attribute__((unused)))
+{
+	uint64_t expirations;
+
+	if (read(src->fd, &expirations, sizeof expirations) < 0) {
+		if (errno == EAGAIN)
+			return;
+		B1B_FATAL("Failed to read ARP retry timer: %m");
+	}
+
+	b1b_garp_resume(gs);
+}
+
+static void b1b_uring_cb(struct b1b_global_session *const gs,
+			 struct b1b_event_src *const src
+						__attribute__((unused)),
+			 const uint32_t events __attribute__((unused)))
+{
+	/* Completions are reaped even if no burst is pending */
+	if (gs->pending == 0)
+		b1b_garp_uring_reap(&gs->xmit);
+	else
+		b1b_garp_resume(gs);
+}
+
+
+/*
+ *
+ *	OpenFlow bursts (-o/--ovs-openflow)
+ *
+ */
+
+/* Count a batch of frames as sent */
+static void b1b_garp_of_sent(struct b1b_burst *const burst,
+			     const unsigned int count)
+{
+	if (count != 0 && burst->sent == 0)
+		clock_gettime(CLOCK_MONOTONIC, &burst->first);
+
+	burst->sent += count;
+}
+
+static int b1b_garp_of_idx_cmp(const void *const a, const void *const b)
+{
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Replace a burst's destinations with only those whose frames ovs-vswitchd
+ * rejected, so that they (and only they) are resent via the ARP socket.
+ * Packet-out messages were queued in tree order, with consecutive transaction
+ * IDs starting at base.
+ */
+static void b1b_garp_of_rejected(struct b1b_bond_session *const bs,
+				 struct b1b_burst *const burst,
+				 const uint32_t base, const unsigned int errors)
+{
+	const uint32_t *const xids = b1b_of_rejected(bs->ofconn);
+	struct b1b_dst_node *dn;
+	struct savl_node *node;
+	unsigned int i, r, resend;
+	uint32_t *idx;
+
+	idx = B1B_ZALLOC(errors * sizeof *idx);
+
+	/* Unsigned arithmetic handles transaction ID wraparound */
+	for (r = 0; r < errors; ++r)
+		idx[r] = xids[r] - base;
+
+	qsort(idx, errors, sizeof *idx, b1b_garp_of_idx_cmp);
+
+	/* The bond's tree was handed to the burst; reuse it to collect */
+	B1B_ASSERT(bs->fdbtree == NULL);
+
+	node = savl_first(burst->fdbtree);
+	resend = 0;
+
+	for (i = 0, r = 0; node != NULL && r < errors; ++i) {
+
+		if (idx[r] == i) {
+			dn = SAVL_NODE_CONTAINER(node, struct b1b_dst_node,
+						 avl);
+			b1b_fdb_add(bs, dn->dst);
+			++resend;
+			while (r < errors && idx[r] == i)
+				++r;
+		}
+
+		node = savl_next(node);
+	}
+
+	free(idx);
+
+	b1b_fdb_free(&burst->fdbtree);
+	burst->fdbtree = bs->fdbtree;
+	burst->next = savl_first(burst->fdbtree);
+	burst->sent -= resend;
+	bs->fdbtree = NULL;
+}
+
+/*
+ * Send a burst to the OVS port of the bond, as OpenFlow packet-out messages
+ * (see openflow.c).  Returns 0 if the burst is complete.  Otherwise, the
+ * connection has failed or ovs-vswitchd has rejected some frames, and the
+ * caller should send the rest of the burst (starting at burst->next) via the
+ * ARP socket.  Rejected frames aren't counted as errors, because they are
+ * resent; the ARP socket counts any that fail again.
+ */
+static int b1b_garp_of_burst(struct b1b_bond_session *const bs,
+			     struct b1b_burst *const burst)
+{
+	struct b1b_garp_tmpl tmpl;
+	struct b1b_dst_node *dn;
+	struct savl_node *start;
+	unsigned int queued;
+	uint32_t base;
+	int32_t vlan;
+	int errors;
+
+	if (!b1b_of_port_ok(bs->ofport)) {
+		B1B_WARN("Cannot send to OVS port of %s via OpenFlow: %" PRIu32,
+			 bs->ifname, bs->ofport);
+		return -1;
+	}
+
+	if (bs->ofconn == NULL
+			&& (bs->ofconn = b1b_of_connect(bs->brname)) == NULL) {
+		return -1;
+	}
+
+	/* Frames since the last successful flush (start) may not be sent */
+	start = burst->next;
+	base = b1b_of_next_xid(bs->ofconn);
+	queued = 0;
+	vlan = -1;
+
+	while (burst->next != NULL) {
+
+		dn = SAVL_NODE_CONTAINER(burst->next, struct b1b_dst_node, avl);
+
+		if (dn->dst.dst.vlan != vlan) {
+			vlan = dn->dst.dst.vlan;
+			b1b_garp_tmpl_init(&tmpl, vlan,
+					   vlan != 0 && vlan != burst->pvid);
+		}
+
+		memcpy(tmpl.frame.macs.src, dn->dst.dst.mac, ETH_ALEN);
+		memcpy(tmpl.arp->sha, dn->dst.dst.mac, ETH_ALEN);
+
+		if (!b1b_of_queue(bs->ofconn, bs->ofport, &tmpl.frame,
+				  tmpl.len)) {
+
+			if (b1b_of_flush(bs->ofconn) < 0)
+				goto error;
+
+			b1b_garp_of_sent(burst, queued);
+			queued = 0;
+			start = burst->next;
+			continue;
+		}
+
+		b1b_garp_log_mac(LOG_DEBUG, "Queued", bs, burst, dn->dst.dst,
+				 0);
+		++queued;
+		burst->next = savl_next(burst->next);
 	}
 
-	if (sendmsg(gs->arpsock, &msg, 0) < 0) {
-		B1B_ERR("Failed to send gratuitous ARP for"
-				" %02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
-				":%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
-				" via %s.%" PRIu16 ": %m",
-			dst.mac[0], dst.mac[1], dst.mac[2], dst.mac[3],
-			dst.mac[4], dst.mac[5], bs->ifname, dst.vlan);
+	if (b1b_of_flush(bs->ofconn) < 0)
+		goto error;
+
+	b1b_garp_of_sent(burst, queued);
+	queued = 0;
+	start = NULL;
+
+	if ((errors = b1b_of_barrier(bs->ofconn)) < 0)
+		goto error;
+
+	if (errors != 0) {
+		B1B_ERR("OVS rejected %d OpenFlow packet-out message(s) for %s",
+			errors, bs->ifname);
+		b1b_garp_of_rejected(bs, burst, base, errors);
+		return -1;
 	}
 
-	B1B_DEBUG("Sent gratuitous ARP for"
-			" %02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
-			":%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
-			" via %s.%" PRIu16,
-		dst.mac[0], dst.mac[1], dst.mac[2], dst.mac[3],
-		dst.mac[4], dst.mac[5], bs->ifname, dst.vlan);
+	b1b_garp_burst_done(bs, burst);
+
+	return 0;
+
+error:
+	b1b_of_close(&bs->ofconn);
+	burst->next = start;
+	return -1;
 }
 
+
+/*
+ *
+ *	Start a burst
+ *
+ */
+
 void b1b_send_garps(struct b1b_global_session *const gs,
 		    struct b1b_bond_session *const bs)
 {
-	struct savl_node *n;
-	struct b1b_dst_node *dn;
+	struct b1b_burst *const burst = &bs->burst;
+	struct b1b_burst new_burst;
+	struct savl_node *node;
+	uint64_t rxbytes;
+	int result;
 
 	B1B_DEBUG("Sending gratuitous ARP requests for %s via %s",
 		  bs->brname, bs->ifname);
 
+	rxbytes = gs->rxbytes;
+	B1B_PROBE(fdb__start, bs->ifname, bs->brtype);
 	bs->getfdb(gs, bs);
 
-	for (n = savl_first(bs->fdbtree); n != NULL; n = savl_next(n)) {
-		dn = SAVL_NODE_CONTAINER(n, struct b1b_dst_node, avl);
-		b1b_send_garp(gs, bs, dn->dst.dst);
+	clock_gettime(CLOCK_MONOTONIC, &new_burst.start);
+	new_burst.event = bs->event_time;
+	new_burst.fdb_bytes = bs->fdb_bytes + (gs->rxbytes - rxbytes);
+	bs->fdb_bytes = 0;
+	new_burst.fdbtree = bs->fdbtree;
+	new_burst.next = savl_first(bs->fdbtree);
+	new_burst.sent = 0;
+	new_burst.errors = 0;
+	new_burst.retries = 0;
+	new_burst.inflight = 0;
+	new_burst.ifindex = bs->ifindex;
+	new_burst.pvid = bs->pvid;
+	snprintf(new_burst.brname, sizeof new_burst.brname, "%s", bs->brname);
+	bs->fdbtree = NULL;
+
+	for (node = new_burst.next, new_burst.dsts = 0; node != NULL;
+						node = savl_next(node)) {
+		++new_burst.dsts;
+	}
+
+	B1B_PROBE(fdb__done, bs->ifname, new_burst.dsts, new_burst.fdb_bytes);
+
+	if (b1b_slave_xmit && bs->active_slave != 0) {
+		B1B_DEBUG("Sending directly via active slave of %s (index %"
+				PRId32 ")",
+			  bs->ifname, bs->active_slave);
+		new_burst.ifindex = bs->active_slave;
+	}
+
+	B1B_PROBE(burst__start, bs->ifname, new_burst.dsts, new_burst.ifindex);
+
+	if (b1b_ovs_openflow && bs->brtype == B1B_BR_TYPE_OVS
+			&& !b1b_null_xmit) {
+		if (b1b_garp_of_burst(bs, &new_burst) == 0)
+			return;
+		B1B_WARN("Sending gratuitous ARPs for %s via ARP socket",
+			 bs->ifname);
+	}
+
+	/* The worker takes ownership of the destination tree */
+	if (b1b_worker_submit(gs, bs, &new_burst))
+		return;
+
+	if (b1b_burst_active(burst)) {
+		B1B_WARN("Abandoning incomplete burst for %s: %u frames sent",
+			 bs->ifname, burst->sent);
+		b1b_garp_orphan(&gs->xmit, burst);
+		b1b_fdb_free(&burst->fdbtree);
+		--gs->pending;
+	}
+
+	*burst = new_burst;
+
+	/* Don't jump ahead of bursts that are already waiting */
+	if (gs->pending == 0 || burst->next == NULL) {
+		if ((result = b1b_garp_burst(&gs->xmit, bs, burst)) == 0)
+			return;
+		b1b_garp_block(gs, result);
 	}
 
-	b1b_fdb_free(bs);
+	B1B_DEBUG("Burst for %s suspended", bs->ifname);
+	++gs->pending;
 }
@@ -0,0 +1,535 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	jsonrpc.c - minimal JSON-RPC codec for ovs-vswitchd requests/responses
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "b1b.h"
+
+#include <string.h>
+
+
+/*
+ * ovs-vswitchd's unixctl requests and responses are simple enough that they
+ * can be formatted and parsed without building a json-c object tree.  The
+ * scanner only understands responses that look like the ones ovs-vswitchd
+ * actually sends; anything else is rejected, and the caller falls back to
+ * json-c.
+ */
+
+
+/*
+ *
+ *	Format a request
+ *
+ */
+
+/* Appends a JSON string (with quotes); returns false if it doesn't fit */
+static _Bool b1b_jsonrpc_put_str(char **const p, const char *const end,
+				 const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *out;
+	char c;
+
+	out = *p;
+
+	if (out == end)
+		return 0;
+
+	*out++ = '"';
+
+	for (; *s != 0; ++s) {
+
+		/* Longest escape sequence is \u00XX */
+		if (end - out < 6)
+			return 0;
+
+		switch ((c = *s)) {
+			case '"':	*out++ = '\\';	*out++ = '"';	break;
+			case '\\':	*out++ = '\\';	*out++ = '\\';	break;
+			case '\b':	*out++ = '\\';	*out++ = 'b';	break;
+			case '\f':	*out++ = '\\';	*out++ = 'f';	break;
+			case '\n':	*out++ = '\\';	*out++ = 'n';	break;
+			case '\r':	*out++ = '\\';	*out++ = 'r';	break;
+			case '\t':	*out++ = '\\';	*out++ = 't';	break;
+			default:
+				if ((unsigned char)c >= 0x20) {
+					*out++ = c;
+					break;
+				}
+				memcpy(out, "\\u00", 4);
+				out[4] = hex[c >> 4];
+				out[5] = hex[c & 0xf];
+				out += 6;
+		}
+	}
+
+	if (out == end)
+		return 0;
+
+	*out++ = '"';
+	*p = out;
+
+	return 1;
+}
+
+static _Bool b1b_jsonrpc_put_raw(char **const p, const char *const end,
+				 const char *const s, const size_t len)
+{
+	if ((size_t)(end - *p) < len)
+		return 0;
+
+	memcpy(*p, s, len);
+	*p += len;
+
+	return 1;
+}
+
+static _Bool b1b_jsonrpc_put_u64(char **const p, const char *const end,
+				 uint64_t value)
+{
+	char digits[20];
+	unsigned int i;
+
+	i = sizeof digits;
+
+	do {
+		digits[--i] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+
+	return b1b_jsonrpc_put_raw(p, end, digits + i, sizeof digits - i);
+}
+
+#define B1B_PUT_CONST(p, end, s)	\
+		b1b_jsonrpc_put_raw(p, end, s, sizeof s - 1)
+
+/*
+ * Format a request with zero or one (string) parameters.  Returns the length
+ * of the request, or 0 if it doesn't fit in the buffer.
+ */
+size_t b1b_jsonrpc_req(char *const buf, const size_t size, const uint64_t id,
+		       const char *restrict const method,
+		       const char *restrict const param)
+{
+	const char *const end = buf + size;
+	char *p;
+
+	p = buf;
+
+	if (!B1B_PUT_CONST(&p, end, "{\"id\":")
+			|| !b1b_jsonrpc_put_u64(&p, end, id)
+			|| !B1B_PUT_CONST(&p, end, ",\"method\":")
+			|| !b1b_jsonrpc_put_str(&p, end, method)
+			|| !B1B_PUT_CONST(&p, end, ",\"params\":[")
+			|| (param != NULL
+				&& !b1b_jsonrpc_put_str(&p, end, param))
+			|| !B1B_PUT_CONST(&p, end, "]}")) {
+		return 0;
+	}
+
+	return p - buf;
+}
+
+
+/*
+ *
+ *	Find the end of a response
+ *
+ */
+
+/*
+ * Scan the bytes received so far (from frame->pos onward) for the end of a
+ * top-level JSON object or array.  Returns 1 when the end has been found (at
+ * frame->pos), 0 if more bytes are needed, or -1 if the bytes can't be the
+ * start of a JSON object or array.
+ */
+int b1b_json_frame(struct b1b_json_frame *const frame, const char *const buf,
+		   const size_t len)
+{
+	const char *c;
+
+	for (c = buf + frame->pos; c < buf + len; ++c) {
+
+		if (frame->in_string) {
+			if (frame->escape)
+				frame->escape = 0;
+			else if (*c == '\\')
+				frame->escape = 1;
+			else if (*c == '"')
+				frame->in_string = 0;
+			continue;
+		}
+
+		switch (*c) {
+
+			case '"':
+				if (frame->depth == 0)
+					return -1;
+				frame->in_string = 1;
+				break;
+
+			case '{':
+			case '[':
+				++frame->depth;
+				break;
+
+			case '}':
+			case ']':
+				if (frame->depth == 0)
+					return -1;
+				if (--frame->depth == 0) {
+					frame->pos = c + 1 - buf;
+					return 1;
+				}
+				break;
+
+			case ' ':
+			case '\t':
+			case '\r':
+			case '\n':
+				break;
+
+			default:
+				if (frame->depth == 0)
+					return -1;
+		}
+	}
+
+	frame->pos = len;
+
+	return 0;
+}
+
+
+/*
+ *
+ *	Parse a response
+ *
+ */
+
+static char *b1b_json_skip_ws(char *p, const char *const end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		++p;
+
+	return p;
+}
+
+static int b1b_json_hex4(const char *const p)
+{
+	unsigned int i;
+	int value, d;
+
+	for (i = 0, value = 0; i < 4; ++i) {
+
+		if (p[i] >= '0' && p[i] <= '9')
+			d = p[i] - '0';
+		else if (p[i] >= 'a' && p[i] <= 'f')
+			d = p[i] - 'a' + 10;
+		else if (p[i] >= 'A' && p[i] <= 'F')
+			d = p[i] - 'A' + 10;
+		else
+			return -1;
+
+		value = value << 4 | d;
+	}
+
+	return value;
+}
+
+/*
+ * Check a string (p points to its opening quote).  Returns a pointer to the
+ * byte after its closing quote, or NULL if it isn't valid.
+ */
+static char *b1b_json_str_end(char *p, const char *const end)
+{
+	for (++p; p < end; ++p) {
+
+		if (*p == '"')
+			return p + 1;
+
+		if ((unsigned char)*p < 0x20)
+			return NULL;
+
+		if (*p != '\\')
+			continue;
+
+		if (++p == end)
+			return NULL;
+
+		if (*p == 'u') {
+			if (end - p < 5 || b1b_json_hex4(p + 1) < 0)
+				return NULL;
+			p += 4;
+		}
+		else if (*p == 0 || strchr("\"\\/bfnrt", *p) == NULL) {
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+static size_t b1b_json_put_utf8(char *const out, const unsigned int cp)
+{
+	if (cp < 0x80) {
+		out[0] = cp;
+		return 1;
+	}
+
+	if (cp < 0x800) {
+		out[0] = 0xc0 | cp >> 6;
+		out[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+
+	if (cp < 0x10000) {
+		out[0] = 0xe0 | cp >> 12;
+		out[1] = 0x80 | (cp >> 6 & 0x3f);
+		out[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+
+	out[0] = 0xf0 | cp >> 18;
+	out[1] = 0x80 | (cp >> 12 & 0x3f);
+	out[2] = 0x80 | (cp >> 6 & 0x3f);
+	out[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+/*
+ * Decode a string that has been checked by b1b_json_str_end(), in place.  An
+ * escape sequence is never shorter than the character it represents, so the
+ * decoded string (which starts after the opening quote) always fits, with room
+ * for a terminating NUL.  Returns the length of the decoded string.
+ */
+static size_t b1b_json_str_decode(char *const str)
+{
+	unsigned int cp, lo;
+	char *in, *out;
+
+	in = str + 1;
+
+	/* Nothing to move until the first escape sequence */
+	while (*in != '"' && *in != '\\')
+		++in;
+
+	out = in;
+
+	while (*in != '"') {
+
+		if (*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+
+		switch (in[1]) {
+			case 'b':	*out++ = '\b';	break;
+			case 'f':	*out++ = '\f';	break;
+			case 'n':	*out++ = '\n';	break;
+			case 'r':	*out++ = '\r';	break;
+			case 't':	*out++ = '\t';	break;
+			case 'u':	break;
+			default:	*out++ = in[1];
+		}
+
+		if (in[1] != 'u') {
+			in += 2;
+			continue;
+		}
+
+		cp = b1b_json_hex4(in + 2);
+		in += 6;
+
+		/* Combine a surrogate pair */
+		if (cp >= 0xd800 && cp < 0xdc00 && in[0] == '\\'
+				&& in[1] == 'u'
+				&& (lo = b1b_json_hex4(in + 2)) >= 0xdc00
+				&& lo < 0xe000) {
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+			in += 6;
+		}
+
+		out += b1b_json_put_utf8(out, cp);
+	}
+
+	*out = 0;
+
+	return out - (str + 1);
+}
+
+/* Skip a value that isn't needed; returns NULL if it isn't valid */
+static char *b1b_json_skip(char *p, const char *const end)
+{
+	unsigned int depth;
+	char *start;
+
+	if (*p == '"')
+		return b1b_json_str_end(p, end);
+
+	if (*p != '{' && *p != '[') {
+		start = p;
+		while (p < end && *p != ',' && *p != '}' && *p != ']'
+				&& *p != ' ' && *p != '\t' && *p != '\r'
+				&& *p != '\n') {
+			++p;
+		}
+		return p == start ? NULL : p;
+	}
+
+	for (depth = 0; p < end; ) {
+
+		if (*p == '"') {
+			if ((p = b1b_json_str_end(p, end)) == NULL)
+				return NULL;
+			continue;
+		}
+
+		if (*p == '{' || *p == '[')
+			++depth;
+		else if ((*p == '}' || *p == ']') && --depth == 0)
+			return p + 1;
+
+		++p;
+	}
+
+	return NULL;
+}
+
+static char *b1b_json_parse_u64(char *p, const char *const end,
+				uint64_t *const value)
+{
+	uint64_t v;
+	char *start;
+
+	for (start = p, v = 0; p < end && *p >= '0' && *p <= '9'; ++p) {
+		if (v > (UINT64_MAX - (*p - '0')) / 10)
+			return NULL;
+		v = v * 10 + (*p - '0');
+	}
+
+	if (p == start)
+		return NULL;
+
+	*value = v;
+
+	return p;
+}
+
+/* Parse a string or null; *str is set to NULL if the value is null */
+static char *b1b_json_str_or_null(char *const p, const char *const end,
+				  char **const str)
+{
+	if (*p == '"') {
+		*str = p;
+		return b1b_json_str_end(p, end);
+	}
+
+	if (end - p >= 4 && memcmp(p, "null", 4) == 0) {
+		*str = NULL;
+		return p + 4;
+	}
+
+	return NULL;
+}
+
+#define B1B_JSON_KEY_IS(key, len, name)	\
+		((len) == sizeof "\"" name "\"" - 1	\
+			&& memcmp(key, "\"" name "\"", len) == 0)
+
+/*
+ * Parse a complete response (as found by b1b_json_frame()).  The result or
+ * error string is decoded in place, so buf is modified.  Returns -1 if the
+ * response isn't understood; the buffer is only modified if the response is
+ * understood, so it can still be parsed by json-c.
+ */
+int b1b_jsonrpc_scan(char *const buf, const size_t len,
+		     struct b1b_jsonrpc_resp *const resp)
+{
+	const char *const end = buf + len;
+	char *p, *key, *result, *error;
+	_Bool have_id, have_error;
+	size_t klen;
+
+	have_id = have_error = 0;
+	result = error = NULL;
+
+	p = b1b_json_skip_ws(buf, end);
+	if (p == end || *p != '{')
+		return -1;
+
+	p = b1b_json_skip_ws(p + 1, end);
+
+	while (1) {
+
+		if (p == end || *p != '"')
+			return -1;
+
+		key = p;
+		if ((p = b1b_json_str_end(p, end)) == NULL)
+			return -1;
+		klen = p - key;
+
+		p = b1b_json_skip_ws(p, end);
+		if (p == end || *p != ':')
+			return -1;
+
+		p = b1b_json_skip_ws(p + 1, end);
+		if (p == end)
+			return -1;
+
+		if (B1B_JSON_KEY_IS(key, klen, "id")) {
+			p = b1b_json_parse_u64(p, end, &resp->id);
+			have_id = 1;
+		}
+		else if (B1B_JSON_KEY_IS(key, klen, "result")) {
+			p = b1b_json_str_or_null(p, end, &result);
+		}
+		else if (B1B_JSON_KEY_IS(key, klen, "error")) {
+			p = b1b_json_str_or_null(p, end, &error);
+			have_error = 1;
+		}
+		else {
+			p = b1b_json_skip(p, end);
+		}
+
+		if (p == NULL)
+			return -1;
+
+		p = b1b_json_skip_ws(p, end);
+		if (p == end)
+			return -1;
+
+		if (*p == '}')
+			break;
+
+		if (*p != ',')
+			return -1;
+
+		p = b1b_json_skip_ws(p + 1, end);
+	}
+
+	if (!have_id || !have_error || (error == NULL && result == NULL))
+		return -1;
+
+	if (error != NULL) {
+		b1b_json_str_decode(error);
+		resp->error = error + 1;
+		resp->result = NULL;
+		resp->len = 0;
+	}
+	else {
+		resp->len = b1b_json_str_decode(result);
+		resp->result = result + 1;
+		resp->error = NULL;
+	}
+
+	return 0;
+}
@@ -0,0 +1,676 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	log.c - logging (asynchronous, once the main loop is running)
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "b1b.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+/*
+ * Writing a message to stderr can block (if it's a pipe to a slow reader), so
+ * after b1b_log_start() has been called, messages are formatted into
+ * fixed-size records in a ring, and a logging thread writes them.  Any thread
+ * can log, so the ring is a bounded multi-producer, single-consumer queue;
+ * each record has a sequence number that tells producers when it is free and
+ * the consumer when it is ready (see Dmitry Vyukov's bounded MPMC queue).  If
+ * the ring is full, messages are dropped and counted, rather than delaying the
+ * caller.
+ *
+ * The per-frame gratuitous ARP messages (see b1b_log_garp()) aren't formatted
+ * by the caller at all.  Their records hold the raw arguments (a pointer to a
+ * string literal, the interface names, the destination and errno), and the
+ * logging thread formats the message and its fields.
+ *
+ * Fatal (and abort) messages are the exception.  The caller waits for them
+ * (and everything before them) to be written, because the process is about to
+ * exit.
+ */
+
+#define B1B_LOG_RING_SIZE	2048  /* must be a power of 2 */
+_Static_assert((B1B_LOG_RING_SIZE & (B1B_LOG_RING_SIZE - 1)) == 0,
+	       "B1B_LOG_RING_SIZE");
+
+/* Longer messages are truncated */
+#define B1B_LOG_MSG_MAX		400
+
+/* Structured fields (-j/--json-log), already formatted as JSON members */
+#define B1B_LOG_FIELDS_MAX	320
+
+/* A JSON log line; big enough for the worst case of escaping a message */
+#define B1B_LOG_JSON_MAX	(6 * B1B_LOG_MSG_MAX + B1B_LOG_FIELDS_MAX + 256)
+
+/* Maximum time to wait for a fatal message to be written */
+#define B1B_LOG_FLUSH_MS	1000
+
+/* Raw arguments of a gratuitous ARP message */
+struct b1b_log_garp {
+	const char *what;  /* always a string literal */
+	struct b1b_dst dst;
+	int err;
+	char bond[IFNAMSIZ];
+	char bridge[IFNAMSIZ];
+};
+
+struct b1b_log_rec {
+	atomic_uint seq;
+	int level;
+	int line;
+	const char *file;  /* always a string literal (__FILE__) */
+	struct timespec time;  /* CLOCK_REALTIME; only set for JSON output */
+	_Bool raw;  /* msg & fields not yet formatted from garp */
+	struct b1b_log_garp garp;
+	char msg[B1B_LOG_MSG_MAX];
+	char fields[B1B_LOG_FIELDS_MAX];
+};
+
+_Bool b1b_use_syslog;
+_Bool b1b_log_json;
+
+static struct b1b_log_rec *b1b_log_ring;  /* NULL if not asynchronous */
+static atomic_uint b1b_log_tail;  /* next record to claim (producers) */
+static atomic_uint b1b_log_head;  /* next record to write (logging thread) */
+static atomic_uint_least64_t b1b_log_drops;  /* total dropped messages */
+static atomic_bool b1b_log_sleeping;  /* logging thread waiting on eventfd */
+static atomic_bool b1b_log_exit;
+static pthread_t b1b_log_thread;
+static int b1b_log_efd;
+
+
+/*
+ *
+ *	Write a message
+ *
+ */
+
+static const char *const b1b_log_levels[] = {
+	[LOG_EMERG]	= "EMERGENCY", 	/* not used */
+	[LOG_ALERT]	= "ABORT",
+	[LOG_CRIT]	= "FATAL",
+	[LOG_ERR]	= "ERROR",
+	[LOG_WARNING]	= "WARNING",
+	[LOG_NOTICE]	= "NOTICE",
+	[LOG_INFO]	= "INFO",
+	[LOG_DEBUG]	= "DEBUG"
+};
+
+/*
+ * Escape a string for JSON (without quotes).  Stops (at a character boundary)
+ * if the output buffer is full.  Returns the length of the output.
+ */
+static size_t b1b_log_escape(char *const out, const size_t size,
+			     const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t len;
+	char c;
+
+	for (len = 0; (c = *s) != 0 && size - len > 6; ++s) {
+
+		if (c == '"' || c == '\\') {
+			out[len++] = '\\';
+			out[len++] = c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			memcpy(out + len, "\\u00", 4);
+			out[len + 4] = hex[c >> 4];
+			out[len + 5] = hex[c & 0xf];
+			len += 6;
+		}
+		else {
+			out[len++] = c;
+		}
+	}
+
+	out[len] = 0;
+
+	return len;
+}
+
+static void b1b_log_write_json(const struct b1b_log_rec *const rec)
+{
+	char line[B1B_LOG_JSON_MAX];
+	char msg[6 * B1B_LOG_MSG_MAX];
+
+	b1b_log_escape(msg, sizeof msg, rec->msg);
+
+	snprintf(line, sizeof line,
+		 "{\"time\":%lld.%09ld,\"priority\":%d,\"level\":\"%s\","
+			"\"file\":\"%s\",\"line\":%d,\"message\":\"%s\"%s}\n",
+		 (long long)rec->time.tv_sec, rec->time.tv_nsec, rec->level,
+		 b1b_log_levels[rec->level], rec->file, rec->line, msg,
+		 rec->fields);
+
+	fputs(line, stderr);
+}
+
+static void b1b_log_write(const struct b1b_log_rec *const rec)
+{
+	/*
+	 * This function relies on the fact that stderr is line buffered, which
+	 * is set by main().  The stream is locked, so that messages written
+	 * synchronously by different threads aren't interleaved.
+	 */
+
+	if (b1b_log_json) {
+		b1b_log_write_json(rec);
+		return;
+	}
+
+	flockfile(stderr);
+
+	if (b1b_use_syslog)
+		fprintf(stderr, "<%d>", rec->level);
+
+	if (b1b_debug)
+		fprintf(stderr, "%s:%d: ", rec->file, rec->line);
+
+	fprintf(stderr, "%s: %s\n", b1b_log_levels[rec->level], rec->msg);
+
+	funlockfile(stderr);
+}
+
+/* Format structured fields as JSON object members (each preceded by a comma) */
+static void b1b_log_fmt_fields(char *const buf, const size_t size,
+			       const struct b1b_log_field *const fields,
+			       const unsigned int count)
+{
+	const struct b1b_log_field *f;
+	size_t len, avail;
+	unsigned int i;
+	int n;
+
+	for (i = 0, len = 0; i < count; ++i) {
+
+		f = fields + i;
+		avail = size - len;
+
+		switch (f->type) {
+
+			case B1B_LOGF_TYPE_STR:
+				n = snprintf(buf + len, avail, ",\"%s\":\"",
+					     f->key);
+				if (n < 0 || (size_t)n >= avail)
+					break;
+				n += b1b_log_escape(buf + len + n, avail - n,
+						    f->str);
+				if ((size_t)n + 1 < avail)
+					buf[len + n++] = '"';
+				else
+					n = -1;
+				break;
+
+			case B1B_LOGF_TYPE_UINT:
+				n = snprintf(buf + len, avail,
+					     ",\"%s\":%" PRIu64, f->key,
+					     f->uint);
+				break;
+
+			case B1B_LOGF_TYPE_INT:
+				n = snprintf(buf + len, avail,
+					     ",\"%s\":%" PRId64, f->key,
+					     f->sint);
+				break;
+
+			default:
+				B1B_ABORT("Invalid log field type: %d",
+					  f->type);
+		}
+
+		/* Drop a field that doesn't fit (and any after it) */
+		if (n < 0 || (size_t)n >= avail)
+			break;
+
+		len += n;
+	}
+
+	buf[len] = 0;
+}
+
+__attribute__((format(printf, 7, 0)))
+static void b1b_log_fill(struct b1b_log_rec *const rec,
+			 const char *restrict const file, const int line,
+			 const int level,
+			 const struct b1b_log_field *const fields,
+			 const unsigned int count,
+			 const char *restrict const format, va_list ap)
+{
+	rec->file = file;
+	rec->line = line;
+	rec->level = level;
+	rec->raw = 0;
+	vsnprintf(rec->msg, sizeof rec->msg, format, ap);
+
+	if (b1b_log_json) {
+		clock_gettime(CLOCK_REALTIME, &rec->time);
+		b1b_log_fmt_fields(rec->fields, sizeof rec->fields,
+				   fields, count);
+	}
+}
+
+/* Format a gratuitous ARP message from its raw arguments */
+static void b1b_log_fmt_garp(struct b1b_log_rec *const rec)
+{
+	const struct b1b_log_garp *const g = &rec->garp;
+	char mac[sizeof "xx:xx:xx:xx:xx:xx"];
+	struct b1b_log_field fields[] = {
+		B1B_LOGF_STR("event", "garp"),
+		B1B_LOGF_STR("bond", g->bond),
+		B1B_LOGF_STR("bridge", g->bridge),
+		B1B_LOGF_STR("mac", mac),
+		B1B_LOGF_UINT("vlan", g->dst.vlan),
+		B1B_LOGF_INT("errno", g->err),  /* last 2 only if err != 0 */
+		B1B_LOGF_STR("error", "")
+	};
+	const char *errstr;
+	unsigned int count;
+
+	snprintf(mac, sizeof mac, "%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8
+					":%02" PRIx8 ":%02" PRIx8 ":%02" PRIx8,
+		 g->dst.mac[0], g->dst.mac[1], g->dst.mac[2], g->dst.mac[3],
+		 g->dst.mac[4], g->dst.mac[5]);
+
+	count = sizeof fields / sizeof fields[0];
+
+	if (g->err != 0) {
+		errstr = strerror(g->err);
+		fields[count - 1].str = errstr;
+	}
+	else {
+		errstr = "";
+		count -= 2;
+	}
+
+	snprintf(rec->msg, sizeof rec->msg,
+		 "%s gratuitous ARP for %s via %s.%" PRIu16 "%s%s",
+		 g->what, mac, g->bond, g->dst.vlan, g->err ? ": " : "",
+		 errstr);
+
+	if (b1b_log_json) {
+		b1b_log_fmt_fields(rec->fields, sizeof rec->fields,
+				   fields, count);
+	}
+}
+
+/* Copy an interface name (truncating it, if necessary) */
+static void b1b_log_ifname(char *const buf, const char *const name)
+{
+	size_t len;
+
+	len = strnlen(name, IFNAMSIZ - 1);
+	memcpy(buf, name, len);
+	buf[len] = 0;
+}
+
+static void b1b_log_fill_garp(struct b1b_log_rec *const rec,
+			      const char *restrict const file, const int line,
+			      const int level, const char *const what,
+			      const char *const bond, const char *const bridge,
+			      const struct b1b_dst dst, const int err)
+{
+	rec->file = file;
+	rec->line = line;
+	rec->level = level;
+	rec->raw = 1;
+	rec->garp.what = what;
+	rec->garp.dst = dst;
+	rec->garp.err = err;
+	b1b_log_ifname(rec->garp.bond, bond);
+	b1b_log_ifname(rec->garp.bridge, bridge);
+
+	/* The time of the event, not of formatting */
+	if (b1b_log_json)
+		clock_gettime(CLOCK_REALTIME, &rec->time);
+}
+
+
+/*
+ *
+ *	Ring (producers)
+ *
+ */
+
+static void b1b_log_wake(void)
+{
+	static const uint64_t one = 1;
+
+	if (write(b1b_log_efd, &one, sizeof one) < 0)
+		abort();  /* can't log */
+}
+
+/*
+ * Claim a record in the ring.  Returns NULL (after counting the message as
+ * dropped) if the ring is full; otherwise sets *pos to the record's position.
+ */
+static struct b1b_log_rec *b1b_log_claim(unsigned int *const pos)
+{
+	struct b1b_log_rec *rec;
+	unsigned int p, seq;
+
+	p = atomic_load_explicit(&b1b_log_tail, memory_order_relaxed);
+
+	while (1) {
+
+		rec = b1b_log_ring + (p & (B1B_LOG_RING_SIZE - 1));
+		seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+
+		if (seq == p) {
+			if (atomic_compare_exchange_weak_explicit(
+					&b1b_log_tail, &p, p + 1,
+					memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if ((int)(seq - p) < 0) {
+			atomic_fetch_add_explicit(&b1b_log_drops, 1,
+						  memory_order_relaxed);
+			return NULL;
+		}
+		else {
+			p = atomic_load_explicit(&b1b_log_tail,
+						 memory_order_relaxed);
+		}
+	}
+
+	*pos = p;
+
+	return rec;
+}
+
+/* Hand a filled record (claimed at pos) to the logging thread */
+static void b1b_log_publish(struct b1b_log_rec *const rec,
+			    const unsigned int pos)
+{
+	atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+
+	/* Pairs with the fence in b1b_log_main() */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_exchange(&b1b_log_sleeping, 0))
+		b1b_log_wake();
+}
+
+/* Wait (for a limited time) until the message at pos has been written */
+static void b1b_log_flush(const unsigned int pos)
+{
+	static const struct timespec ms = { 0, 1000000 };
+
+	unsigned int i;
+
+	for (i = 0; i < B1B_LOG_FLUSH_MS; ++i) {
+		if ((int)(atomic_load(&b1b_log_head) - pos) > 0)
+			break;
+		nanosleep(&ms, NULL);
+	}
+}
+
+__attribute__((format(printf, 6, 0)))
+static void b1b_log_msg(const char *restrict const file, const int line,
+			const int level,
+			const struct b1b_log_field *const fields,
+			const unsigned int count,
+			const char *restrict const format, va_list ap)
+{
+	struct b1b_log_rec *rec, local;
+	unsigned int pos;
+
+	if (level > LOG_INFO && !b1b_debug)
+		return;
+
+	if (b1b_log_ring != NULL) {
+
+		if ((rec = b1b_log_claim(&pos)) != NULL) {
+			b1b_log_fill(rec, file, line, level, fields, count,
+				     format, ap);
+			b1b_log_publish(rec, pos);
+			if (level <= LOG_CRIT)
+				b1b_log_flush(pos);
+			return;
+		}
+
+		/* Don't drop the reason for exiting */
+		if (level > LOG_CRIT)
+			return;
+	}
+
+	b1b_log_fill(&local, file, line, level, fields, count, format, ap);
+	b1b_log_write(&local);
+}
+
+__attribute__((format(printf, 4, 0)))
+void b1b_vlog(const char *restrict const file, const int line, const int level,
+	      const char *restrict const format, va_list ap)
+{
+	b1b_log_msg(file, line, level, NULL, 0, format, ap);
+}
+
+__attribute__((format(printf, 4, 5)))
+void b1b_log(const char *restrict const file, const int line, const int level,
+	     const char *restrict const format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	b1b_log_msg(file, line, level, NULL, 0, format, ap);
+	va_end(ap);
+}
+
+/*
+ * Log a message with structured fields, which are only output (as members of
+ * the message's JSON object) if -j/--json-log is used.
+ */
+__attribute__((format(printf, 6, 7)))
+void b1b_log_fields(const char *restrict const file, const int line,
+		    const int level, const struct b1b_log_field *const fields,
+		    const unsigned int count,
+		    const char *restrict const format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	b1b_log_msg(file, line, level, fields, count, format, ap);
+	va_end(ap);
+}
+
+/*
+ * Log the result of sending (or queueing) a gratuitous ARP.  This is called
+ * for every frame, so the caller only copies the raw arguments into a record;
+ * the logging thread formats the message.  what must be a string literal.
+ */
+void b1b_log_garp(const char *restrict const file, const int line,
+		  const int level, const char *const what,
+		  const char *const bond, const char *const bridge,
+		  const struct b1b_dst dst, const int err)
+{
+	struct b1b_log_rec *rec, local;
+	unsigned int pos;
+
+	if (level > LOG_INFO && !b1b_debug)
+		return;
+
+	if (b1b_log_ring != NULL) {
+		if ((rec = b1b_log_claim(&pos)) == NULL)
+			return;
+		b1b_log_fill_garp(rec, file, line, level, what, bond, bridge,
+				  dst, err);
+		b1b_log_publish(rec, pos);
+		return;
+	}
+
+	b1b_log_fill_garp(&local, file, line, level, what, bond, bridge, dst,
+			  err);
+	b1b_log_fmt_garp(&local);
+	b1b_log_write(&local);
+}
+
+/* Number of messages dropped because the ring was full */
+uint64_t b1b_log_dropped(void)
+{
+	return atomic_load_explicit(&b1b_log_drops, memory_order_relaxed);
+}
+
+
+/*
+ *
+ *	Logging thread (consumer)
+ *
+ */
+
+static _Bool b1b_log_ready(const unsigned int head)
+{
+	const struct b1b_log_rec *const rec =
+			b1b_log_ring + (head & (B1B_LOG_RING_SIZE - 1));
+
+	return atomic_load_explicit(&rec->seq, memory_order_acquire)
+			== head + 1;
+}
+
+/* Can't use b1b_log(), which could queue the report in the full ring */
+static void b1b_log_report(const uint64_t drops)
+{
+	const struct b1b_log_field field = B1B_LOGF_UINT("dropped", drops);
+	struct b1b_log_rec rec;
+
+	rec.file = __FILE__;
+	rec.line = __LINE__;
+	rec.level = LOG_WARNING;
+	snprintf(rec.msg, sizeof rec.msg,
+		 "Log ring full; %" PRIu64 " message(s) dropped", drops);
+
+	if (b1b_log_json) {
+		clock_gettime(CLOCK_REALTIME, &rec.time);
+		b1b_log_fmt_fields(rec.fields, sizeof rec.fields, &field, 1);
+	}
+
+	b1b_log_write(&rec);
+}
+
+static void b1b_log_drain(void)
+{
+	static uint64_t reported;
+
+	struct b1b_log_rec *rec;
+	unsigned int head;
+	uint64_t drops;
+
+	head = atomic_load_explicit(&b1b_log_head, memory_order_relaxed);
+
+	while (b1b_log_ready(head)) {
+
+		rec = b1b_log_ring + (head & (B1B_LOG_RING_SIZE - 1));
+		if (rec->raw)
+			b1b_log_fmt_garp(rec);
+		b1b_log_write(rec);
+
+		/* Record is free for producers the next time around the ring */
+		atomic_store_explicit(&rec->seq, head + B1B_LOG_RING_SIZE,
+				      memory_order_release);
+		atomic_store(&b1b_log_head, ++head);
+	}
+
+	drops = atomic_load_explicit(&b1b_log_drops, memory_order_relaxed);
+
+	if (drops != reported) {
+		b1b_log_report(drops - reported);
+		reported = drops;
+	}
+}
+
+static void *b1b_log_main(void *const arg __attribute__((unused)))
+{
+	uint64_t count;
+
+	while (1) {
+
+		b1b_log_drain();
+
+		if (atomic_load(&b1b_log_exit))
+			break;
+
+		atomic_store(&b1b_log_sleeping, 1);
+
+		/* Pairs with the fence in b1b_log_publish() */
+		atomic_thread_fence(memory_order_seq_cst);
+
+		if (b1b_log_ready(atomic_load(&b1b_log_head))) {
+			atomic_store(&b1b_log_sleeping, 0);
+			continue;
+		}
+
+		/* eventfd counter persists, so wake-ups can't be lost */
+		if (read(b1b_log_efd, &count, sizeof count) < 0
+				&& errno != EINTR) {
+			abort();  /* can't log */
+		}
+	}
+
+	b1b_log_drain();
+
+	return NULL;
+}
+
+
+/*
+ *
+ *	Start & stop (main thread)
+ *
+ */
+
+void b1b_log_start(void)
+{
+	unsigned int i;
+	int result;
+
+	b1b_log_ring = B1B_ZALLOC(B1B_LOG_RING_SIZE * sizeof *b1b_log_ring);
+
+	for (i = 0; i < B1B_LOG_RING_SIZE; ++i)
+		atomic_init(&b1b_log_ring[i].seq, i);
+
+	if ((b1b_log_efd = eventfd(0, EFD_CLOEXEC)) < 0)
+		B1B_FATAL("Failed to create logging eventfd: %m");
+
+	result = pthread_create(&b1b_log_thread, NULL, b1b_log_main, NULL);
+	if (result != 0) {
+		B1B_FATAL("Failed to create logging thread: %s",
+			  strerror(result));
+	}
+}
+
+/* Write any queued messages and return to synchronous logging */
+void b1b_log_stop(void)
+{
+	struct b1b_log_rec *ring;
+	int result;
+
+	if ((ring = b1b_log_ring) == NULL)
+		return;
+
+	atomic_store(&b1b_log_exit, 1);
+	b1b_log_wake();
+
+	if ((result = pthread_join(b1b_log_thread, NULL)) != 0)
+		abort();  /* can't log */
+
+	/* No other threads are left to log */
+	b1b_log_ring = NULL;
+	free(ring);
+
+	if (close(b1b_log_efd) < 0)
+		B1B_ERR("Failed to close logging eventfd: %m");
+}
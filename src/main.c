@@ -9,7 +9,7 @@
  */
 
 
-#define _GNU_SOURCE  /* for ppoll() */
+#define _GNU_SOURCE  /* for vasprintf() */
 
 #include "b1b.h"
 
@@ -21,15 +21,40 @@
 #include <string.h>
 
 #include <net/if.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
 #include <libmnl/libmnl.h>
 
 
 _Bool b1b_debug;
-static _Bool b1b_use_syslog;
+_Bool b1b_slave_xmit;
+_Bool b1b_qdisc_bypass;
+unsigned int b1b_nworkers;
+_Bool b1b_io_uring;
+unsigned int b1b_ovs_prefetch;
+_Bool b1b_ovs_datapath;
+_Bool b1b_ovs_openflow;
+const char *b1b_ovs_rundir = "/run/openvswitch";
+const char *b1b_control_path;
+const char *b1b_metrics_path;
+unsigned int b1b_metrics_port;
+const char *b1b_trace_path;
+const char *b1b_replay_path;
+_Bool b1b_null_xmit;
+_Bool b1b_dry_run;
+const char *b1b_pcap_path;
 static sig_atomic_t b1b_exit_flag;
+static sig_atomic_t b1b_stats_flag;
+
+/* Maximum number of events returned by a single epoll_pwait() call */
+#define B1B_MAX_EVENTS		8
+
+/* Upper limit for -p/--ovs-prefetch (seconds) */
+#define B1B_MAX_PREFETCH	3600
+
+/* Upper limit for -w/--workers */
+#define B1B_MAX_WORKERS		64
 
 
 /*
@@ -38,51 +63,6 @@ static sig_atomic_t b1b_exit_flag;
  *
  */
 
-__attribute__((format(printf, 4, 0)))
-void b1b_vlog(const char *restrict const file, const int line, const int level,
-	      const char *restrict const format, va_list ap)
-{
-	static const char *const level_names[] = {
-		[LOG_EMERG]	= "EMERGENCY", 	/* not used */
-		[LOG_ALERT]	= "ABORT",
-		[LOG_CRIT]	= "FATAL",
-		[LOG_ERR]	= "ERROR",
-		[LOG_WARNING]	= "WARNING",
-		[LOG_NOTICE]	= "NOTICE",
-		[LOG_INFO]	= "INFO",
-		[LOG_DEBUG]	= "DEBUG"
-	};
-
-	/*
-	 * This function relies on the fact that stderr is line buffered, which
-	 * is set by main().
-	 */
-
-	if (level > LOG_INFO && !b1b_debug)
-		return;
-
-	if (b1b_use_syslog)
-		fprintf(stderr, "<%d>", level);
-
-	if (b1b_debug)
-		fprintf(stderr, "%s:%d: ", file, line);
-
-	fprintf(stderr, "%s: ", level_names[level]);
-	vfprintf(stderr, format, ap);
-	fputc('\n', stderr);
-}
-
-__attribute__((format(printf, 4, 5)))
-void b1b_log(const char *restrict const file, const int line, const int level,
-	     const char *restrict const format, ...)
-{
-	va_list ap;
-
-	va_start(ap, format);
-	b1b_vlog(file, line, level, format, ap);
-	va_end(ap);
-}
-
 void *b1b_zalloc(const size_t size, const char *const file, const int line)
 {
 	void *result;
@@ -143,9 +123,33 @@ static _Bool b1b_opt_match(const char *restrict const arg,
 	return strcmp(arg, short_opt) == 0 || strcmp(arg, long_opt) == 0;
 }
 
+static unsigned int b1b_parse_uint(const char *restrict const opt,
+				   const char *restrict const arg,
+				   const unsigned int min,
+				   const unsigned int max)
+{
+	unsigned long value;
+	char *endptr;
+
+	if (arg == NULL)
+		B1B_FATAL("Missing argument for option: %s", opt);
+
+	errno = 0;
+	value = strtoul(arg, &endptr, 10);
+
+	if (errno != 0 || *endptr != 0 || endptr == arg || *arg == '-'
+			|| value < min || value > max) {
+		B1B_FATAL("Invalid value for option: %s: %s "
+				"(must be %u - %u)",
+			  opt, arg, min, max);
+	}
+
+	return value;
+}
+
 static int b1b_parse_args(const int argc, char **const argv)
 {
-	_Bool log_dest_set;
+	_Bool log_dest_set, rundir_set;
 	int i;
 
 #if 0
@@ -154,6 +158,7 @@ static int b1b_parse_args(const int argc, char **const argv)
 #endif
 
 	log_dest_set = 0;
+	rundir_set = 0;
 
 	for (i = 1; i < argc; ++i) {
 
@@ -182,6 +187,31 @@ static int b1b_parse_args(const int argc, char **const argv)
 			continue;
 		}
 
+		if (b1b_opt_match(argv[i], "-j", "--json-log")) {
+			if (log_dest_set) {
+				B1B_FATAL("Duplicate/conflicting option: %s: "
+						"Log destination already set",
+					  argv[i]);
+			}
+			b1b_use_syslog = 0;
+			b1b_log_json = 1;
+			log_dest_set = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-c", "--control")) {
+			if (b1b_control_path != NULL) {
+				B1B_FATAL("Duplicate option: %s: "
+						"Control socket already set",
+					  argv[i]);
+			}
+			if (argv[i + 1] == NULL || argv[i + 1][0] == 0)
+				B1B_FATAL("Missing argument for option: %s",
+					  argv[i]);
+			b1b_control_path = argv[++i];
+			continue;
+		}
+
 		if (b1b_opt_match(argv[i], "-d", "--debug")) {
 			if (b1b_debug) {
 				B1B_FATAL("Duplicate/conflicting option: %s: "
@@ -192,6 +222,162 @@ static int b1b_parse_args(const int argc, char **const argv)
 			continue;
 		}
 
+		if (b1b_opt_match(argv[i], "-s", "--slave-xmit")) {
+			if (b1b_slave_xmit) {
+				B1B_FATAL("Duplicate option: %s: Slave "
+						"transmission already set",
+					  argv[i]);
+			}
+			b1b_slave_xmit = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-q", "--qdisc-bypass")) {
+			if (b1b_qdisc_bypass) {
+				B1B_FATAL("Duplicate option: %s: "
+						"Qdisc bypass already set",
+					  argv[i]);
+			}
+			b1b_qdisc_bypass = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-k", "--ovs-datapath")) {
+			if (b1b_ovs_datapath) {
+				B1B_FATAL("Duplicate option: %s: "
+						"OVS datapath FDB already set",
+					  argv[i]);
+			}
+			b1b_ovs_datapath = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-m", "--metrics")) {
+			if (b1b_metrics_path != NULL || b1b_metrics_port != 0) {
+				B1B_FATAL("Duplicate option: %s: "
+						"Metrics endpoint already set",
+					  argv[i]);
+			}
+			if (argv[i + 1] != NULL && argv[i + 1][0] == '/') {
+				b1b_metrics_path = argv[++i];
+				continue;
+			}
+			b1b_metrics_port = b1b_parse_uint(argv[i], argv[i + 1],
+							  1, UINT16_MAX);
+			++i;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-n", "--dry-run")) {
+			if (b1b_dry_run) {
+				B1B_FATAL("Duplicate option: %s: "
+						"Dry run already set",
+					  argv[i]);
+			}
+			b1b_dry_run = 1;
+			b1b_null_xmit = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-f", "--pcap")) {
+			if (b1b_pcap_path != NULL) {
+				B1B_FATAL("Duplicate option: %s: "
+						"Pcap file already set",
+					  argv[i]);
+			}
+			if (argv[i + 1] == NULL || argv[i + 1][0] == 0)
+				B1B_FATAL("Missing argument for option: %s",
+					  argv[i]);
+			b1b_pcap_path = argv[++i];
+			b1b_null_xmit = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-o", "--ovs-openflow")) {
+			if (b1b_ovs_openflow) {
+				B1B_FATAL("Duplicate option: %s: OVS OpenFlow "
+						"transmission already set",
+					  argv[i]);
+			}
+			b1b_ovs_openflow = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-p", "--ovs-prefetch")) {
+			if (b1b_ovs_prefetch != 0) {
+				B1B_FATAL("Duplicate option: %s: OVS prefetch "
+						"interval already set",
+					  argv[i]);
+			}
+			b1b_ovs_prefetch = b1b_parse_uint(argv[i], argv[i + 1],
+							  1, B1B_MAX_PREFETCH);
+			++i;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-r", "--ovs-rundir")) {
+			if (rundir_set) {
+				B1B_FATAL("Duplicate option: %s: "
+						"OVS run directory already set",
+					  argv[i]);
+			}
+			if (argv[i + 1] == NULL || argv[i + 1][0] == 0)
+				B1B_FATAL("Missing argument for option: %s",
+					  argv[i]);
+			b1b_ovs_rundir = argv[++i];
+			rundir_set = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-t", "--trace")) {
+			if (b1b_trace_path != NULL || b1b_replay_path != NULL) {
+				B1B_FATAL("Duplicate/conflicting option: %s: "
+						"Trace file already set",
+					  argv[i]);
+			}
+			if (argv[i + 1] == NULL || argv[i + 1][0] == 0)
+				B1B_FATAL("Missing argument for option: %s",
+					  argv[i]);
+			b1b_trace_path = argv[++i];
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-y", "--replay")) {
+			if (b1b_trace_path != NULL || b1b_replay_path != NULL) {
+				B1B_FATAL("Duplicate/conflicting option: %s: "
+						"Trace file already set",
+					  argv[i]);
+			}
+			if (argv[i + 1] == NULL || argv[i + 1][0] == 0)
+				B1B_FATAL("Missing argument for option: %s",
+					  argv[i]);
+			b1b_replay_path = argv[++i];
+			b1b_null_xmit = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-u", "--io-uring")) {
+			if (b1b_io_uring) {
+				B1B_FATAL("Duplicate option: %s: "
+						"io_uring already set",
+					  argv[i]);
+			}
+			b1b_io_uring = 1;
+			continue;
+		}
+
+		if (b1b_opt_match(argv[i], "-w", "--workers")) {
+			if (b1b_nworkers != 0) {
+				B1B_FATAL("Duplicate option: %s: "
+						"Number of workers already set",
+					  argv[i]);
+			}
+			b1b_nworkers = b1b_parse_uint(argv[i], argv[i + 1],
+						      1, B1B_MAX_WORKERS);
+			++i;
+			continue;
+		}
+
 		B1B_FATAL("Invalid option: %s", argv[i]);
 	}
 
@@ -214,6 +400,9 @@ static struct b1b_global_session *b1b_gs_alloc(void)
 	gs->bufsize = MNL_SOCKET_BUFFER_SIZE;
 	gs->ovssock = -1;
 
+	if ((gs->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		B1B_FATAL("Failed to create epoll instance: %m");
+
 	return gs;
 }
 
@@ -221,11 +410,14 @@ static void b1b_gs_free(struct b1b_global_session *const gs)
 {
 	unsigned int i;
 
-	if (gs->ovssock >= 0 && close(gs->ovssock) < 0)
-		B1B_ERR("Failed to close UNIX socket: %m");
+	b1b_ovs_close(gs);
+	b1b_metrics_close(gs);
+	b1b_control_close(gs);
+
+	b1b_xmit_fini(&gs->xmit);
 
-	if (close(gs->arpsock) < 0)
-		B1B_ERR("Failed to close ARP socket: %m");
+	if (close(gs->retry_ev.fd) < 0)
+		B1B_ERR("Failed to close ARP retry timer: %m");
 
 	if (mnl_socket_close(gs->nlsock) < 0)
 		B1B_ERR("Failed to close netlink request socket: %m");
@@ -233,17 +425,55 @@ static void b1b_gs_free(struct b1b_global_session *const gs)
 	if (mnl_socket_close(gs->mcsock) < 0)
 		B1B_ERR("Failed to close netlink multicast socket: %m");
 
+	if (gs->gensock != NULL && mnl_socket_close(gs->gensock) < 0)
+		B1B_ERR("Failed to close generic netlink socket: %m");
+
+	if (close(gs->epfd) < 0)
+		B1B_ERR("Failed to close epoll instance: %m");
+
 	for (i = 0; i < gs->bcount; ++i) {
+		b1b_fdb_free(&gs->bonds[i].burst.fdbtree);
+		b1b_fdb_free(&gs->bonds[i].fdbcache);
+		b1b_of_close(&gs->bonds[i].ofconn);
 		free(gs->bonds[i].brname);
 		free(gs->bonds[i].ifname);
 	}
 
-	free(gs->ovssock_path);
+	b1b_stats_free(gs);
 	free(gs->bonds);
 	free(gs);
 }
 
 
+/*
+ *
+ *	Event sources
+ *
+ */
+
+static void b1b_ev_ctl(struct b1b_global_session *const gs,
+		       struct b1b_event_src *const src, const int op,
+		       const uint32_t events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = src };
+
+	if (epoll_ctl(gs->epfd, op, src->fd, &ev) < 0)
+		B1B_FATAL("Failed to update epoll interest list: %m");
+}
+
+void b1b_ev_add(struct b1b_global_session *const gs,
+		struct b1b_event_src *const src, const uint32_t events)
+{
+	b1b_ev_ctl(gs, src, EPOLL_CTL_ADD, events);
+}
+
+void b1b_ev_mod(struct b1b_global_session *const gs,
+		struct b1b_event_src *const src, const uint32_t events)
+{
+	b1b_ev_ctl(gs, src, EPOLL_CTL_MOD, events);
+}
+
+
 /*
  *
  *	Signal handling
@@ -255,6 +485,11 @@ static void b1b_catch_signal(const int signum __attribute__((unused)))
 	b1b_exit_flag = 1;
 }
 
+static void b1b_catch_usr1(const int signum __attribute__((unused)))
+{
+	b1b_stats_flag = 1;
+}
+
 static void b1b_signal_setup(sigset_t *const oldmask)
 {
 	struct sigaction sa;
@@ -266,6 +501,8 @@ static void b1b_signal_setup(sigset_t *const oldmask)
 		B1B_FATAL("sigaddset(SIGTERM): %m");
 	if (sigaddset(&mask, SIGINT) != 0)
 		B1B_FATAL("sigaddset(SIGINT): %m");
+	if (sigaddset(&mask, SIGUSR1) != 0)
+		B1B_FATAL("sigaddset(SIGUSR1): %m");
 
 	sa.sa_handler = b1b_catch_signal;
 	sa.sa_mask = mask;
@@ -278,6 +515,38 @@ static void b1b_signal_setup(sigset_t *const oldmask)
 		B1B_FATAL("sigaction(SIGTERM): %m");
 	if (sigaction(SIGINT, &sa, NULL) != 0)
 		B1B_FATAL("sigaction(SIGINT): %m");
+
+	/* Log statistics; not a one-shot handler */
+	sa.sa_handler = b1b_catch_usr1;
+	sa.sa_flags = 0;
+
+	if (sigaction(SIGUSR1, &sa, NULL) != 0)
+		B1B_FATAL("sigaction(SIGUSR1): %m");
+}
+
+
+/*
+ *
+ *	Dry run (-n/--dry-run)
+ *
+ */
+
+/*
+ * Announce every bond once, as if it had failed over, with frames going
+ * nowhere (or to the pcap file).  The failover summaries (and the statistics
+ * logged at exit) show how long each stage took.
+ */
+static void b1b_dry_run_all(struct b1b_global_session *const gs)
+{
+	struct b1b_bond_session *bs;
+	unsigned int i;
+
+	for (i = 0; i < gs->bcount; ++i) {
+		bs = gs->bonds + i;
+		B1B_INFO("Dry run: announcing %s", bs->ifname);
+		clock_gettime(CLOCK_MONOTONIC, &bs->event_time);
+		b1b_send_garps(gs, bs);
+	}
 }
 
 
@@ -289,14 +558,17 @@ static void b1b_signal_setup(sigset_t *const oldmask)
 
 int main(const int argc, char **const argv)
 {
+	struct epoll_event events[B1B_MAX_EVENTS];
 	struct b1b_global_session *gs;
-	struct pollfd pfd;
+	struct b1b_event_src *src;
 	sigset_t ppmask;
-	int bindex;
+	int bindex, count, i;
 
 	setlinebuf(stderr);
 	b1b_use_syslog = !isatty(STDERR_FILENO);
 	bindex = b1b_parse_args(argc, argv);
+	b1b_trace_open();
+	b1b_pcap_open();
 	gs = b1b_gs_alloc();
 	b1b_nlsock_open(gs);
 	b1b_mcsock_open(gs);
@@ -307,33 +579,60 @@ int main(const int argc, char **const argv)
 	else
 		b1b_detect_bonds(gs);
 
-	pfd.fd = mnl_socket_get_fd(gs->mcsock);
-	pfd.events = POLLIN;
+	b1b_stats_init(gs);
+	b1b_metrics_open(gs);
+	b1b_control_open(gs);
+
+	/* Worker and logging threads inherit the blocked signal mask */
+	b1b_signal_setup(&ppmask);
+	b1b_log_start();
+	b1b_workers_start(gs);
 
 	B1B_INFO("Ready");
 
-	b1b_signal_setup(&ppmask);
+	/* Replay runs (without the event loop) until the trace is exhausted */
+	if (b1b_replay_path != NULL) {
+		b1b_trace_replay(gs);
+		b1b_exit_flag = 1;
+	}
+	else if (b1b_dry_run) {
+		b1b_dry_run_all(gs);
+		b1b_exit_flag = 1;
+	}
 
 	while (!b1b_exit_flag) {
 
-		if (ppoll(&pfd, 1, NULL, &ppmask) < 0) {
+		if (b1b_stats_flag) {
+			b1b_stats_flag = 0;
+			b1b_stats_log(gs);
+		}
+
+		count = epoll_pwait(gs->epfd, events, B1B_MAX_EVENTS, -1,
+				    &ppmask);
+		if (count < 0) {
 			if (errno == EINTR)
 				continue;
-			B1B_FATAL("Failed to wait for netlink messages: %m");
+			B1B_FATAL("Failed to wait for events: %m");
 		}
 
-		if (pfd.revents & ~POLLIN) {
-			B1B_FATAL("Unexpected event type(s) on netlink socket: "
-					"%04hx",
-				  pfd.revents);
+		for (i = 0; i < count; ++i) {
+			src = events[i].data.ptr;
+			src->cb(gs, src, events[i].events);
 		}
-
-		b1b_mcast_process(gs);
 	}
 
 	B1B_INFO("Exiting");
 
+	b1b_workers_stop(gs);
+
+	/* Workers finish their queued bursts before they exit */
+	if (b1b_replay_path != NULL || b1b_dry_run)
+		b1b_stats_log(gs);
+
 	b1b_gs_free(gs);
+	b1b_pcap_close();
+	b1b_trace_close();
+	b1b_log_stop();
 
 	return 0;
 }
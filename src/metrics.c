@@ -0,0 +1,590 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	metrics.c - Prometheus metrics endpoint (-m/--metrics)
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#define _GNU_SOURCE  /* for open_memstream() */
+
+#include "b1b.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+/*
+ * A minimal HTTP/1.x server, on a UNIX socket or a loopback TCP port, that
+ * answers GET /metrics in the Prometheus text format.  Everything is
+ * non-blocking and runs in the main event loop; rendering a response only
+ * reads counters (no system calls other than the final send()), so a scrape
+ * can't hold up a burst for more than a few microseconds.  Each connection
+ * handles a single request.
+ */
+
+/* Maximum number of simultaneous connections; the oldest is dropped */
+#define B1B_METRICS_MAX_CONNS	4
+
+/* Maximum size of a request (including headers) */
+#define B1B_METRICS_REQ_MAX	2048
+
+/* Histogram bucket boundaries (powers of 2) */
+#define B1B_METRICS_NS_MIN	10  /* ~1 us */
+#define B1B_METRICS_NS_MAX	36  /* ~69 s */
+#define B1B_METRICS_SIZE_MAX	20  /* ~1M destinations */
+
+struct b1b_metrics_conn {
+	struct b1b_event_src ev;  /* must be first; cb is NULL if not in use */
+	struct timespec accepted;
+	char *resp;  /* NULL until the request has been received */
+	size_t resp_len;
+	size_t sent;
+	size_t req_len;
+	char req[B1B_METRICS_REQ_MAX];
+};
+
+struct b1b_metrics {
+	struct b1b_event_src listen_ev;
+	struct b1b_metrics_conn conns[B1B_METRICS_MAX_CONNS];
+};
+
+
+/*
+ *
+ *	Render metrics
+ *
+ */
+
+/* Label text; an interface name could (in theory) need escaping */
+static void b1b_metrics_labels(char *const buf, const size_t size,
+			       const char *restrict const bond,
+			       const char *restrict const stage)
+{
+	char *p, *end;
+	const char *s;
+
+	p = buf;
+	end = buf + size - 1;
+
+	p += snprintf(p, end - p, "bond=\"");
+
+	for (s = bond; *s != 0 && end - p >= 2; ++s) {
+		if (*s == '"' || *s == '\\')
+			*p++ = '\\';
+		*p++ = *s;
+	}
+
+	if (stage != NULL)
+		snprintf(p, end + 1 - p, "\",stage=\"%s\"", stage);
+	else
+		snprintf(p, end + 1 - p, "\"");
+}
+
+static void b1b_metrics_head(FILE *const f, const char *restrict const name,
+			     const char *restrict const type,
+			     const char *restrict const help)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Number of decimal digits in a (non-zero) value */
+static int b1b_metrics_digits(uint64_t value)
+{
+	int digits;
+
+	for (digits = 0; value != 0; value /= 10)
+		++digits;
+
+	return digits;
+}
+
+/*
+ * Output a histogram with a bucket for the values below each power of 2, from
+ * 2^min to 2^max.  The recorded values are integers, so each bucket's upper
+ * bound (le, which is inclusive) is 2^k - 1, scaled with all of its digits, so
+ * that it isn't rounded up to the next power of 2.  labels may be empty.  scale
+ * converts the recorded values (usually nanoseconds) to the exported unit.
+ */
+static void b1b_metrics_hist(FILE *const f, const char *restrict const name,
+			     const char *restrict const labels,
+			     const struct b1b_hist *const hist,
+			     const unsigned int min, const unsigned int max,
+			     const double scale)
+{
+	const char *const sep = *labels != 0 ? "," : "";
+	const char *const lbrace = *labels != 0 ? "{" : "";
+	const char *const rbrace = *labels != 0 ? "}" : "";
+	unsigned int i, shift, limit;
+	uint64_t count, sum, le;
+
+	/* Counts are read once, so the buckets are consistent with _count */
+	for (i = 0, shift = min, count = 0; shift <= max; ++shift) {
+
+		limit = b1b_hist_bucket(UINT64_C(1) << shift);
+
+		for (; i < limit; ++i) {
+			count += __atomic_load_n(&hist->buckets[i],
+						 __ATOMIC_RELAXED);
+		}
+
+		le = (UINT64_C(1) << shift) - 1;
+
+		fprintf(f, "%s_bucket{%s%sle=\"%.*g\"} %" PRIu64 "\n",
+			name, labels, sep, b1b_metrics_digits(le | 1),
+			(double)le * scale, count);
+	}
+
+	for (; i < B1B_HIST_BUCKETS; ++i)
+		count += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+
+	sum = __atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED);
+
+	fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n",
+		name, labels, sep, count);
+	fprintf(f, "%s_sum%s%s%s %.9g\n",
+		name, lbrace, labels, rbrace, (double)sum * scale);
+	fprintf(f, "%s_count%s%s%s %" PRIu64 "\n",
+		name, lbrace, labels, rbrace, count);
+}
+
+/* Per-bond counters, in the order they appear in struct b1b_bond_stats */
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} b1b_metrics_counters[] = {
+	{
+		"b1b_failovers_total",
+		"Failovers (gratuitous ARP bursts completed).",
+		offsetof(struct b1b_bond_stats, failovers)
+	},
+	{
+		"b1b_frames_sent_total",
+		"Gratuitous ARP frames sent.",
+		offsetof(struct b1b_bond_stats, frames)
+	},
+	{
+		"b1b_send_errors_total",
+		"Gratuitous ARP frames that could not be sent.",
+		offsetof(struct b1b_bond_stats, errors)
+	},
+	{
+		"b1b_destinations_total",
+		"Destinations (FDB entries) of all bursts.",
+		offsetof(struct b1b_bond_stats, dsts)
+	},
+	{
+		"b1b_fdb_bytes_total",
+		"Bytes received to get forwarding databases.",
+		offsetof(struct b1b_bond_stats, fdb_bytes)
+	}
+};
+
+static char *b1b_metrics_render(const struct b1b_global_session *const gs,
+				size_t *const len)
+{
+	const struct b1b_bond_session *bs;
+	const uint64_t *counter;
+	char labels[96];
+	unsigned int i, j;
+	char *buf;
+	FILE *f;
+
+	if ((f = open_memstream(&buf, len)) == NULL)
+		B1B_FATAL("Failed to create memory stream: %m");
+
+	for (j = 0; j < sizeof b1b_metrics_counters
+					/ sizeof b1b_metrics_counters[0]; ++j) {
+
+		b1b_metrics_head(f, b1b_metrics_counters[j].name, "counter",
+				 b1b_metrics_counters[j].help);
+
+		for (i = 0; i < gs->bcount; ++i) {
+			bs = gs->bonds + i;
+			counter = (const void *)((const char *)bs->stats
+					+ b1b_metrics_counters[j].offset);
+			b1b_metrics_labels(labels, sizeof labels, bs->ifname,
+					   NULL);
+			fprintf(f, "%s{%s} %" PRIu64 "\n",
+				b1b_metrics_counters[j].name, labels,
+				__atomic_load_n(counter, __ATOMIC_RELAXED));
+		}
+	}
+
+	b1b_metrics_head(f, "b1b_failover_stage_seconds", "histogram",
+			 "Time from failover notification to each stage.");
+
+	for (i = 0; i < gs->bcount; ++i) {
+		bs = gs->bonds + i;
+		for (j = 0; j < B1B_STAGE_COUNT; ++j) {
+			b1b_metrics_labels(labels, sizeof labels, bs->ifname,
+					   b1b_stage_name(j));
+			b1b_metrics_hist(f, "b1b_failover_stage_seconds",
+					 labels, &bs->stats->hist[j],
+					 B1B_METRICS_NS_MIN, B1B_METRICS_NS_MAX,
+					 1e-9);
+		}
+	}
+
+	b1b_metrics_head(f, "b1b_burst_duration_seconds", "histogram",
+			 "Time from FDB acquisition to last frame of each "
+				"burst.");
+
+	for (i = 0; i < gs->bcount; ++i) {
+		bs = gs->bonds + i;
+		b1b_metrics_labels(labels, sizeof labels, bs->ifname, NULL);
+		b1b_metrics_hist(f, "b1b_burst_duration_seconds", labels,
+				 &bs->stats->burst, B1B_METRICS_NS_MIN,
+				 B1B_METRICS_NS_MAX, 1e-9);
+	}
+
+	b1b_metrics_head(f, "b1b_burst_destinations", "histogram",
+			 "Destinations (FDB entries) per burst.");
+
+	for (i = 0; i < gs->bcount; ++i) {
+		bs = gs->bonds + i;
+		b1b_metrics_labels(labels, sizeof labels, bs->ifname, NULL);
+		b1b_metrics_hist(f, "b1b_burst_destinations", labels,
+				 &bs->stats->size, 0, B1B_METRICS_SIZE_MAX, 1);
+	}
+
+	b1b_metrics_head(f, "b1b_netlink_overflows_total", "counter",
+			 "Netlink multicast socket receive buffer overruns.");
+	fprintf(f, "b1b_netlink_overflows_total %" PRIu64 "\n",
+		gs->nl_overflows);
+
+	b1b_metrics_head(f, "b1b_log_dropped_total", "counter",
+			 "Log messages dropped because the log ring was full.");
+	fprintf(f, "b1b_log_dropped_total %" PRIu64 "\n", b1b_log_dropped());
+
+	b1b_metrics_head(f, "b1b_ovs_rpc_duration_seconds", "histogram",
+			 "Latency of ovs-vswitchd JSON-RPC requests.");
+	b1b_metrics_hist(f, "b1b_ovs_rpc_duration_seconds", "", &gs->ovs_rpc,
+			 B1B_METRICS_NS_MIN, B1B_METRICS_NS_MAX, 1e-9);
+
+	if (fclose(f) != 0)
+		B1B_FATAL("Failed to render metrics: %m");
+
+	return buf;
+}
+
+
+/*
+ *
+ *	Connections
+ *
+ */
+
+static void b1b_metrics_drop(struct b1b_metrics_conn *const conn)
+{
+	if (close(conn->ev.fd) < 0)
+		B1B_ERR("Failed to close metrics connection: %m");
+
+	free(conn->resp);
+	conn->resp = NULL;
+	conn->ev.cb = NULL;
+}
+
+static void b1b_metrics_respond(const struct b1b_global_session *const gs,
+				struct b1b_metrics_conn *const conn)
+{
+	const char *status;
+	char *body;
+	size_t len;
+
+	if (strncmp(conn->req, "GET ", 4) != 0)
+		status = "405 Method Not Allowed";
+	else if (strncmp(conn->req + 4, "/metrics ", 9) != 0
+			&& strncmp(conn->req + 4, "/metrics? ", 10) != 0)
+		status = "404 Not Found";
+	else
+		status = NULL;
+
+	if (status != NULL) {
+		conn->resp_len = B1B_ASPRINTF(&conn->resp,
+					      "HTTP/1.1 %s\r\n"
+					      "Content-Length: 0\r\n"
+					      "Connection: close\r\n\r\n",
+					      status);
+		return;
+	}
+
+	body = b1b_metrics_render(gs, &len);
+
+	conn->resp_len = B1B_ASPRINTF(&conn->resp,
+				      "HTTP/1.1 200 OK\r\n"
+				      "Content-Type: text/plain; "
+				      "version=0.0.4\r\n"
+				      "Content-Length: %zu\r\n"
+				      "Connection: close\r\n\r\n%s",
+				      len, body);
+	free(body);
+}
+
+/* Returns false if the connection should be dropped */
+static _Bool b1b_metrics_read(const struct b1b_global_session *const gs,
+			      struct b1b_metrics_conn *const conn)
+{
+	ssize_t bytes;
+
+	while (1) {
+
+		bytes = recv(conn->ev.fd, conn->req + conn->req_len,
+			     sizeof conn->req - 1 - conn->req_len, 0);
+
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 1;
+			B1B_DEBUG("Failed to read metrics request: %m");
+			return 0;
+		}
+
+		if (bytes == 0)
+			return 0;
+
+		conn->req_len += bytes;
+		conn->req[conn->req_len] = 0;
+
+		/* End of headers */
+		if (strstr(conn->req, "\r\n\r\n") != NULL
+				|| strstr(conn->req, "\n\n") != NULL) {
+			b1b_metrics_respond(gs, conn);
+			return 1;
+		}
+
+		if (conn->req_len == sizeof conn->req - 1) {
+			B1B_DEBUG("Metrics request too long");
+			return 0;
+		}
+	}
+}
+
+/* Returns false if the connection should be dropped (or is finished) */
+static _Bool b1b_metrics_write(struct b1b_metrics_conn *const conn)
+{
+	ssize_t bytes;
+
+	while (conn->sent < conn->resp_len) {
+
+		bytes = send(conn->ev.fd, conn->resp + conn->sent,
+			     conn->resp_len - conn->sent, MSG_NOSIGNAL);
+
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 1;
+			B1B_DEBUG("Failed to send metrics response: %m");
+			return 0;
+		}
+
+		conn->sent += bytes;
+	}
+
+	return 0;
+}
+
+static void b1b_metrics_conn_cb(struct b1b_global_session *const gs,
+				struct b1b_event_src *const src,
+				const uint32_t events __attribute__((unused)))
+{
+	struct b1b_metrics_conn *const conn = (struct b1b_metrics_conn *)src;
+
+	if (conn->resp == NULL) {
+
+		if (!b1b_metrics_read(gs, conn)) {
+			b1b_metrics_drop(conn);
+			return;
+		}
+
+		if (conn->resp == NULL)
+			return;
+	}
+
+	if (b1b_metrics_write(conn)) {
+		b1b_ev_mod(gs, &conn->ev, EPOLLOUT);
+		return;
+	}
+
+	b1b_metrics_drop(conn);
+}
+
+static void b1b_metrics_accept_cb(struct b1b_global_session *const gs,
+				  struct b1b_event_src *const src,
+				  const uint32_t events __attribute__((unused)))
+{
+	struct b1b_metrics *const m = gs->metrics;
+	struct b1b_metrics_conn *conn;
+	unsigned int i;
+	int fd;
+
+	while (1) {
+
+		fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN) {
+				B1B_ERR("Failed to accept metrics connection: "
+						"%m");
+			}
+			return;
+		}
+
+		/* Use a free slot, or the oldest connection's slot */
+		for (i = 0, conn = m->conns; i < B1B_METRICS_MAX_CONNS; ++i) {
+
+			if (m->conns[i].ev.cb == NULL) {
+				conn = m->conns + i;
+				break;
+			}
+
+			if (b1b_ns_between(&m->conns[i].accepted,
+					   &conn->accepted) > 0) {
+				conn = m->conns + i;
+			}
+		}
+
+		if (conn->ev.cb != NULL) {
+			B1B_DEBUG("Too many metrics connections; "
+					"dropping oldest");
+			b1b_metrics_drop(conn);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &conn->accepted);
+		conn->req_len = 0;
+		conn->sent = 0;
+		conn->ev.cb = b1b_metrics_conn_cb;
+		conn->ev.fd = fd;
+		b1b_ev_add(gs, &conn->ev, EPOLLIN);
+	}
+}
+
+
+/*
+ *
+ *	Open & close the endpoint
+ *
+ */
+
+static int b1b_metrics_unix(void)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct stat st;
+	int sock;
+
+	if (strlen(b1b_metrics_path) >= sizeof sun.sun_path)
+		B1B_FATAL("Metrics socket path too long: %s", b1b_metrics_path);
+
+	strcpy(sun.sun_path, b1b_metrics_path);
+
+	/* Remove a stale socket from a previous run (but nothing else) */
+	if (lstat(b1b_metrics_path, &st) == 0 && S_ISSOCK(st.st_mode)
+			&& unlink(b1b_metrics_path) < 0) {
+		B1B_FATAL("Failed to remove stale metrics socket: %s: %m",
+			  b1b_metrics_path);
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		B1B_FATAL("Failed to create metrics socket: %m");
+
+	if (bind(sock, (struct sockaddr *)&sun, sizeof sun) < 0)
+		B1B_FATAL("Failed to bind metrics socket: %s: %m",
+			  b1b_metrics_path);
+
+	return sock;
+}
+
+static int b1b_metrics_tcp(void)
+{
+	static const int one = 1;
+
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(b1b_metrics_port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+	};
+	int sock;
+
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		B1B_FATAL("Failed to create metrics socket: %m");
+
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0)
+		B1B_FATAL("Failed to set SO_REUSEADDR on metrics socket: %m");
+
+	if (bind(sock, (struct sockaddr *)&sin, sizeof sin) < 0) {
+		B1B_FATAL("Failed to bind metrics socket: 127.0.0.1:%u: %m",
+			  b1b_metrics_port);
+	}
+
+	return sock;
+}
+
+void b1b_metrics_open(struct b1b_global_session *const gs)
+{
+	struct b1b_metrics *m;
+	int sock;
+
+	if (b1b_metrics_path == NULL && b1b_metrics_port == 0)
+		return;
+
+	sock = b1b_metrics_path != NULL ? b1b_metrics_unix()
+					: b1b_metrics_tcp();
+
+	if (listen(sock, B1B_METRICS_MAX_CONNS) < 0)
+		B1B_FATAL("Failed to listen on metrics socket: %m");
+
+	m = B1B_ZALLOC(sizeof *m);
+	m->listen_ev.cb = b1b_metrics_accept_cb;
+	m->listen_ev.fd = sock;
+	gs->metrics = m;
+	b1b_ev_add(gs, &m->listen_ev, EPOLLIN);
+
+	if (b1b_metrics_path != NULL)
+		B1B_INFO("Serving metrics on %s", b1b_metrics_path);
+	else
+		B1B_INFO("Serving metrics on 127.0.0.1:%u", b1b_metrics_port);
+}
+
+void b1b_metrics_close(struct b1b_global_session *const gs)
+{
+	struct b1b_metrics *const m = gs->metrics;
+	unsigned int i;
+
+	if (m == NULL)
+		return;
+
+	for (i = 0; i < B1B_METRICS_MAX_CONNS; ++i) {
+		if (m->conns[i].ev.cb != NULL)
+			b1b_metrics_drop(m->conns + i);
+	}
+
+	if (close(m->listen_ev.fd) < 0)
+		B1B_ERR("Failed to close metrics socket: %m");
+
+	if (b1b_metrics_path != NULL && unlink(b1b_metrics_path) < 0)
+		B1B_ERR("Failed to remove metrics socket: %s: %m",
+			b1b_metrics_path);
+
+	free(m);
+	gs->metrics = NULL;
+}
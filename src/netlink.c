@@ -16,7 +16,10 @@
 #include <string.h>
 
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
 
+#include <linux/genetlink.h>
 #include <linux/rtnetlink.h>
 
 #include <libmnl/libmnl.h>
@@ -28,12 +31,13 @@
  *
  */
 
-static struct mnl_socket * b1b_nl_open(int optname, unsigned int optval)
+static struct mnl_socket * b1b_nl_open(int bus, int optname,
+				       unsigned int optval)
 {
 	struct mnl_socket *nlsock;
 	int result;
 
-	if ((nlsock = mnl_socket_open(NETLINK_ROUTE)) == NULL)
+	if ((nlsock = mnl_socket_open(bus)) == NULL)
 		B1B_FATAL("Failed to create netlink socket: %m");
 
 	if (mnl_socket_bind(nlsock, 0, MNL_SOCKET_AUTOPID) != 0)
@@ -48,14 +52,37 @@ static struct mnl_socket * b1b_nl_open(int optname, unsigned int optval)
 
 void b1b_nlsock_open(struct b1b_global_session *const gs)
 {
-	gs->nlsock = b1b_nl_open(NETLINK_GET_STRICT_CHK, 1);
+	gs->nlsock = b1b_nl_open(NETLINK_ROUTE, NETLINK_GET_STRICT_CHK, 1);
+}
+
+/* Generic netlink socket is only opened if needed */
+void b1b_gensock_open(struct b1b_global_session *const gs)
+{
+	gs->gensock = b1b_nl_open(NETLINK_GENERIC, NETLINK_CAP_ACK, 1);
+}
+
+static void b1b_mcsock_cb(struct b1b_global_session *const gs,
+			  struct b1b_event_src *const src
+						__attribute__((unused)),
+			  const uint32_t events)
+{
+	if (events & ~EPOLLIN) {
+		B1B_FATAL("Unexpected event type(s) on netlink socket: "
+				"%04" PRIx32,
+			  events);
+	}
+
+	b1b_mcast_process(gs);
 }
 
 void b1b_mcsock_open(struct b1b_global_session *const gs)
 {
+	static const int one = 1;
+
 	int fd, flags;
 
-	gs->mcsock = b1b_nl_open(NETLINK_ADD_MEMBERSHIP, RTNLGRP_LINK);
+	gs->mcsock = b1b_nl_open(NETLINK_ROUTE, NETLINK_ADD_MEMBERSHIP,
+				 RTNLGRP_LINK);
 
 	fd = mnl_socket_get_fd(gs->mcsock);
 
@@ -63,6 +90,14 @@ void b1b_mcsock_open(struct b1b_global_session *const gs)
 
 	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
 		B1B_FATAL("Failed to make netlink socket non-blocking: %m");
+
+	/* Kernel receive timestamps for failover latency statistics */
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof one) < 0)
+		B1B_WARN("Failed to enable netlink socket timestamps: %m");
+
+	gs->mc_ev.cb = b1b_mcsock_cb;
+	gs->mc_ev.fd = fd;
+	b1b_ev_add(gs, &gs->mc_ev, EPOLLIN);
 }
 
 
@@ -95,38 +130,64 @@ static int b1b_nlmsg_req_cb_wrapper(const struct nlmsghdr *const nlmsg,
 		return MNL_CB_STOP;
 }
 
-int b1b_nlmsg_req(struct b1b_global_session *const gs, const mnl_cb_t msg_cb,
-		  void *const data)
+/*
+ * When replaying a trace, the request isn't sent, and the replies (which have
+ * the recording's sequence and port numbers) are read from the trace.
+ */
+static int b1b_nl_req(struct b1b_global_session *const gs,
+		      struct mnl_socket *const sock,
+		      const enum b1b_trace_src src, const mnl_cb_t msg_cb,
+		      void *const data)
 {
 	static unsigned int seq;
 
 	int result;
 	ssize_t bytes;
+	unsigned int portid;
 	struct b1b_cb_wrapper_data wd;
 
 	gs->nlmsg.nlmsg_flags |= NLM_F_REQUEST;
 	gs->nlmsg.nlmsg_seq = ++seq;
 
-	result = mnl_socket_sendto(gs->nlsock, gs->buf, gs->nlmsg.nlmsg_len);
-	if (result < 0) {
-		B1B_ERR("Failed to send netlink message: %m");
-		return MNL_CB_ERROR;
+	if (b1b_replay_path == NULL) {
+		result = mnl_socket_sendto(sock, gs->buf, gs->nlmsg.nlmsg_len);
+		if (result < 0) {
+			B1B_ERR("Failed to send netlink message: %m");
+			return MNL_CB_ERROR;
+		}
+		portid = mnl_socket_get_portid(sock);
+	}
+	else {
+		portid = 0;  /* don't check */
 	}
 
 	do {
-		bytes = mnl_socket_recvfrom(gs->nlsock, gs->buf, gs->bufsize);
+		if (b1b_replay_path == NULL)
+			bytes = mnl_socket_recvfrom(sock, gs->buf, gs->bufsize);
+		else
+			bytes = b1b_trace_read(gs, src, 1);
+
 		if (bytes < 0) {
-			B1B_ERR("Failed to receive netlink message: %m");
+			if (b1b_replay_path != NULL) {
+				B1B_ERR("Trace has no reply to netlink "
+						"request");
+			}
+			else {
+				B1B_ERR("Failed to receive netlink message: "
+						"%m");
+			}
 			return MNL_CB_ERROR;
 		}
 
+		b1b_trace_record(src, 0, NULL, gs->buf, bytes);
+		gs->rxbytes += bytes;
+
 		wd.msg_cb = msg_cb;
 		wd.data = data;
 
 		errno = 0;
-		result = mnl_cb_run(gs->buf, bytes, seq,
-				    mnl_socket_get_portid(gs->nlsock),
-				    b1b_nlmsg_req_cb_wrapper, &wd);
+		result = mnl_cb_run(gs->buf, bytes, portid != 0 ? seq : 0,
+				    portid, b1b_nlmsg_req_cb_wrapper, &wd);
 
 	} while (result >= MNL_CB_OK);
 
@@ -140,6 +201,81 @@ int b1b_nlmsg_req(struct b1b_global_session *const gs, const mnl_cb_t msg_cb,
 	return result;
 }
 
+/* Send a request on the (NETLINK_ROUTE) request socket */
+int b1b_nlmsg_req(struct b1b_global_session *const gs, const mnl_cb_t msg_cb,
+		  void *const data)
+{
+	return b1b_nl_req(gs, gs->nlsock, B1B_TRACE_ROUTE, msg_cb, data);
+}
+
+/* Send a request on the generic netlink socket */
+int b1b_genmsg_req(struct b1b_global_session *const gs, const mnl_cb_t msg_cb,
+		   void *const data)
+{
+	return b1b_nl_req(gs, gs->gensock, B1B_TRACE_GENL, msg_cb, data);
+}
+
+
+/*
+ *
+ *	Look up a generic netlink family
+ *
+ */
+
+static int b1b_genl_family_attr_cb(const struct nlattr *const attr,
+				   void *const data)
+{
+	uint16_t *const family = data;
+
+	if (mnl_attr_get_type(attr) != CTRL_ATTR_FAMILY_ID)
+		return MNL_CB_OK;
+
+	if (mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
+		return MNL_CB_ERROR;
+
+	*family = mnl_attr_get_u16(attr);
+
+	return MNL_CB_STOP;
+}
+
+static int b1b_genl_family_msg_cb(const struct nlmsghdr *const nlmsg,
+				  void *const data)
+{
+	if (nlmsg->nlmsg_type != GENL_ID_CTRL)
+		return MNL_CB_OK;
+
+	B1B_ASSERT(nlmsg->nlmsg_len >= MNL_NLMSG_HDRLEN
+						+ sizeof(struct genlmsghdr));
+
+	return mnl_attr_parse(nlmsg, sizeof(struct genlmsghdr),
+			      b1b_genl_family_attr_cb, data);
+}
+
+/*
+ * Returns the ID of a generic netlink family, or 0 if the family doesn't exist
+ * (e.g. because its kernel module isn't loaded).
+ */
+uint16_t b1b_genl_family(struct b1b_global_session *const gs,
+			 const char *const name)
+{
+	struct genlmsghdr *genl;
+	uint16_t family;
+
+	mnl_nlmsg_put_header(gs->buf);
+	gs->nlmsg.nlmsg_type = GENL_ID_CTRL;
+	genl = mnl_nlmsg_put_extra_header(&gs->nlmsg, sizeof *genl);
+	genl->cmd = CTRL_CMD_GETFAMILY;
+	genl->version = 1;
+	mnl_attr_put_strz(&gs->nlmsg, CTRL_ATTR_FAMILY_NAME, name);
+
+	family = 0;
+
+	if (b1b_genmsg_req(gs, b1b_genl_family_msg_cb, &family) < 0)
+		return 0;
+
+	return family;
+}
+
 
 /*
  *
@@ -185,6 +321,36 @@ int b1b_bs_ifindex_cmp(const void *const e1, const void *const e2)
 	return 0;
 }
 
+/*
+ * Callback for parsing (doubly) nested attributes in IFLA_INFO_DATA (only
+ * needed if b1b_slave_xmit is set)
+ */
+static int b1b_mc_bond_cb(const struct nlattr *const attr, void *const data)
+{
+	struct b1b_bond_session *const bs = data;
+
+	if (attr->nla_type == IFLA_BOND_ACTIVE_SLAVE) {
+		bs->active_slave = mnl_attr_get_u32(attr);
+		return MNL_CB_STOP;
+	}
+
+	return MNL_CB_OK;
+}
+
+static int b1b_mc_linkinfo_cb(const struct nlattr *const attr,
+			      void *const data)
+{
+	struct b1b_bond_session *const bs = data;
+
+	if (attr->nla_type == IFLA_INFO_DATA) {
+		/* Attribute is absent if the bond has no active slave */
+		bs->active_slave = 0;
+		return mnl_attr_parse_nested(attr, b1b_mc_bond_cb, bs);
+	}
+
+	return MNL_CB_OK;
+}
+
 static int b1b_mc_attr_cb(const struct nlattr *const attr, void *const data)
 {
 	struct b1b_bond_session *const bs = data;
@@ -198,10 +364,17 @@ static int b1b_mc_attr_cb(const struct nlattr *const attr, void *const data)
 					  bs->ifname);
 			}
 			else {
+				B1B_PROBE(failover, bs->ifname, bs->ifindex);
 				bs->failover_event = 1;
 			}
 		}
 
+		/* IFLA_LINKINFO follows IFLA_EVENT, if we need it */
+		return b1b_slave_xmit ? MNL_CB_OK : MNL_CB_STOP;
+	}
+
+	if (attr->nla_type == IFLA_LINKINFO && b1b_slave_xmit) {
+		mnl_attr_parse_nested(attr, b1b_mc_linkinfo_cb, bs);
 		return MNL_CB_STOP;
 	}
 
@@ -214,6 +387,7 @@ static int b1b_mc_msg_cb(const struct nlmsghdr *const nlmsg,
 	struct b1b_global_session *const gs = data;
 	const struct ifinfomsg *ifi;
 	struct b1b_bond_session key, *bs;
+	_Bool failover;
 	int result;
 
 	if (nlmsg->nlmsg_type != RTM_NEWLINK)
@@ -228,36 +402,136 @@ static int b1b_mc_msg_cb(const struct nlmsghdr *const nlmsg,
 	if (bs == NULL)
 		return MNL_CB_OK;
 
+	/*
+	 * Bridge port change (possibly VLAN configuration); see bridge.c.  Open
+	 * vSwitch keeps a port's VLAN configuration (tag & vlan_mode) in its
+	 * database, which b1b doesn't read, so OVS bonds never have a PVID, and
+	 * their frames for non-zero VLANs are always tagged.
+	 */
+	if (ifi->ifi_family == AF_BRIDGE) {
+		if (bs->brtype != B1B_BR_TYPE_LINUX)
+			return MNL_CB_OK;
+		return b1b_br_port_pvid(bs, nlmsg);
+	}
+
+	failover = bs->failover_event;
+
 	result = mnl_attr_parse(nlmsg, MNL_ALIGN(sizeof *ifi),
 				b1b_mc_attr_cb, bs);
 	if (result <= MNL_CB_ERROR)
 		return MNL_CB_ERROR;
 
+	if (bs->failover_event && !failover)
+		bs->event_time = gs->mc_time;
+
 	return MNL_CB_OK;
 }
 
+/*
+ * Receive multicast message(s), and note when they were received by the
+ * kernel (gs->mc_time, converted to CLOCK_MONOTONIC), or by us if the kernel
+ * timestamp isn't available.  (first is set for the first call from each
+ * b1b_mcast_process(), to mark batches in traces.)
+ */
+static ssize_t b1b_mcast_recv(struct b1b_global_session *const gs,
+			      const _Bool first)
+{
+	union {
+		struct cmsghdr cmsg;
+		uint8_t buf[CMSG_SPACE(sizeof(struct timespec))];
+	} ctl;
+	struct iovec iov = { .iov_base = gs->buf, .iov_len = gs->bufsize };
+	struct sockaddr_nl addr;
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof addr,
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = &ctl,
+		.msg_controllen = sizeof ctl
+	};
+	struct timespec kernel, now;
+	struct cmsghdr *cmsg;
+	int64_t age, mono;
+	ssize_t bytes;
+
+	/* Replayed messages are timed from when they are read */
+	if (b1b_replay_path != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &gs->mc_time);
+		return b1b_trace_read(gs, B1B_TRACE_MCAST, first);
+	}
+
+	if ((bytes = recvmsg(gs->mc_ev.fd, &msg, 0)) < 0) {
+		if (errno == ENOBUFS) {
+			b1b_trace_record(B1B_TRACE_MCAST, first, NULL, NULL,
+					 -1);
+		}
+		return -1;
+	}
+
+	/* As mnl_socket_recvfrom() */
+	if (msg.msg_flags & MSG_TRUNC) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &gs->mc_time);
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+					cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+		if (cmsg->cmsg_level != SOL_SOCKET
+				|| cmsg->cmsg_type != SCM_TIMESTAMPNS) {
+			continue;
+		}
+
+		/* Kernel timestamp is CLOCK_REALTIME */
+		memcpy(&kernel, CMSG_DATA(cmsg), sizeof kernel);
+		clock_gettime(CLOCK_REALTIME, &now);
+		age = b1b_ns_between(&kernel, &now);
+
+		if (age > 0) {
+			mono = gs->mc_time.tv_sec * INT64_C(1000000000)
+					+ gs->mc_time.tv_nsec - age;
+			gs->mc_time.tv_sec = mono / 1000000000;
+			gs->mc_time.tv_nsec = mono % 1000000000;
+		}
+	}
+
+	b1b_trace_record(B1B_TRACE_MCAST, first, &gs->mc_time, gs->buf, bytes);
+
+	return bytes;
+}
+
 void b1b_mcast_process(struct b1b_global_session *const gs)
 {
 	ssize_t bytes;
 	unsigned int i;
 	int result;
-	_Bool parse_error;
+	_Bool parse_error, overflow, first;
 
 	for (i = 0; i < gs->bcount; ++i)
 		gs->bonds[i].failover_event = 0;
 
 	i = mnl_socket_get_portid(gs->mcsock);
-	parse_error = 0;
+	parse_error = overflow = 0;
 
-	while (1) {
+	for (first = 1; ; first = 0) {
 
-		bytes = mnl_socket_recvfrom(gs->mcsock, gs->buf, gs->bufsize);
+		bytes = b1b_mcast_recv(gs, first);
 		if (bytes < 0) {
 			if (errno == EAGAIN)
 				break;
+			if (errno == ENOBUFS) {
+				++gs->nl_overflows;
+				overflow = 1;
+				continue;
+			}
 			B1B_FATAL("Failed to receive netlink message: %m");
 		}
 
+		B1B_PROBE(nl__batch, bytes);
+
 		errno = 0;
 		result = mnl_cb_run(gs->buf, bytes, 0, i, b1b_mc_msg_cb, gs);
 		if (result <= MNL_CB_ERROR && !parse_error) {
@@ -269,6 +543,14 @@ void b1b_mcast_process(struct b1b_global_session *const gs)
 		}
 	}
 
+	if (overflow) {
+		B1B_WARN("Netlink multicast socket overrun; "
+				"notifications lost");
+	}
+
+	/* Overlap ovs-vswitchd's work if several OVS bonds failed over */
+	b1b_ovs_pipeline_fdb(gs);
+
 	for (i = 0; i < gs->bcount; ++i) {
 		if (gs->bonds[i].failover_event)
 			b1b_send_garps(gs, gs->bonds + i);
@@ -0,0 +1,475 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	openflow.c - OpenFlow 1.0 packet-out via an OVS bridge management socket
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "b1b.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+/*
+ * ovs-vswitchd listens for OpenFlow connections on a UNIX socket for each
+ * bridge (<rundir>/<bridge>.mgmt).  Frames are sent as packet-out messages
+ * with a single output action, so they are transmitted on the bond's OVS port
+ * exactly as built.  Many packet-out messages are queued in a buffer and sent
+ * with a single send() call, and a barrier request at the end of each burst
+ * collects any errors.
+ */
+
+#define B1B_OFP10_VERSION	0x01
+
+#define B1B_OFPT_HELLO		0
+#define B1B_OFPT_ERROR		1
+#define B1B_OFPT_ECHO_REQUEST	2
+#define B1B_OFPT_ECHO_REPLY	3
+#define B1B_OFPT_PACKET_OUT	13
+#define B1B_OFPT_BARRIER_REQUEST	18
+#define B1B_OFPT_BARRIER_REPLY	19
+
+#define B1B_OFPAT_OUTPUT	0
+
+#define B1B_OFPP_MAX		0xff00  /* highest "physical" port number */
+#define B1B_OFPP_CONTROLLER	0xfffd
+
+#define B1B_OFP_NO_BUFFER	0xffffffff
+
+/* Size of the packet-out batch buffer */
+#define B1B_OF_BATCH_SIZE	65536
+
+/* Maximum time to wait for ovs-vswitchd to read a batch or reply */
+#define B1B_OF_TIMEOUT_SEC	1
+
+struct b1b_ofp_header {
+	uint8_t version;
+	uint8_t type;
+	uint16_t length;
+	uint32_t xid;
+};
+_Static_assert(sizeof(struct b1b_ofp_header) == 8,
+	       "struct b1b_ofp_header size");
+
+struct b1b_ofp_action_output {
+	uint16_t type;  /* B1B_OFPAT_OUTPUT */
+	uint16_t len;  /* 8 */
+	uint16_t port;
+	uint16_t max_len;  /* only used when sending to controller */
+};
+_Static_assert(sizeof(struct b1b_ofp_action_output) == 8,
+	       "struct b1b_ofp_action_output size");
+
+struct b1b_ofp_packet_out {
+	struct b1b_ofp_header header;
+	uint32_t buffer_id;  /* B1B_OFP_NO_BUFFER - frame follows actions */
+	uint16_t in_port;
+	uint16_t actions_len;
+	struct b1b_ofp_action_output action;
+	/* frame follows */
+};
+_Static_assert(sizeof(struct b1b_ofp_packet_out) == 24,
+	       "struct b1b_ofp_packet_out size");
+
+struct b1b_ofp_error {
+	struct b1b_ofp_header header;
+	uint16_t type;
+	uint16_t code;
+};
+
+struct b1b_ofconn {
+	char *path;
+	uint32_t xid;
+	size_t len;  /* bytes queued in batch */
+	unsigned int errors;  /* error messages received */
+	unsigned int rejsize;  /* size of rejected */
+	uint32_t *rejected;  /* transaction IDs of failed messages */
+	int sock;
+	union {
+		struct b1b_ofp_header header;  /* received messages */
+		uint8_t rxbuf[UINT16_MAX + 1];
+	};
+	uint8_t batch[B1B_OF_BATCH_SIZE];
+};
+
+
+/*
+ *
+ *	Send & receive messages
+ *
+ */
+
+static int b1b_of_send(struct b1b_ofconn *const conn, const void *const buf,
+		       size_t len)
+{
+	const uint8_t *p;
+	ssize_t sent;
+
+	/* MSG_NOSIGNAL - get EPIPE, rather than SIGPIPE, if OVS has exited */
+	for (p = buf; len != 0; p += sent, len -= sent) {
+
+		sent = send(conn->sock, p, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				sent = 0;
+				continue;
+			}
+			B1B_ERR("Failed to send OpenFlow message(s): %s: %m",
+				conn->path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int b1b_of_read(struct b1b_ofconn *const conn, uint8_t *p, size_t len)
+{
+	ssize_t bytes;
+
+	while (len != 0) {
+
+		bytes = read(conn->sock, p, len);
+
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			B1B_ERR("Failed to receive OpenFlow message: %s: %m",
+				conn->path);
+			return -1;
+		}
+
+		if (bytes == 0) {
+			B1B_ERR("OpenFlow connection closed: %s", conn->path);
+			return -1;
+		}
+
+		p += bytes;
+		len -= bytes;
+	}
+
+	return 0;
+}
+
+/* Receive one message into conn->rxbuf; returns its type, or -1 on failure */
+static int b1b_of_recv(struct b1b_ofconn *const conn)
+{
+	size_t len;
+
+	if (b1b_of_read(conn, conn->rxbuf, sizeof conn->header) < 0)
+		return -1;
+
+	len = ntohs(conn->header.length);
+
+	if (len < sizeof conn->header) {
+		B1B_ERR("Invalid OpenFlow message length: %s: %zu",
+			conn->path, len);
+		return -1;
+	}
+
+	len -= sizeof conn->header;
+
+	if (b1b_of_read(conn, conn->rxbuf + sizeof conn->header, len) < 0)
+		return -1;
+
+	return conn->header.type;
+}
+
+static uint32_t b1b_of_xid(struct b1b_ofconn *const conn)
+{
+	return htonl(++conn->xid);
+}
+
+static int b1b_of_simple_msg(struct b1b_ofconn *const conn,
+			     const uint8_t type, const uint32_t xid)
+{
+	struct b1b_ofp_header msg = {
+		.version = B1B_OFP10_VERSION,
+		.type = type,
+		.length = htons(sizeof msg),
+		.xid = xid
+	};
+
+	return b1b_of_send(conn, &msg, sizeof msg);
+}
+
+/* Log (the first) error of a burst and remember which message failed */
+static void b1b_of_log_error(struct b1b_ofconn *const conn)
+{
+	const struct b1b_ofp_error *const err = (void *)conn->rxbuf;
+	size_t size;
+
+	if (conn->errors == conn->rejsize) {
+		conn->rejsize = conn->rejsize == 0 ? 64 : conn->rejsize * 2;
+		size = conn->rejsize * sizeof *conn->rejected;
+		if ((conn->rejected = realloc(conn->rejected, size)) == NULL)
+			B1B_FATAL("Cannot allocate %zu bytes: %m", size);
+	}
+
+	/* The error's transaction ID is that of the failed message */
+	conn->rejected[conn->errors] = ntohl(err->header.xid);
+
+	/* Only log the first error of each burst; one bad frame means many */
+	if (conn->errors++ != 0)
+		return;
+
+	if (ntohs(err->header.length) < sizeof *err) {
+		B1B_ERR("OpenFlow error: %s", conn->path);
+		return;
+	}
+
+	B1B_ERR("OpenFlow error: %s: type %" PRIu16 ", code %" PRIu16,
+		conn->path, ntohs(err->type), ntohs(err->code));
+}
+
+/*
+ * Receive messages until one of the given type (and transaction ID) arrives,
+ * replying to echo requests and counting errors along the way.  Returns -1 if
+ * the connection fails.
+ */
+static int b1b_of_wait(struct b1b_ofconn *const conn, const int type,
+		       const uint32_t xid)
+{
+	int result;
+
+	while (1) {
+
+		if ((result = b1b_of_recv(conn)) < 0)
+			return -1;
+
+		if (result == type && conn->header.xid == xid)
+			return 0;
+
+		if (result == B1B_OFPT_ERROR) {
+			b1b_of_log_error(conn);
+		}
+		else if (result == B1B_OFPT_ECHO_REQUEST) {
+			if (b1b_of_simple_msg(conn, B1B_OFPT_ECHO_REPLY,
+					      conn->header.xid) < 0) {
+				return -1;
+			}
+		}
+	}
+}
+
+
+/*
+ *
+ *	Connect & disconnect
+ *
+ */
+
+void b1b_of_close(struct b1b_ofconn **const conn)
+{
+	if (*conn == NULL)
+		return;
+
+	if (close((*conn)->sock) < 0)
+		B1B_ERR("Failed to close OpenFlow socket: %m");
+
+	free((*conn)->path);
+	free((*conn)->rejected);
+	free(*conn);
+	*conn = NULL;
+}
+
+/*
+ * Connect to the management socket of an OVS bridge and negotiate OpenFlow
+ * 1.0.  Returns NULL (after logging the reason) on failure.
+ */
+struct b1b_ofconn *b1b_of_connect(const char *const brname)
+{
+	static const struct timeval timeout = { B1B_OF_TIMEOUT_SEC, 0 };
+
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct b1b_ofconn *conn;
+	uint32_t xid;
+	int result;
+
+	conn = B1B_ZALLOC(sizeof *conn);
+	B1B_ASPRINTF(&conn->path, "%s/%s.mgmt", b1b_ovs_rundir, brname);
+
+	if (strlen(conn->path) >= sizeof sun.sun_path) {
+		B1B_ERR("OpenFlow socket path too long: %s", conn->path);
+		free(conn->path);
+		free(conn);
+		return NULL;
+	}
+
+	strcpy(sun.sun_path, conn->path);
+
+	conn->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (conn->sock < 0)
+		B1B_FATAL("Failed to create UNIX socket: %s: %m", conn->path);
+
+	/* Don't let a stuck ovs-vswitchd block the main loop indefinitely */
+	if (setsockopt(conn->sock, SOL_SOCKET, SO_SNDTIMEO,
+		       &timeout, sizeof timeout) < 0
+			|| setsockopt(conn->sock, SOL_SOCKET, SO_RCVTIMEO,
+				      &timeout, sizeof timeout) < 0) {
+		B1B_FATAL("Failed to set OpenFlow socket timeouts: %m");
+	}
+
+	result = connect(conn->sock, (struct sockaddr *)&sun, sizeof sun);
+	if (result < 0) {
+		B1B_ERR("Failed to connect UNIX socket: %s: %m", conn->path);
+		goto error;
+	}
+
+	xid = b1b_of_xid(conn);
+
+	if (b1b_of_simple_msg(conn, B1B_OFPT_HELLO, xid) < 0)
+		goto error;
+
+	if ((result = b1b_of_recv(conn)) < 0)
+		goto error;
+
+	if (result != B1B_OFPT_HELLO) {
+		B1B_ERR("Unexpected OpenFlow message type: %s: %d",
+			conn->path, result);
+		goto error;
+	}
+
+	/* Any higher version in the peer's hello means it will use ours */
+	if (conn->header.version < B1B_OFP10_VERSION) {
+		B1B_ERR("OpenFlow version not supported: %s: %" PRIu8,
+			conn->path, conn->header.version);
+		goto error;
+	}
+
+	/* An error here means that the bridge doesn't allow OpenFlow 1.0 */
+	xid = b1b_of_xid(conn);
+
+	if (b1b_of_simple_msg(conn, B1B_OFPT_BARRIER_REQUEST, xid) < 0
+			|| b1b_of_wait(conn, B1B_OFPT_BARRIER_REPLY, xid) < 0) {
+		goto error;
+	}
+
+	if (conn->errors != 0) {
+		B1B_ERR("OpenFlow 1.0 not enabled on bridge: %s", brname);
+		goto error;
+	}
+
+	B1B_DEBUG("Connected to %s", conn->path);
+
+	return conn;
+
+error:
+	b1b_of_close(&conn);
+	return NULL;
+}
+
+
+/*
+ *
+ *	Packet-out batches
+ *
+ */
+
+/*
+ * Queue a packet-out message that sends a frame to an OVS port.  Returns false
+ * if the batch is full, in which case the caller must flush the batch and try
+ * again.
+ */
+_Bool b1b_of_queue(struct b1b_ofconn *const conn, const uint16_t port,
+		   const void *const frame, const size_t len)
+{
+	struct b1b_ofp_packet_out po;
+	size_t msglen;
+
+	msglen = sizeof po + len;
+
+	if (sizeof conn->batch - conn->len < msglen)
+		return 0;
+
+	po.header.version = B1B_OFP10_VERSION;
+	po.header.type = B1B_OFPT_PACKET_OUT;
+	po.header.length = htons(msglen);
+	po.header.xid = b1b_of_xid(conn);
+	po.buffer_id = htonl(B1B_OFP_NO_BUFFER);
+	po.in_port = htons(B1B_OFPP_CONTROLLER);
+	po.actions_len = htons(sizeof po.action);
+	po.action.type = htons(B1B_OFPAT_OUTPUT);
+	po.action.len = htons(sizeof po.action);
+	po.action.port = htons(port);
+	po.action.max_len = 0;
+
+	/* Messages in the batch aren't necessarily aligned */
+	memcpy(conn->batch + conn->len, &po, sizeof po);
+	memcpy(conn->batch + conn->len + sizeof po, frame, len);
+
+	conn->len += msglen;
+
+	return 1;
+}
+
+/* Send all queued messages; returns -1 if the connection has failed */
+int b1b_of_flush(struct b1b_ofconn *const conn)
+{
+	int result;
+
+	if (conn->len == 0)
+		return 0;
+
+	result = b1b_of_send(conn, conn->batch, conn->len);
+	conn->len = 0;
+
+	return result;
+}
+
+/*
+ * Send a barrier request and wait for its reply, so that any errors caused by
+ * previously sent messages have been received.  Returns the number of errors,
+ * or -1 if the connection has failed.
+ */
+int b1b_of_barrier(struct b1b_ofconn *const conn)
+{
+	uint32_t xid;
+	int result;
+
+	conn->errors = 0;
+	xid = b1b_of_xid(conn);
+
+	result = b1b_of_simple_msg(conn, B1B_OFPT_BARRIER_REQUEST, xid);
+	if (result < 0 || b1b_of_wait(conn, B1B_OFPT_BARRIER_REPLY, xid) < 0)
+		return -1;
+
+	return conn->errors;
+}
+
+/*
+ * Transaction IDs of the messages rejected before the last barrier (as many as
+ * b1b_of_barrier() returned), in host byte order.  Each packet-out message
+ * uses the next ID; see b1b_of_next_xid().
+ */
+const uint32_t *b1b_of_rejected(const struct b1b_ofconn *const conn)
+{
+	return conn->rejected;
+}
+
+/* Transaction ID (in host byte order) of the next message to be queued */
+uint32_t b1b_of_next_xid(const struct b1b_ofconn *const conn)
+{
+	return conn->xid + 1;
+}
+
+/* Is a port number usable in an OpenFlow 1.0 output action? */
+_Bool b1b_of_port_ok(const uint32_t ofport)
+{
+	return ofport != 0 && ofport < B1B_OFPP_MAX;
+}
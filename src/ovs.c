@@ -9,23 +9,42 @@
  */
 
 
+#define _GNU_SOURCE  /* for asprintf() */
+
 #include "b1b.h"
 
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/un.h>
 
+#include <linux/if_ether.h>
 #include <linux/rtnetlink.h>
 
 #include <json-c/json_object.h>
 #include <json-c/json_tokener.h>
-#include <json-c/json_util.h>
 
 
-static const char b1b_ovs_pid_file[] = "/run/openvswitch/ovs-vswitchd.pid";
+static const char b1b_ovs_pid_name[] = "ovs-vswitchd.pid";
+
+/* Connection attempts at startup, or in the background after a failure */
+#define B1B_OVS_CONNECT_TRIES	5
+
+/* Delay after first failed connection attempt; doubled after each attempt */
+#define B1B_OVS_BACKOFF_NS	50000000
+
+/* Maximum time that a blocking send or receive waits for ovs-vswitchd */
+#define B1B_OVS_TIMEOUT_SEC	2
 
 
 /*
@@ -37,6 +56,7 @@ static const char b1b_ovs_pid_file[] = "/run/openvswitch/ovs-vswitchd.pid";
 static pid_t b1b_ovs_pid(void)
 {
 	struct flock lck = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+	char pid_file[PATH_MAX];
 	int pidfd;
 
 	/*
@@ -44,31 +64,73 @@ static pid_t b1b_ovs_pid(void)
 	 * of the lock, rather than parsing the file contents.
 	 */
 
-	if ((pidfd = open(b1b_ovs_pid_file, O_RDONLY)) < 0)
-		B1B_FATAL("Failed to open PID file: %s: %m", b1b_ovs_pid_file);
+	if ((size_t)snprintf(pid_file, sizeof pid_file, "%s/%s",
+			     b1b_ovs_rundir, b1b_ovs_pid_name)
+						>= sizeof pid_file) {
+		B1B_FATAL("PID file path too long: %s", b1b_ovs_rundir);
+	}
 
-	if (fcntl(pidfd, F_GETLK, &lck) < 0) {
-		B1B_FATAL("Failed to query PID file lock: %s: %m",
-				b1b_ovs_pid_file);
+	if ((pidfd = open(pid_file, O_RDONLY | O_CLOEXEC)) < 0) {
+		B1B_ERR("Failed to open PID file: %s: %m", pid_file);
+		return -1;
 	}
 
-	if (lck.l_type == F_UNLCK)
-		B1B_FATAL("PID file not locked: %s: %m",b1b_ovs_pid_file);
+	if (fcntl(pidfd, F_GETLK, &lck) < 0) {
+		B1B_ERR("Failed to query PID file lock: %s: %m", pid_file);
+		lck.l_pid = -1;
+	}
+	else if (lck.l_type == F_UNLCK) {
+		B1B_ERR("PID file not locked: %s", pid_file);
+		lck.l_pid = -1;
+	}
 
 	if (close(pidfd) < 0)
-		B1B_FATAL("Failed to close PID file: %s:%m", b1b_ovs_pid_file);
+		B1B_FATAL("Failed to close PID file: %s:%m", pid_file);
 
 	return lck.l_pid;
 }
 
-static void b1b_ovs_open(struct b1b_global_session *const gs)
+static void b1b_ovs_sock_cb(struct b1b_global_session *gs,
+			    struct b1b_event_src *src, uint32_t events);
+
+static void b1b_ovs_disconnect(struct b1b_global_session *const gs)
+{
+	unsigned int i;
+
+	/* Closing the socket also removes it from the epoll set */
+	if (gs->ovssock >= 0 && close(gs->ovssock) < 0)
+		B1B_ERR("Failed to close UNIX socket: %m");
+
+	gs->ovssock = -1;
+	free(gs->ovssock_path);
+	gs->ovssock_path = NULL;
+
+	/* Discard any partial response */
+	gs->ovsrlen = 0;
+	gs->ovsrnext = 0;
+	memset(&gs->ovsframe, 0, sizeof gs->ovsframe);
+
+	/* Responses to background requests will never arrive */
+	for (i = 0; i < gs->bcount; ++i)
+		gs->bonds[i].prefetch_req = 0;
+	gs->prefetches = 0;
+	gs->portmap_req = 0;
+}
+
+static int b1b_ovs_connect(struct b1b_global_session *const gs)
 {
+	static const struct timeval timeout = { B1B_OVS_TIMEOUT_SEC, 0 };
+
 	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	pid_t pid;
 	int result;
 
+	if ((pid = b1b_ovs_pid()) < 0)
+		return -1;
+
 	result = asprintf(&gs->ovssock_path,
-			  "/run/openvswitch/ovs-vswitchd.%" PRIdMAX ".ctl",
-			  (intmax_t)b1b_ovs_pid());
+			  "%s/ovs-vswitchd.%" PRIdMAX ".ctl",
+			  b1b_ovs_rundir, (intmax_t)pid);
 	if (result < 0)
 		B1B_FATAL("Failed to format UNIX socket path: %m");
 
@@ -77,367 +139,1766 @@ static void b1b_ovs_open(struct b1b_global_session *const gs)
 
 	memcpy(sun.sun_path, gs->ovssock_path, result + 1);
 
-	if ((gs->ovssock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	gs->ovssock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (gs->ovssock < 0)
 		B1B_FATAL("Failed to create UNIX socket: %s: %m", sun.sun_path);
 
+	/* Don't let a hung ovs-vswitchd block the main loop indefinitely */
+	if (setsockopt(gs->ovssock, SOL_SOCKET, SO_SNDTIMEO,
+		       &timeout, sizeof timeout) < 0
+			|| setsockopt(gs->ovssock, SOL_SOCKET, SO_RCVTIMEO,
+				      &timeout, sizeof timeout) < 0) {
+		B1B_FATAL("Failed to set UNIX socket timeouts: %m");
+	}
+
 	result = connect(gs->ovssock, (struct sockaddr *)&sun, sizeof sun);
 	if (result < 0) {
-		B1B_FATAL("Failed to connect UNIX socket: %s, %m",
-			  sun.sun_path);
+		B1B_ERR("Failed to connect UNIX socket: %s: %m", sun.sun_path);
+		b1b_ovs_disconnect(gs);
+		return -1;
+	}
+
+	/*
+	 * Port numbers and bridge names that were looked up from a different
+	 * ovs-vswitchd process may no longer be valid.
+	 */
+	if (pid != gs->ovspid) {
+		if (gs->ovspid != 0) {
+			B1B_NOTICE("ovs-vswitchd has restarted (PID %" PRIdMAX
+					"); OVS port info will be refreshed",
+				   (intmax_t)pid);
+		}
+		gs->ovspid = pid;
+		++gs->ovsgen;
+	}
+
+	/* Responses to background requests are read from the event loop */
+	gs->ovssock_ev.cb = b1b_ovs_sock_cb;
+	gs->ovssock_ev.fd = gs->ovssock;
+	b1b_ev_add(gs, &gs->ovssock_ev, EPOLLIN);
+
+	B1B_DEBUG("Connected to %s", gs->ovssock_path);
+
+	return 0;
+}
+
+/*
+ * Connect at startup, making up to B1B_OVS_CONNECT_TRIES attempts with
+ * exponential backoff.  The event loop isn't running yet, so waiting doesn't
+ * delay anything else.
+ */
+static int b1b_ovs_connect_wait(struct b1b_global_session *const gs)
+{
+	struct timespec delay;
+	uint64_t nsec;
+	unsigned int i;
+
+	for (i = 1, nsec = B1B_OVS_BACKOFF_NS; ; ++i, nsec *= 2) {
+
+		if (b1b_ovs_connect(gs) == 0)
+			return 0;
+
+		if (i >= B1B_OVS_CONNECT_TRIES)
+			break;
+
+		delay.tv_sec = nsec / 1000000000;
+		delay.tv_nsec = nsec % 1000000000;
+		nanosleep(&delay, NULL);
 	}
+
+	B1B_ERR("Failed to connect to ovs-vswitchd after %u attempts", i);
+
+	return -1;
 }
 
 
 /*
  *
- *	Send a JSON-RPC request to ovs-vswitchd
+ *	Reconnect in the background
  *
  */
 
-static void b1b_json_req_add(json_object *restrict const req,
-			     const char *restrict const name,
-			     json_object *restrict const member)
+/*
+ * After the daemon is running, a request that finds ovs-vswitchd unreachable
+ * makes only one connection attempt, so that it never delays a failover.
+ * Further attempts are made from the event loop (with the same backoff as at
+ * startup), so that the connection (and any port map refresh that it triggers)
+ * is likely to be ready before the next request.
+ */
+
+static void b1b_ovs_retry_arm(struct b1b_global_session *const gs,
+			      const uint64_t nsec)
 {
-	static const unsigned int opts =
-		JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_ADD_CONSTANT_KEY;
+	struct itimerspec its = { .it_interval = { 0, 0 } };
+
+	its.it_value.tv_sec = nsec / 1000000000;
+	its.it_value.tv_nsec = nsec % 1000000000;
 
-	if (json_object_object_add_ex(req, name, member, opts) < 0)
-		B1B_FATAL("Failed to add member to JSON request: %s", name);
+	if (timerfd_settime(gs->ovsretry_ev.fd, 0, &its, NULL) < 0)
+		B1B_FATAL("Failed to arm OVS reconnect timer: %m");
 }
 
-static uint64_t b1b_ovs_rpc_send(struct b1b_global_session *const gs,
-				 const char *restrict const method,
-				 const char *restrict const param)
+/* Start retrying, if not already doing so */
+static void b1b_ovs_retry_start(struct b1b_global_session *const gs)
 {
-	static uint64_t reqid;
+	if (gs->ovsretry_ev.cb == NULL || gs->ovsretries != 0)
+		return;
 
-	json_object *req, *member, *elem;
-	int result;
-
-	if ((req = json_object_new_object()) == NULL)
-		B1B_FATAL("Failed to create JSON-RPC request: %m");
+	gs->ovsretries = 1;
+	b1b_ovs_retry_arm(gs, B1B_OVS_BACKOFF_NS);
+}
 
-	if ((member = json_object_new_uint64(++reqid)) == NULL)
-		B1B_FATAL("Failed to create JSON-RPC request ID: %m");
+static void b1b_ovs_retry_cb(struct b1b_global_session *const gs,
+			     struct b1b_event_src *const src,
+			     const uint32_t events __attribute__((unused)))
+{
+	uint64_t expirations;
 
-	b1b_json_req_add(req, "id", member);
+	if (read(src->fd, &expirations, sizeof expirations) < 0) {
+		if (errno == EAGAIN)
+			return;
+		B1B_FATAL("Failed to read OVS reconnect timer: %m");
+	}
 
-	if ((member = json_object_new_string(method)) == NULL)
-		B1B_FATAL("Failed to create JSON-RPC method: %m");
+	/* A request may have connected in the meantime */
+	if (gs->ovssock >= 0 || b1b_ovs_connect(gs) == 0) {
+		gs->ovsretries = 0;
+		return;
+	}
 
-	b1b_json_req_add(req, "method", member);
+	/* Initial attempt (by the request) + background attempts */
+	if (++gs->ovsretries >= B1B_OVS_CONNECT_TRIES) {
+		B1B_ERR("Failed to connect to ovs-vswitchd after %u attempts",
+			gs->ovsretries);
+		gs->ovsretries = 0;
+		return;
+	}
 
-	if ((member = json_object_new_array_ext(param != NULL)) == NULL)
-		B1B_FATAL("Failed to create JSON-RPC parameter list: %m");
+	b1b_ovs_retry_arm(gs, (uint64_t)B1B_OVS_BACKOFF_NS
+						<< (gs->ovsretries - 1));
+}
 
-	if (param != NULL) {
+static void b1b_ovs_retry_init(struct b1b_global_session *const gs)
+{
+	int fd;
 
-		if ((elem = json_object_new_string(param)) == NULL)
-			B1B_FATAL("Failed to create JSON-RPC parameter: %m");
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		B1B_FATAL("Failed to create OVS reconnect timer: %m");
 
-		if (json_object_array_add(member, elem) < 0)
-			B1B_FATAL("Failed to add JSON-RPC parameter to list");
-	}
+	gs->ovsretry_ev.cb = b1b_ovs_retry_cb;
+	gs->ovsretry_ev.fd = fd;
+	b1b_ev_add(gs, &gs->ovsretry_ev, EPOLLIN);
+}
 
-	b1b_json_req_add(req, "params", member);
+/*
+ * Connect, if not already connected, making a single attempt (or none, if
+ * attempts are already being made in the background).  If it fails, further
+ * attempts are made in the background.
+ */
+static int b1b_ovs_open(struct b1b_global_session *const gs)
+{
+	if (gs->ovssock >= 0)
+		return 0;
 
-	if (gs->ovssock < 0)
-		b1b_ovs_open(gs);
+	if (gs->ovsretries != 0)
+		return -1;
 
-	result = json_object_to_fd(gs->ovssock, req,
-				   JSON_C_TO_STRING_NOSLASHESCAPE);
-	if (result < 0) {
-		B1B_FATAL("Failed to send JSON-RPC request: %s",
-			  json_util_get_last_err());
-	}
+	if (b1b_ovs_connect(gs) == 0)
+		return 0;
 
-	if (json_object_put(req) != 1)
-		B1B_FATAL("Failed to free JSON-RPC request");
+	b1b_ovs_retry_start(gs);
 
-	return reqid;
+	return -1;
 }
 
 
 /*
  *
- *	Receive a JSON-RPC response from ovs-vswitchd
+ *	Watch for ovs-vswitchd restarts
  *
  */
 
-static json_object *b1b_json_resp_get(const json_object *restrict const resp,
-				      const char *restrict const name,
-				      ...)
+static void b1b_ovs_watch_cb(struct b1b_global_session *const gs,
+			     struct b1b_event_src *const src,
+			     const uint32_t events __attribute__((unused)))
 {
-	json_object *member;
-	json_type type;
-	va_list ap;
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t bytes;
+	_Bool restart;
+	char *p;
 
-	if (!json_object_object_get_ex(resp, name, &member)) {
-		B1B_FATAL("JSON-RPC response does not contain member: %s",
-			  name);
-	}
+	restart = 0;
 
-	va_start(ap, name);
+	while ((bytes = read(src->fd, buf, sizeof buf)) > 0) {
 
-	while ((type = va_arg(ap, json_type)) >= 0) {
+		for (p = buf; p < buf + bytes; p += sizeof *ev + ev->len) {
 
-		if (json_object_is_type(member, type))
-			break;
+			ev = (const void *)p;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				restart = 1;
+			}
+			else if (ev->len != 0 && strcmp(ev->name,
+						      b1b_ovs_pid_name) == 0) {
+				restart = 1;
+			}
+		}
 	}
 
-	va_end(ap);
+	if (bytes < 0 && errno != EAGAIN)
+		B1B_FATAL("Failed to read inotify events: %m");
 
-	if (type < 0) {
-		B1B_FATAL("Incorrect type of JSON-RPC response member: %s: %s",
-			  name,
-			  json_type_to_name(json_object_get_type(member)));
+	/*
+	 * Drop the connection and reconnect to the new process, if any (in the
+	 * background, if it isn't ready yet).  The port info is refreshed by
+	 * the next request if the PID has changed.
+	 */
+	if (restart) {
+		if (gs->ovssock >= 0) {
+			B1B_INFO("ovs-vswitchd PID file changed; "
+					"reconnecting");
+			b1b_ovs_disconnect(gs);
+		}
+		b1b_ovs_open(gs);
 	}
-
-	return member;
 }
 
-static _Bool b1b_ovs_rpc_recv(struct b1b_global_session *const gs,
-			      const uint64_t reqid)
+static void b1b_ovs_watch(struct b1b_global_session *const gs)
 {
-	struct json_tokener *tok;
-	json_object *resp, *member;
-	ssize_t bytes;
-	enum json_type type;
-	_Bool result;
+	static const uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_DELETE;
 
-	if ((tok = json_tokener_new_ex(2)) == NULL)
-		B1B_FATAL("Failed to create JSON parser: %m");
+	int fd;
 
-	bytes = read(gs->ovssock, gs->buf, gs->bufsize);
-	if (bytes < 0) {
-		B1B_FATAL("Failed to receive JSON-RPC response: %s: %m",
-			  gs->ovssock_path);
+	if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		B1B_FATAL("Failed to create inotify instance: %m");
+
+	if (inotify_add_watch(fd, b1b_ovs_rundir, mask) < 0) {
+		B1B_WARN("Failed to watch %s: %m: "
+				"ovs-vswitchd restarts will only be detected "
+				"when requests fail",
+			 b1b_ovs_rundir);
+		if (close(fd) < 0)
+			B1B_ERR("Failed to close inotify instance: %m");
+		return;
 	}
 
-	if ((size_t)bytes == gs->bufsize)
-		B1B_FATAL("JSON-RPC response too large: %zd", bytes);
+	gs->ovswatch_ev.cb = b1b_ovs_watch_cb;
+	gs->ovswatch_ev.fd = fd;
+	b1b_ev_add(gs, &gs->ovswatch_ev, EPOLLIN);
+}
+
+
+/*
+ *
+ *	Send a JSON-RPC request to ovs-vswitchd
+ *
+ */
+
+/* Requests only have a method and (at most) one interface name parameter */
+#define B1B_OVS_REQ_MAX		256
+
+/* Returns the request ID, or 0 if the request could not be sent */
+static uint64_t b1b_ovs_rpc_send(struct b1b_global_session *const gs,
+				 const char *restrict const method,
+				 const char *restrict const param)
+{
+	static uint64_t reqid;
+
+	char req[B1B_OVS_REQ_MAX];
+	const char *str;
+	size_t len;
+	ssize_t sent;
+
+	len = b1b_jsonrpc_req(req, sizeof req, ++reqid, method, param);
+	if (len == 0)
+		B1B_FATAL("JSON-RPC request too long: %s", method);
 
-	gs->buf[bytes] = 0;
+	str = req;
 
-	resp = json_tokener_parse_ex(tok, gs->str, bytes + 1);
-	if (resp == NULL) {
-		B1B_FATAL("Failed to parse JSON-RPC response: %s",
-			  json_tokener_error_desc(json_tokener_get_error(tok)));
+	/* MSG_NOSIGNAL - get EPIPE, rather than SIGPIPE, if OVS has exited */
+	while (len != 0) {
+
+		sent = send(gs->ovssock, str, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			B1B_ERR("Failed to send JSON-RPC request: %s: %m",
+				gs->ovssock_path);
+			reqid = 0;
+			break;
+		}
+
+		str += sent;
+		len -= sent;
 	}
 
-	json_tokener_free(tok);
+	return reqid;
+}
 
-	if (!json_object_is_type(resp, json_type_object))
-		B1B_FATAL("JSON-RPC response is not a JSON object");
 
-	member = b1b_json_resp_get(resp, "id", json_type_int, -1);
+/*
+ *
+ *	Receive a JSON-RPC response from ovs-vswitchd
+ *
+ */
+
+/* Initial size of the response buffer; doubled as needed */
+#define B1B_OVS_RBUF_SIZE	65536
 
-	if (json_object_get_uint64(member) != reqid) {
-		B1B_FATAL("JSON-RPC response ID does not match request: "
-				"request: %" PRIu64 ", response: %" PRIu64,
-			  reqid, json_object_get_uint64(member));
+/*
+ * Free the previous response, and move any bytes after it to the start of the
+ * buffer
+ */
+static void b1b_ovs_rpc_compact(struct b1b_global_session *const gs)
+{
+	if (gs->ovsjson != NULL) {
+		if (json_object_put(gs->ovsjson) != 1)
+			B1B_FATAL("Failed to free JSON-RPC response");
+		gs->ovsjson = NULL;
 	}
 
-	member = b1b_json_resp_get(resp, "error", json_type_string,
-				   json_type_null, -1);
+	if (gs->ovsrbuf == NULL) {
+		gs->ovsrsize = B1B_OVS_RBUF_SIZE;
+		gs->ovsrbuf = B1B_ZALLOC(gs->ovsrsize);
+	}
+
+	if (gs->ovsrnext != 0) {
+		gs->ovsrlen -= gs->ovsrnext;
+		memmove(gs->ovsrbuf, gs->ovsrbuf + gs->ovsrnext, gs->ovsrlen);
+		gs->ovsrnext = 0;
+	}
+}
 
-	if ((type = json_object_get_type(member)) == json_type_string) {
+/*
+ * Receive more bytes into gs->ovsrbuf (growing it if it's full).  Returns the
+ * number of bytes received, 0 if flags includes MSG_DONTWAIT and no bytes are
+ * available, or -1 if the connection has failed.
+ */
+static ssize_t b1b_ovs_rpc_fill(struct b1b_global_session *const gs,
+				const int flags)
+{
+	ssize_t bytes;
 
-		result = 0;
+	if (gs->ovsrlen == gs->ovsrsize) {
+		gs->ovsrsize *= 2;
+		gs->ovsrbuf = realloc(gs->ovsrbuf, gs->ovsrsize);
+		if (gs->ovsrbuf == NULL) {
+			B1B_FATAL("Cannot allocate %zu bytes: %m",
+				  gs->ovsrsize);
+		}
 	}
-	else {  /* must be a string (ensured by b1b_json_resp_get()) */
 
-		member = b1b_json_resp_get(resp, "result",
-					   json_type_string, -1);
-		result = 1;
+	do {
+		bytes = recv(gs->ovssock, gs->ovsrbuf + gs->ovsrlen,
+			     gs->ovsrsize - gs->ovsrlen, flags);
+	} while (bytes < 0 && errno == EINTR);
+
+	if (bytes < 0) {
+		if (errno == EAGAIN) {
+			if (flags & MSG_DONTWAIT)
+				return 0;
+			B1B_ERR("Timed out waiting for JSON-RPC response: %s",
+				gs->ovssock_path);
+			return -1;
+		}
+		B1B_ERR("Failed to receive JSON-RPC response: %s: %m",
+			gs->ovssock_path);
+		return -1;
 	}
 
-	if ((bytes = json_object_get_string_len(member)) <= 0)
-		B1B_FATAL("JSON-RPC response has zero length result/error");
+	if (bytes == 0) {
+		B1B_ERR("Connection closed while receiving JSON-RPC "
+				"response: %s",
+			gs->ovssock_path);
+		return -1;
+	}
 
-	/* Buffer held JSON response, so string definitely fits */
-	memcpy(gs->buf, json_object_get_string(member), bytes);
-	gs->buf[bytes - 1] = 0;  /* remove newline */
+	gs->ovsrlen += bytes;
+	gs->rxbytes += bytes;
 
-	if (json_object_put(resp) != 1)
-		B1B_FATAL("Failed to free JSON-RPC response");
+	return bytes;
+}
+
+/*
+ * Check whether a complete response has been received.  Scanning resumes where
+ * the previous call left off (gs->ovsframe), so a large response that arrives
+ * in many pieces is only scanned once.  Returns 1 if a response is complete
+ * (and ends at gs->ovsrnext), 0 if more bytes are needed, or -1 if the bytes
+ * received can't be a response.
+ */
+static int b1b_ovs_rpc_frame(struct b1b_global_session *const gs)
+{
+	int result;
+
+	result = b1b_json_frame(&gs->ovsframe, gs->ovsrbuf, gs->ovsrlen);
+
+	if (result < 0) {
+		B1B_ERR("Failed to parse JSON-RPC response: %s",
+			"not a JSON object");
+	}
+	else if (result > 0) {
+		gs->ovsrnext = gs->ovsframe.pos;
+		memset(&gs->ovsframe, 0, sizeof gs->ovsframe);
+	}
 
 	return result;
 }
 
-
 /*
+ * Read a complete JSON-RPC response into gs->ovsrbuf, which may span many
+ * reads.  Returns the length of the response (which starts at the beginning of
+ * the buffer), or 0 if the connection fails or the response can't be parsed.
  *
- *	Simple line iterator for parsing ovs-vswitchd results
- *
+ * When requests are pipelined, a read may return more than one response.  Any
+ * bytes after the end of the response are left in the buffer (starting at
+ * gs->ovsrnext), and moved to the start of the buffer by the next call, so
+ * the previous response is only valid until then.
  */
+static size_t b1b_ovs_rpc_read(struct b1b_global_session *const gs)
+{
+	int result;
 
-struct b1b_line_iter {
-	char *line;
-	char *eol;  /* if NULL, last (possibly empty) line has been returned */
-};
+	b1b_ovs_rpc_compact(gs);
 
-struct b1b_line_iter *b1b_line_iter_new(char *const buf)
-{
-	struct b1b_line_iter *iter;
+	while ((result = b1b_ovs_rpc_frame(gs)) == 0) {
+		if (b1b_ovs_rpc_fill(gs, 0) < 0)
+			return 0;
+	}
+
+	if (result < 0)
+		return 0;
 
-	iter = B1B_ZALLOC(sizeof *iter);
-	iter->line = buf;
-	iter->eol = buf;
+	return gs->ovsrnext;
+}
 
-	return iter;
+/* Discard any unexpected data after the last response */
+static void b1b_ovs_rpc_flush(struct b1b_global_session *const gs)
+{
+	if (gs->ovsrlen != gs->ovsrnext) {
+		B1B_WARN("Ignoring %zu bytes after JSON-RPC response",
+			 gs->ovsrlen - gs->ovsrnext);
+		gs->ovsrlen = gs->ovsrnext;
+	}
 }
 
-char *b1b_line_iter_next(struct b1b_line_iter *const iter)
+/*
+ * Get a member of a response, which must have one of the listed types.
+ * Returns NULL (after logging the reason) if it doesn't.
+ */
+static json_object *b1b_json_resp_get(const json_object *restrict const resp,
+				      const char *restrict const name,
+				      ...)
 {
-	char *result;
+	json_object *member;
+	json_type type;
+	va_list ap;
 
-	if (iter->eol == NULL)
+	if (!json_object_object_get_ex(resp, name, &member)) {
+		B1B_ERR("JSON-RPC response does not contain member: %s", name);
 		return NULL;
+	}
 
-	result = iter->line;
+	va_start(ap, name);
 
-#if 0
-	/* Enable these (untested) lines to make the iterator non-destructive */
-	if (iter->eol != iter->line)
-		*iter->eol = '\n';
-#endif
+	while ((type = va_arg(ap, json_type)) >= 0) {
 
-	if ((iter->eol = strchr(iter->line, '\n')) != NULL) {
-		*iter->eol = 0;
-		iter->line = iter->eol + 1;
+		if (json_object_is_type(member, type))
+			break;
 	}
 
-	return result;
-}
+	va_end(ap);
+
+	if (type < 0) {
+		B1B_ERR("Incorrect type of JSON-RPC response member: %s: %s",
+			name, json_type_to_name(json_object_get_type(member)));
+		return NULL;
+	}
 
+	return member;
+}
 
 /*
- *
- *	Get the forwarding database of an OVS bridge
- *
+ * Parse a response that b1b_jsonrpc_scan() didn't understand with json-c.  The
+ * parsed response is kept (gs->ovsjson) until the next response is read.
  */
-
-static void b1b_ovs_get_fdb(struct b1b_global_session *const gs,
-			    struct b1b_bond_session *const bs)
+static int b1b_ovs_rpc_parse_json(struct b1b_global_session *const gs,
+				  const size_t len,
+				  struct b1b_jsonrpc_resp *const resp)
 {
-	uint64_t reqid;
-	struct b1b_line_iter *iter;
-	char *line;
-	int result;
-	uint32_t ofport;
-	union b1b_fdb_dst dst;
+	enum json_tokener_error err;
+	json_object *member;
 
+	B1B_DEBUG("Parsing JSON-RPC response with json-c");
 
-	reqid = b1b_ovs_rpc_send(gs, "fdb/show", bs->brname);
-	if (!b1b_ovs_rpc_recv(gs, reqid))
-		B1B_FATAL("Error response from OVS daemon: %s", gs->str);
+	if (gs->ovstok == NULL && (gs->ovstok = json_tokener_new_ex(2)) == NULL)
+		B1B_FATAL("Failed to create JSON parser: %m");
 
-	iter = b1b_line_iter_new(gs->str);
-	b1b_line_iter_next(iter);  /* skip header */
+	json_tokener_reset(gs->ovstok);
 
-	while ((line = b1b_line_iter_next(iter)) != NULL) {
+	gs->ovsjson = json_tokener_parse_ex(gs->ovstok, gs->ovsrbuf, len);
+	if (gs->ovsjson == NULL) {
+		err = json_tokener_get_error(gs->ovstok);
+		B1B_ERR("Failed to parse JSON-RPC response: %s",
+			json_tokener_error_desc(err));
+		return -1;
+	}
 
-		if (strncmp(line, "LOCAL", sizeof("LOCAL") - 1) == 0)
-			continue;
+	if (!json_object_is_type(gs->ovsjson, json_type_object)) {
+		B1B_ERR("JSON-RPC response is not a JSON object");
+		return -1;
+	}
 
-		result = sscanf(line, " %" SCNu32 " %" SCNu16
-					" %" SCNx8 ":%" SCNx8 ":%" SCNx8
-					":%" SCNx8 ":%" SCNx8 ":%" SCNx8,
-				&ofport, &dst.dst.vlan,
-				&dst.dst.mac[0], &dst.dst.mac[1],
-				&dst.dst.mac[2], &dst.dst.mac[3],
-				&dst.dst.mac[4], &dst.dst.mac[5]);
-		if (result != 8)
-			B1B_FATAL("Failed to parse result from OVS daemon");
+	member = b1b_json_resp_get(gs->ovsjson, "id", json_type_int, -1);
+	if (member == NULL)
+		return -1;
+	resp->id = json_object_get_uint64(member);
 
-		if (ofport != bs->ofport)
-			b1b_fdb_add(bs, dst);
+	member = b1b_json_resp_get(gs->ovsjson, "error", json_type_string,
+				   json_type_null, -1);
+	if (member == NULL)
+		return -1;
+
+	if (json_object_is_type(member, json_type_string)) {
+		resp->error = json_object_get_string(member);
+		resp->result = NULL;
+		resp->len = 0;
+		return 0;
 	}
 
-	free(iter);
-}
+	member = b1b_json_resp_get(gs->ovsjson, "result", json_type_string,
+				   -1);
+	if (member == NULL)
+		return -1;
 
+	resp->error = NULL;
+	resp->result = json_object_get_string(member);
+	resp->len = json_object_get_string_len(member);
+
+	return 0;
+}
 
 /*
- *
- *	Get OVS-specific bridge information
- *
+ * Parse a complete response (of length len) at the start of gs->ovsrbuf.
+ * Returns -1 (after logging the reason) if it isn't a valid response.
  */
-
-static int b1b_ovs_msg_cb(const struct nlmsghdr *const nlmsg, void *const data)
+static int b1b_ovs_rpc_parse(struct b1b_global_session *const gs,
+			     const size_t len,
+			     struct b1b_jsonrpc_resp *const resp)
 {
-	struct b1b_bond_session *const bs = data;
-	struct ifinfomsg *ifi;
+	if (b1b_jsonrpc_scan(gs->ovsrbuf, len, resp) != 0
+			&& b1b_ovs_rpc_parse_json(gs, len, resp) < 0) {
+		return -1;
+	}
 
-	if (nlmsg->nlmsg_type != RTM_NEWLINK)
-		return MNL_CB_OK;
+	/* Every command that b1b uses has some output */
+	if (resp->error == NULL && resp->len == 0) {
+		B1B_ERR("JSON-RPC response has zero length result");
+		return -1;
+	}
 
-	B1B_ASSERT(nlmsg->nlmsg_len >= MNL_NLMSG_HDRLEN + sizeof *ifi);
-	ifi = mnl_nlmsg_get_payload(nlmsg);
-	bs->brindex = ifi->ifi_index;
+	return 0;
+}
 
-	return MNL_CB_STOP;
+/*
+ * Read and parse the next response.  Returns -1 if the connection fails or the
+ * response can't be parsed.
+ */
+static int b1b_ovs_rpc_next(struct b1b_global_session *const gs,
+			    struct b1b_jsonrpc_resp *const resp)
+{
+	size_t len;
+
+	if ((len = b1b_ovs_rpc_read(gs)) == 0)
+		return -1;
+
+	return b1b_ovs_rpc_parse(gs, len, resp);
 }
 
-void b1b_get_ovs_info(struct b1b_global_session *const gs,
-		      struct b1b_bond_session *const bs)
+static _Bool b1b_ovs_bg_resp(struct b1b_global_session *gs,
+			     const struct b1b_jsonrpc_resp *resp);
+
+/*
+ * Handle responses that have arrived (without blocking), when the socket is
+ * readable and no request is waiting for a response.  All of them should be
+ * responses to background (prefetch or port map) requests; anything else is a
+ * protocol error.
+ */
+static void b1b_ovs_sock_cb(struct b1b_global_session *const gs,
+			    struct b1b_event_src *const src,
+			    const uint32_t events __attribute__((unused)))
 {
-	uint64_t reqid;
-	struct b1b_line_iter *iter;
-	char *line, *ifname, *brname;
-	uint32_t ofport;
+	struct b1b_jsonrpc_resp resp;
+	ssize_t bytes;
 	int result;
 
-	reqid = b1b_ovs_rpc_send(gs, "dpif/show", NULL);
-	if (!b1b_ovs_rpc_recv(gs, reqid))
-		B1B_FATAL("Error response from OVS daemon: %s", gs->str);
+	/* Disconnected by an earlier callback in this batch */
+	if (src->fd != gs->ovssock)
+		return;
 
-	iter = b1b_line_iter_new(gs->str);
-	b1b_line_iter_next(iter);  /* skip header */
+	b1b_ovs_rpc_compact(gs);
 
-	brname = NULL;
+	if ((bytes = b1b_ovs_rpc_fill(gs, MSG_DONTWAIT)) == 0)
+		return;
 
-	while ((line = b1b_line_iter_next(iter)) != NULL) {
+	if (bytes < 0) {
+		b1b_ovs_disconnect(gs);
+		return;
+	}
 
-		result = sscanf(line, " %m[^: ] %" SCNu32, &ifname, &ofport);
+	while ((result = b1b_ovs_rpc_frame(gs)) > 0) {
 
-		if (result == 1) {
-			free(brname);
-			brname = ifname;
-			continue;
+		if (b1b_ovs_rpc_parse(gs, gs->ovsrnext, &resp) < 0) {
+			result = -1;
+			break;
 		}
 
-		if (result != 2)
-			B1B_FATAL("Failed to parse result from OVS daemon");
-
-		result = strcmp(ifname, bs->ifname);
-		free(ifname);
-
-		if (result == 0)
+		if (!b1b_ovs_bg_resp(gs, &resp)) {
+			B1B_ERR("Unexpected JSON-RPC response: ID %" PRIu64,
+				resp.id);
+			result = -1;
 			break;
+		}
+
+		b1b_ovs_rpc_compact(gs);
 	}
 
-	free(iter);
+	if (result < 0)
+		b1b_ovs_disconnect(gs);
+}
 
-	if (brname == NULL || line == NULL)
-		B1B_FATAL("Failed to identify OVS bridge and port");
+/*
+ * Returns a pointer to the result string (and its length, including the
+ * trailing newline) within a response, or NULL if the response is an error.
+ */
+static const char *b1b_ovs_rpc_result(
+				const struct b1b_jsonrpc_resp *const resp,
+				size_t *const len)
+{
+	if (resp->error != NULL) {
+		B1B_ERR("Error response from OVS daemon: %s", resp->error);
+		return NULL;
+	}
 
-	/*
-	 * The previously identified bond master is the OVS system device.
-	 * Update the bond session with the actual bridge interface info.
-	 */
+	*len = resp->len;
 
-	free(bs->brname);
-	bs->brname = brname;
-	bs->ofport = ofport;
+	return resp->result;
+}
+
+/*
+ * Receive the response to a request.  Returns a pointer to the result string
+ * (see b1b_ovs_rpc_result()), which is valid until the next response is read.
+ * Returns NULL if the response is an error or if the connection has failed, in
+ * which case it is closed.
+ */
+static const char *b1b_ovs_rpc_recv(struct b1b_global_session *const gs,
+				    const uint64_t reqid, size_t *const len)
+{
+	struct b1b_jsonrpc_resp resp;
+
+	/* Responses to earlier background requests arrive first */
+	do {
+		if (b1b_ovs_rpc_next(gs, &resp) < 0) {
+			b1b_ovs_disconnect(gs);
+			return NULL;
+		}
+	} while (b1b_ovs_bg_resp(gs, &resp));
+
+	b1b_ovs_rpc_flush(gs);
+
+	if (resp.id != reqid) {
+		B1B_ERR("JSON-RPC response ID does not match request: "
+				"request: %" PRIu64 ", response: %" PRIu64,
+			reqid, resp.id);
+		b1b_ovs_disconnect(gs);
+		return NULL;
+	}
+
+	return b1b_ovs_rpc_result(&resp, len);
+}
+
+/*
+ * Send a request and receive its response.  If an existing connection has
+ * failed (e.g. because ovs-vswitchd has restarted), reconnect and retry once.
+ * Returns NULL on failure; otherwise see b1b_ovs_rpc_recv().
+ */
+static const char *b1b_ovs_call(struct b1b_global_session *const gs,
+				const char *restrict const method,
+				const char *restrict const param,
+				size_t *const len)
+{
+	struct timespec start, end;
+	const char *result;
+	unsigned int i, tries;
+	uint64_t reqid;
+
+	/* Only one connection attempt (see b1b_ovs_open()) */
+	tries = (gs->ovssock >= 0) ? 2 : 1;
+
+	for (i = 0; i < tries; ++i) {
+
+		if (b1b_ovs_open(gs) < 0)
+			return NULL;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if ((reqid = b1b_ovs_rpc_send(gs, method, param)) == 0) {
+			b1b_ovs_disconnect(gs);
+			continue;
+		}
+
+		result = b1b_ovs_rpc_recv(gs, reqid, len);
+
+		if (gs->ovssock >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			b1b_hist_add(&gs->ovs_rpc,
+				     b1b_ns_between(&start, &end));
+		}
+
+		if (result != NULL)
+			return result;
+
+		/* Error response; connection is still OK */
+		if (gs->ovssock >= 0)
+			return NULL;
+	}
+
+	return NULL;
+}
+
+void b1b_ovs_close(struct b1b_global_session *const gs)
+{
+	b1b_ovs_disconnect(gs);
+
+	if (gs->ovstok != NULL)
+		json_tokener_free(gs->ovstok);
+
+	if (gs->ovsjson != NULL && json_object_put(gs->ovsjson) != 1)
+		B1B_FATAL("Failed to free JSON-RPC response");
+
+	free(gs->ovsrbuf);
+
+	if (gs->ovswatch_ev.cb != NULL && close(gs->ovswatch_ev.fd) < 0)
+		B1B_ERR("Failed to close inotify instance: %m");
+
+	if (gs->prefetch_ev.cb != NULL && close(gs->prefetch_ev.fd) < 0)
+		B1B_ERR("Failed to close FDB prefetch timer: %m");
+
+	if (gs->portmap_ev.cb != NULL && close(gs->portmap_ev.fd) < 0)
+		B1B_ERR("Failed to close OVS port map timer: %m");
+
+	if (gs->ovsretry_ev.cb != NULL && close(gs->ovsretry_ev.fd) < 0)
+		B1B_ERR("Failed to close OVS reconnect timer: %m");
+
+	free(gs->ovsports);
+	free(gs->ovsportbuf);
+}
+
+
+/*
+ *
+ *	Get the forwarding database of an OVS bridge
+ *
+ */
+
+/*
+ * The result of fdb/show is a header line, followed by one line per entry:
+ *
+ *	 port  VLAN  MAC                Age
+ *	    1     0  52:54:00:12:34:56    3
+ *	LOCAL     0  52:54:00:ab:cd:ef    3
+ *
+ * It can have tens of thousands of lines, so it is parsed in a single pass,
+ * directly from the JSON-RPC response.  The parsing functions below advance
+ * *p past the field that they parse.
+ */
+
+static void b1b_fdb_skip_blanks(const char **const p)
+{
+	while (**p == ' ' || **p == '\t')
+		++*p;
+}
+
+static _Bool b1b_fdb_parse_dec(const char **const p, const uint32_t max,
+			       uint32_t *const value)
+{
+	const char *c;
+	uint64_t v;
+
+	for (c = *p, v = 0; *c >= '0' && *c <= '9'; ++c) {
+		v = v * 10 + (*c - '0');
+		if (v > max)
+			return 0;
+	}
+
+	if (c == *p)
+		return 0;
+
+	*p = c;
+	*value = v;
+	return 1;
+}
+
+static int b1b_fdb_hex_digit(const char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static _Bool b1b_fdb_parse_mac(const char **const p, uint8_t *const mac)
+{
+	const char *c;
+	int i, hi, lo;
+
+	for (c = *p, i = 0; i < ETH_ALEN; ++i) {
+
+		if (i != 0 && *c++ != ':')
+			return 0;
+
+		if ((hi = b1b_fdb_hex_digit(*c++)) < 0)
+			return 0;
+
+		/* Accept single digit octets, like sscanf() did */
+		if ((lo = b1b_fdb_hex_digit(*c)) < 0) {
+			mac[i] = hi;
+		}
+		else {
+			mac[i] = (hi << 4) | lo;
+			++c;
+		}
+	}
+
+	*p = c;
+	return 1;
+}
+
+static int b1b_ovs_resolve(struct b1b_global_session *gs,
+			   struct b1b_bond_session *bs);
+
+/*
+ * Add the (non-local) entries in the FDB of the bond's bridge, other than
+ * those on the bond's own port, to the bond's destination tree.  Returns -1
+ * (after logging the reason) if the FDB could not be retrieved.
+ */
+static int b1b_ovs_fetch_fdb(struct b1b_global_session *const gs,
+			     struct b1b_bond_session *const bs)
+{
+	const char *p;
+	size_t len;
+
+	/* Connect first, so that a restart is detected before the request */
+	if (b1b_ovs_open(gs) < 0)
+		return -1;
+
+	if (bs->ovsgen != gs->ovsgen && b1b_ovs_resolve(gs, bs) < 0) {
+		B1B_ERR("Cannot refresh OVS port info: %s", bs->ifname);
+		return -1;
+	}
+
+	p = b1b_ovs_call(gs, "fdb/show", bs->brname, &len);
+	if (p == NULL)
+		return -1;
+
+	/* Reconnected to a new ovs-vswitchd; bond's port may have changed */
+	if (bs->ovsgen != gs->ovsgen) {
+		B1B_ERR("ovs-vswitchd restarted during request: %s",
+			bs->brname);
+		return -1;
+	}
+
+	return b1b_ovs_parse_fdb(bs, p, len);
+}
+
+/*
+ * Parse an fdb/show result into the bond's destination tree.  Returns -1 (after
+ * logging the reason, and freeing the tree) if the result can't be parsed.
+ */
+int b1b_ovs_parse_fdb(struct b1b_bond_session *const bs, const char *p,
+		      const size_t len)
+{
+	const char *end, *what;
+	union b1b_fdb_dst dst;
+	uint32_t ofport, vlan;
+
+	end = p + len;
+
+	/* Every line (including the last) ends with a newline */
+	if (end[-1] != '\n' || (p = memchr(p, '\n', len)) == NULL) {
+		B1B_ERR("Failed to parse result from OVS daemon");
+		return -1;
+	}
+
+	for (++p; p < end; p = (const char *)memchr(p, '\n', end - p) + 1) {
+
+		b1b_fdb_skip_blanks(&p);
+
+		if (*p == '\n')  /* empty line (end of result) */
+			continue;
+
+		if (strncmp(p, "LOCAL", sizeof("LOCAL") - 1) == 0)
+			continue;
+
+		if (!b1b_fdb_parse_dec(&p, UINT32_MAX, &ofport)) {
+			what = "port";
+			goto error;
+		}
+
+		b1b_fdb_skip_blanks(&p);
+		if (!b1b_fdb_parse_dec(&p, 4095, &vlan)) {
+			what = "VLAN";
+			goto error;
+		}
+
+		b1b_fdb_skip_blanks(&p);
+		if (!b1b_fdb_parse_mac(&p, dst.dst.mac)) {
+			what = "MAC";
+			goto error;
+		}
+
+		/* The rest of the line (age) is ignored */
+		if (ofport == bs->ofport)
+			continue;
+
+		dst.dst.vlan = vlan;
+		b1b_fdb_add(bs, dst);
+	}
+
+	return 0;
+
+error:
+	B1B_ERR("Failed to parse %s from OVS daemon: %s", what, bs->brname);
+	b1b_fdb_free(&bs->fdbtree);
+	return -1;
+}
+
+static _Bool b1b_ovs_prefetch_take(struct b1b_global_session *gs,
+				   struct b1b_bond_session *bs);
+
+/*
+ * Get the bond's destinations from ovs-vswitchd (fdb/show), falling back to
+ * the kernel datapath flow table if ovs-vswitchd doesn't respond, or only
+ * from the datapath if -k/--ovs-datapath was specified.
+ */
+static int b1b_ovs_fetch(struct b1b_global_session *const gs,
+			 struct b1b_bond_session *const bs)
+{
+	if (b1b_ovs_datapath)
+		return b1b_ovsdp_get_fdb(gs, bs);
+
+	if (b1b_ovs_fetch_fdb(gs, bs) == 0)
+		return 0;
+
+	B1B_WARN("Using OVS datapath flows instead of FDB: %s", bs->brname);
+
+	return b1b_ovsdp_get_fdb(gs, bs);
+}
+
+/* getfdb callback for OVS bonds */
+static void b1b_ovs_get_fdb(struct b1b_global_session *const gs,
+			    struct b1b_bond_session *const bs)
+{
+	/* Already fetched by b1b_ovs_pipeline_fdb() */
+	if (bs->fdb_ready) {
+		bs->fdb_ready = 0;
+		return;
+	}
+
+	if (b1b_ovs_prefetch_take(gs, bs))
+		return;
+
+	if (b1b_ovs_fetch(gs, bs) < 0)
+		B1B_ERR("Cannot get OVS forwarding database: %s", bs->brname);
+}
+
+
+/*
+ *
+ *	Background FDB prefetch
+ *
+ */
+
+/*
+ * If enabled (-p/--ovs-prefetch), the FDB of each OVS bridge is fetched
+ * periodically from the main loop, so that a failover burst can start
+ * immediately from the cached destination tree, rather than waiting for a
+ * JSON-RPC round trip to ovs-vswitchd (which is likely to be busy handling the
+ * same link failure).  The main loop doesn't wait for the responses.
+ */
+
+/* Delay before the first prefetch, and before refreshing a used cache */
+#define B1B_PREFETCH_SOON_NS	100000000
+
+static void b1b_ovs_prefetch_arm(struct b1b_global_session *const gs,
+				 const uint64_t nsec)
+{
+	struct itimerspec its = { .it_interval = { 0, 0 } };
+
+	its.it_value.tv_sec = nsec / 1000000000;
+	its.it_value.tv_nsec = nsec % 1000000000;
+
+	if (timerfd_settime(gs->prefetch_ev.fd, 0, &its, NULL) < 0)
+		B1B_FATAL("Failed to arm FDB prefetch timer: %m");
+}
+
+/* Prefetch interval +/- 10%, so requests don't synchronize across hosts */
+static uint64_t b1b_ovs_prefetch_interval(void)
+{
+	uint64_t nsec;
+
+	nsec = (uint64_t)b1b_ovs_prefetch * 1000000000;
+
+	return nsec - nsec / 10 + (uint64_t)random() % (nsec / 5 + 1);
+}
+
+/* Replace the bond's cached destination tree */
+static void b1b_ovs_prefetch_store(struct b1b_bond_session *const bs,
+				   struct savl_node *const fdbtree)
+{
+	b1b_fdb_free(&bs->fdbcache);
+	bs->fdbcache = fdbtree;
+	clock_gettime(CLOCK_MONOTONIC, &bs->cache_time);
+}
+
+/* With -k/--ovs-datapath, the flows are dumped from the kernel directly */
+static void b1b_ovs_prefetch_dp(struct b1b_global_session *const gs)
+{
+	struct b1b_bond_session *bs;
+	unsigned int i;
+
+	for (i = 0; i < gs->bcount; ++i) {
+
+		bs = gs->bonds + i;
+
+		if (bs->getfdb != b1b_ovs_get_fdb)
+			continue;
+
+		if (b1b_ovsdp_get_fdb(gs, bs) < 0) {
+			B1B_WARN("Failed to prefetch OVS forwarding database: "
+					"%s",
+				 bs->brname);
+			b1b_fdb_free(&bs->fdbtree);
+			continue;
+		}
+
+		b1b_ovs_prefetch_store(bs, bs->fdbtree);
+		bs->fdbtree = NULL;
+	}
+}
+
+/*
+ * Send one fdb/show request per bridge, without waiting for the responses,
+ * which are handled by b1b_ovs_prefetch_resp() (from b1b_ovs_sock_cb(), or
+ * from whichever request is waiting for a response when they arrive).
+ */
+static void b1b_ovs_prefetch_send(struct b1b_global_session *const gs)
+{
+	struct b1b_bond_session *bs, *other;
+	unsigned int i, j;
+	uint64_t reqid;
+
+	if (gs->prefetches != 0) {
+		B1B_WARN("Previous OVS FDB prefetch still in progress");
+		return;
+	}
+
+	if (b1b_ovs_open(gs) < 0) {
+		B1B_WARN("Failed to prefetch OVS forwarding databases");
+		return;
+	}
+
+	for (i = 0; i < gs->bcount; ++i) {
+
+		bs = gs->bonds + i;
+
+		/* Stale port info is refreshed by the port map timer */
+		if (bs->getfdb != b1b_ovs_get_fdb || bs->prefetch_req != 0
+				|| bs->ovsgen != gs->ovsgen) {
+			continue;
+		}
+
+		if ((reqid = b1b_ovs_rpc_send(gs, "fdb/show",
+					      bs->brname)) == 0) {
+			b1b_ovs_disconnect(gs);
+			return;
+		}
+
+		++gs->prefetches;
+
+		/* Bonds on the same bridge share the response */
+		for (j = i; j < gs->bcount; ++j) {
+
+			other = gs->bonds + j;
+
+			if (other->getfdb == b1b_ovs_get_fdb
+					&& other->ovsgen == gs->ovsgen
+					&& strcmp(other->brname,
+						  bs->brname) == 0) {
+				other->prefetch_req = reqid;
+			}
+		}
+	}
+
+	B1B_DEBUG("Sent %u OVS FDB prefetch request(s)", gs->prefetches);
+}
+
+/*
+ * If a response is to a prefetch request, parse it into the cached destination
+ * tree of every bond on the bridge, and return true.
+ */
+static _Bool b1b_ovs_prefetch_resp(struct b1b_global_session *const gs,
+				   const struct b1b_jsonrpc_resp *const resp)
+{
+	struct b1b_bond_session *bs;
+	struct savl_node *fdbtree;
+	const char *result;
+	unsigned int i;
+	_Bool found;
+	size_t len;
+
+	if (gs->prefetches == 0)
+		return 0;
+
+	result = NULL;
+	found = 0;
+
+	for (i = 0; i < gs->bcount; ++i) {
+
+		bs = gs->bonds + i;
+
+		if (bs->prefetch_req != resp->id)
+			continue;
+
+		bs->prefetch_req = 0;
+
+		if (!found) {
+			found = 1;
+			result = b1b_ovs_rpc_result(resp, &len);
+		}
+
+		if (result == NULL) {
+			B1B_WARN("Failed to prefetch OVS forwarding database: "
+					"%s",
+				 bs->brname);
+			continue;
+		}
+
+		/* Bond may have a destination tree from a pipelined request */
+		fdbtree = bs->fdbtree;
+		bs->fdbtree = NULL;
+
+		/* Keep the previous cache (if any); it expires on its own */
+		if (b1b_ovs_parse_fdb(bs, result, len) < 0) {
+			B1B_WARN("Failed to prefetch OVS forwarding database: "
+					"%s",
+				 bs->brname);
+		}
+		else {
+			b1b_ovs_prefetch_store(bs, bs->fdbtree);
+		}
+
+		bs->fdbtree = fdbtree;
+	}
+
+	if (found)
+		--gs->prefetches;
+
+	return found;
+}
+
+static void b1b_ovs_prefetch_cb(struct b1b_global_session *const gs,
+				struct b1b_event_src *const src,
+				const uint32_t events __attribute__((unused)))
+{
+	uint64_t expirations;
+
+	if (read(src->fd, &expirations, sizeof expirations) < 0) {
+		if (errno == EAGAIN)
+			return;
+		B1B_FATAL("Failed to read FDB prefetch timer: %m");
+	}
+
+	if (b1b_ovs_datapath)
+		b1b_ovs_prefetch_dp(gs);
+	else
+		b1b_ovs_prefetch_send(gs);
+
+	b1b_ovs_prefetch_arm(gs, b1b_ovs_prefetch_interval());
+}
+
+static void b1b_ovs_prefetch_start(struct b1b_global_session *const gs)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		B1B_FATAL("Failed to create FDB prefetch timer: %m");
+
+	srandom(getpid() ^ time(NULL));
+
+	gs->prefetch_ev.cb = b1b_ovs_prefetch_cb;
+	gs->prefetch_ev.fd = fd;
+	b1b_ev_add(gs, &gs->prefetch_ev, EPOLLIN);
+
+	b1b_ovs_prefetch_arm(gs, B1B_PREFETCH_SOON_NS);
+}
+
+/*
+ * Use the bond's cached destination tree, if it is fresh enough (less than 2
+ * prefetch intervals old).  Returns true if the cache was used, in which case
+ * a refresh is scheduled, so that the cache reflects the post-failover FDB.
+ */
+static _Bool b1b_ovs_prefetch_take(struct b1b_global_session *const gs,
+				   struct b1b_bond_session *const bs)
+{
+	struct timespec now;
+
+	if (bs->fdbcache == NULL)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (now.tv_sec - bs->cache_time.tv_sec >= 2 * (time_t)b1b_ovs_prefetch
+			|| bs->ovsgen != gs->ovsgen) {
+		B1B_DEBUG("Cached OVS FDB is stale: %s", bs->brname);
+		b1b_fdb_free(&bs->fdbcache);
+		return 0;
+	}
+
+	B1B_DEBUG("Using cached OVS FDB: %s", bs->brname);
+
+	bs->fdbtree = bs->fdbcache;
+	bs->fdbcache = NULL;
+
+	b1b_ovs_prefetch_arm(gs, B1B_PREFETCH_SOON_NS);
+
+	return 1;
+}
+
+
+/*
+ *
+ *	Pipelined FDB requests
+ *
+ */
+
+/*
+ * When several OVS bonds fail over at once, send all of their fdb/show
+ * requests before reading any responses, so that ovs-vswitchd can work on
+ * them back-to-back, and match the responses to bonds by ID.  Bonds whose
+ * FDBs are fetched here are marked (fdb_ready), so that b1b_ovs_get_fdb()
+ * doesn't fetch them again.  Any failure leaves the remaining bonds to be
+ * fetched individually.
+ */
+static _Bool b1b_ovs_pipeline_wanted(const struct b1b_bond_session *const bs)
+{
+	return bs->failover_event && bs->getfdb == b1b_ovs_get_fdb
+			&& bs->fdbcache == NULL;
+}
+
+void b1b_ovs_pipeline_fdb(struct b1b_global_session *const gs)
+{
+	struct timespec start, end;
+	struct b1b_jsonrpc_resp resp;
+	struct b1b_bond_session *bs;
+	unsigned int i, count;
+	const char *result;
+	size_t len;
+
+	if (b1b_ovs_datapath)
+		return;
+
+	for (i = 0, count = 0; i < gs->bcount; ++i) {
+		bs = gs->bonds + i;
+		bs->ovsreq = b1b_ovs_pipeline_wanted(bs);
+		count += bs->ovsreq;
+	}
+
+	if (count < 2 || b1b_ovs_open(gs) < 0)
+		goto done;
+
+	/* Refresh any stale port info before any requests are outstanding */
+	for (i = 0; i < gs->bcount; ++i) {
+
+		bs = gs->bonds + i;
+
+		if (bs->ovsreq && bs->ovsgen != gs->ovsgen
+				&& b1b_ovs_resolve(gs, bs) < 0) {
+			bs->ovsreq = 0;
+		}
+	}
+
+	for (i = 0, count = 0; i < gs->bcount && gs->ovssock >= 0; ++i) {
+
+		bs = gs->bonds + i;
+
+		if (bs->ovsreq == 0)
+			continue;
+
+		if ((bs->ovsreq = b1b_ovs_rpc_send(gs, "fdb/show",
+						   bs->brname)) == 0) {
+			b1b_ovs_disconnect(gs);
+			break;
+		}
+
+		++count;
+	}
+
+	B1B_DEBUG("Sent %u pipelined fdb/show request(s)", count);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (count != 0 && gs->ovssock >= 0) {
+
+		if (b1b_ovs_rpc_next(gs, &resp) < 0) {
+			b1b_ovs_disconnect(gs);
+			break;
+		}
+
+		for (i = 0; i < gs->bcount; ++i) {
+			if (gs->bonds[i].ovsreq == resp.id)
+				break;
+		}
+
+		if (i == gs->bcount) {
+			if (!b1b_ovs_bg_resp(gs, &resp)) {
+				B1B_WARN("Ignoring JSON-RPC response with "
+						"unknown ID: %" PRIu64,
+					 resp.id);
+			}
+			continue;
+		}
+
+		bs = gs->bonds + i;
+		bs->ovsreq = 0;
+		--count;
+
+		/* Includes time spent waiting behind earlier requests */
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		b1b_hist_add(&gs->ovs_rpc, b1b_ns_between(&start, &end));
+
+		/* Otherwise, it will be fetched individually */
+		if ((result = b1b_ovs_rpc_result(&resp, &len)) != NULL
+				&& b1b_ovs_parse_fdb(bs, result, len) == 0) {
+			bs->fdb_ready = 1;
+			bs->fdb_bytes = len;
+		}
+	}
+
+	b1b_ovs_rpc_flush(gs);
+
+done:
+	/* Requests not sent, or responses that never arrived */
+	for (i = 0; i < gs->bcount; ++i)
+		gs->bonds[i].ovsreq = 0;
+}
+
+
+/*
+ *
+ *	OVS port map (from dpif/show)
+ *
+ */
+
+/*
+ * The output of dpif/show is parsed once into a map of all OVS ports, which is
+ * shared by all bonds.  It looks like this:
+ *
+ *	system@ovs-system: hit:1234 missed:56
+ *	  br0:
+ *	    br0 65534/1: (internal)
+ *	    bond0 1/2: (system)
+ *
+ * The names in the map point into a copy of the output (ovsportbuf), so
+ * loading the map doesn't allocate anything per port.
+ */
+
+struct b1b_ovs_port {
+	const char *ifname;
+	const char *brname;
+	uint32_t ofport;
+	uint32_t dpport;  /* datapath port number (UINT32_MAX if unknown) */
+};
+
+static int b1b_ovs_port_cmp(const void *const p1, const void *const p2)
+{
+	const struct b1b_ovs_port *const port1 = p1;
+	const struct b1b_ovs_port *const port2 = p2;
+
+	return strcmp(port1->ifname, port2->ifname);
+}
+
+/* Parses one line of dpif/show output (after the header) */
+static void b1b_ovs_port_line(char *p, const char **const brname,
+			      struct b1b_ovs_port *const ports,
+			      unsigned int *const count)
+{
+	uint32_t ofport, dpport;
+	const char *name, *c;
+	char *end;
+
+	p += strspn(p, " \t");
+	if (*p == 0)
+		return;
+
+	name = p;
+	end = p + strcspn(p, ": \t");
+	c = end;
+	b1b_fdb_skip_blanks(&c);
+
+	/* Port lines have a port number after the name; others are bridges */
+	if (!b1b_fdb_parse_dec(&c, UINT32_MAX, &ofport)) {
+		*end = 0;
+		*brname = name;
+		return;
+	}
+
+	if (*brname == NULL)
+		return;
+
+	/* Followed by the datapath port number (ofport/dpport) */
+	if (*c++ != '/' || !b1b_fdb_parse_dec(&c, UINT32_MAX, &dpport))
+		dpport = UINT32_MAX;
+
+	*end = 0;
+	ports[*count].ifname = name;
+	ports[*count].brname = *brname;
+	ports[*count].ofport = ofport;
+	ports[*count].dpport = dpport;
+	++*count;
+}
+
+/*
+ * (Re)load the port map from a dpif/show result.  Returns -1 on failure (after
+ * logging the reason), in which case the previous map (if any) is kept.
+ */
+static int b1b_ovs_parse_ports(struct b1b_global_session *const gs,
+			       const char *const result, const size_t len)
+{
+	struct b1b_ovs_port *ports;
+	unsigned int count, max;
+	char *buf, *line, *eol;
+	const char *brname;
+
+	buf = B1B_ZALLOC(len + 1);
+	memcpy(buf, result, len);
+
+	/* Every line after the header could be a port */
+	for (max = 0, line = buf; (line = strchr(line, '\n')) != NULL; ++line)
+		++max;
+
+	ports = B1B_ZALLOC((max + 1) * sizeof *ports);
+	brname = NULL;
+	count = 0;
+
+	/* Skip header */
+	if ((line = strchr(buf, '\n')) != NULL)
+		++line;
+
+	for (; line != NULL && *line != 0; line = eol) {
+
+		if ((eol = strchr(line, '\n')) != NULL)
+			*eol++ = 0;
+
+		b1b_ovs_port_line(line, &brname, ports, &count);
+	}
+
+	if (count == 0) {
+		B1B_ERR("Failed to parse result from OVS daemon");
+		free(ports);
+		free(buf);
+		return -1;
+	}
+
+	qsort(ports, count, sizeof *ports, b1b_ovs_port_cmp);
+
+	free(gs->ovsports);
+	free(gs->ovsportbuf);
+	gs->ovsports = ports;
+	gs->ovsportbuf = buf;
+	gs->ovspcount = count;
+	gs->portmap_gen = gs->ovsgen;
+
+	B1B_DEBUG("Loaded OVS port map: %u ports", count);
+
+	return 0;
+}
+
+/* Load the port map, waiting for the response (at startup or failover) */
+static int b1b_ovs_load_ports(struct b1b_global_session *const gs)
+{
+	const char *result;
+	size_t len;
+
+	result = b1b_ovs_call(gs, "dpif/show", NULL, &len);
+	if (result == NULL)
+		return -1;
+
+	return b1b_ovs_parse_ports(gs, result, len);
+}
+
+static const struct b1b_ovs_port *b1b_ovs_find_port(
+				const struct b1b_global_session *const gs,
+				const char *const ifname)
+{
+	const struct b1b_ovs_port key = { .ifname = ifname };
+
+	if (gs->ovsports == NULL)
+		return NULL;
+
+	return bsearch(&key, gs->ovsports, gs->ovspcount, sizeof key,
+		       b1b_ovs_port_cmp);
+}
+
+/*
+ * Get the datapath port numbers of an OVS bridge's ports from the port map.
+ * All bridges of the same type share a single kernel datapath, so this is
+ * needed to tell which bridge a datapath flow belongs to.  Returns the number
+ * of ports (0 if the bridge isn't in the map); the caller must free *dpports.
+ */
+unsigned int b1b_ovs_br_dpports(const struct b1b_global_session *const gs,
+				const char *const brname,
+				uint32_t **const dpports)
+{
+	const struct b1b_ovs_port *port;
+	unsigned int i, count;
+
+	*dpports = B1B_ZALLOC((gs->ovspcount + 1) * sizeof **dpports);
+
+	for (i = 0, count = 0; i < gs->ovspcount; ++i) {
+		port = gs->ovsports + i;
+		if (port->dpport != UINT32_MAX
+				&& strcmp(port->brname, brname) == 0) {
+			(*dpports)[count++] = port->dpport;
+		}
+	}
+
+	return count;
+}
+
+
+/*
+ *
+ *	Get OVS-specific bridge information
+ *
+ */
+
+static int b1b_ovs_msg_cb(const struct nlmsghdr *const nlmsg, void *const data)
+{
+	struct b1b_bond_session *const bs = data;
+	struct ifinfomsg *ifi;
+
+	if (nlmsg->nlmsg_type != RTM_NEWLINK)
+		return MNL_CB_OK;
+
+	B1B_ASSERT(nlmsg->nlmsg_len >= MNL_NLMSG_HDRLEN + sizeof *ifi);
+	ifi = mnl_nlmsg_get_payload(nlmsg);
+	bs->brindex = ifi->ifi_index;
+
+	return MNL_CB_STOP;
+}
+
+/*
+ * Update the bond session from its entry in the port map.  Returns -1 on
+ * failure (after logging the reason).
+ */
+static int b1b_ovs_apply_port(struct b1b_global_session *const gs,
+			      struct b1b_bond_session *const bs)
+{
+	const struct b1b_ovs_port *port;
+	int result;
+
+	if ((port = b1b_ovs_find_port(gs, bs->ifname)) == NULL) {
+		B1B_ERR("Failed to identify OVS bridge and port: %s",
+			bs->ifname);
+		return -1;
+	}
+
+	if (bs->ovsgen != 0 && strcmp(port->brname, bs->brname) == 0
+			&& port->ofport == bs->ofport) {
+		/* FDB cached before an ovs-vswitchd restart is stale */
+		if (bs->ovsgen != gs->portmap_gen)
+			b1b_fdb_free(&bs->fdbcache);
+		bs->ovsgen = gs->portmap_gen;
+		return 0;
+	}
+
+	/*
+	 * The previously identified bond master is the OVS system device (or,
+	 * if the bond has been moved or renumbered, the bridge that the bond
+	 * was attached to).  Update the bond session with the actual bridge
+	 * interface info.
+	 */
+
+	if (bs->ovsgen != 0) {
+		B1B_NOTICE("OVS port of %s changed: %s port %" PRIu32,
+			   bs->ifname, port->brname, port->ofport);
+	}
+
+	/* Any cached FDB was filtered using the old port number */
+	b1b_fdb_free(&bs->fdbcache);
+
+	/* Bond may have moved to a different bridge */
+	b1b_of_close(&bs->ofconn);
+
+	/* Worker threads only use the copy in each burst (b1b_burst.brname) */
+	free(bs->brname);
+	bs->brname = B1B_STRDUP(port->brname);
+	bs->ofport = port->ofport;
 	bs->getfdb = b1b_ovs_get_fdb;
 	bs->brindex = 0;
+	bs->ovsgen = gs->portmap_gen;
 
 	result = b1b_getlink(gs, bs->brname, 0, b1b_ovs_msg_cb, bs);
-	if (result <= MNL_CB_ERROR)
-		B1B_FATAL("Failed to get OVS bridge info: %s", bs->brname);
+	if (result <= MNL_CB_ERROR || bs->brindex == 0) {
+		B1B_ERR("Failed to get OVS bridge index: %s", bs->brname);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the OVS bridge and port number of a bond, reloading the port map if
+ * ovs-vswitchd has restarted since it was loaded.  Returns -1 on failure
+ * (after logging the reason).
+ */
+static int b1b_ovs_resolve(struct b1b_global_session *const gs,
+			   struct b1b_bond_session *const bs)
+{
+	if (gs->ovsports == NULL || gs->portmap_gen != gs->ovsgen) {
+		if (b1b_ovs_load_ports(gs) < 0)
+			return -1;
+	}
+
+	return b1b_ovs_apply_port(gs, bs);
+}
+
+/*
+ * Ports can be added, removed, or renumbered without restarting ovs-vswitchd,
+ * so the port map is periodically reloaded and compared with every OVS bond,
+ * rather than at failover time.  Like prefetch requests, the dpif/show request
+ * is sent from the timer callback, and its response is handled (by
+ * b1b_ovs_portmap_resp()) when it arrives.
+ */
+#define B1B_PORTMAP_REFRESH_SEC		30
+
+static void b1b_ovs_portmap_cb(struct b1b_global_session *const gs,
+			       struct b1b_event_src *const src,
+			       const uint32_t events __attribute__((unused)))
+{
+	uint64_t expirations;
+
+	if (read(src->fd, &expirations, sizeof expirations) < 0) {
+		if (errno == EAGAIN)
+			return;
+		B1B_FATAL("Failed to read OVS port map timer: %m");
+	}
+
+	if (gs->portmap_req != 0) {
+		B1B_WARN("Previous OVS port map refresh still in progress");
+		return;
+	}
+
+	if (b1b_ovs_open(gs) < 0) {
+		B1B_WARN("Failed to refresh OVS port map");
+		return;
+	}
+
+	gs->portmap_req = b1b_ovs_rpc_send(gs, "dpif/show", NULL);
+	if (gs->portmap_req == 0)
+		b1b_ovs_disconnect(gs);
+}
+
+/*
+ * If a response is to the port map refresh request, reload the port map and
+ * apply it to every OVS bond, and return true.
+ */
+static _Bool b1b_ovs_portmap_resp(struct b1b_global_session *const gs,
+				  const struct b1b_jsonrpc_resp *const resp)
+{
+	struct b1b_bond_session *bs;
+	const char *result;
+	unsigned int i;
+	size_t len;
+
+	if (gs->portmap_req == 0 || resp->id != gs->portmap_req)
+		return 0;
+
+	gs->portmap_req = 0;
+
+	result = b1b_ovs_rpc_result(resp, &len);
+	if (result == NULL || b1b_ovs_parse_ports(gs, result, len) < 0) {
+		B1B_WARN("Failed to refresh OVS port map");
+		return 1;
+	}
+
+	for (i = 0; i < gs->bcount; ++i) {
+
+		bs = gs->bonds + i;
+
+		if (bs->getfdb != b1b_ovs_get_fdb)
+			continue;
+
+		if (b1b_ovs_apply_port(gs, bs) < 0)
+			B1B_WARN("OVS bond info may be stale: %s", bs->ifname);
+	}
+
+	return 1;
+}
+
+/* Handle a response to a background (port map or prefetch) request */
+static _Bool b1b_ovs_bg_resp(struct b1b_global_session *const gs,
+			     const struct b1b_jsonrpc_resp *const resp)
+{
+	return b1b_ovs_portmap_resp(gs, resp)
+			|| b1b_ovs_prefetch_resp(gs, resp);
+}
+
+static void b1b_ovs_portmap_start(struct b1b_global_session *const gs)
+{
+	struct itimerspec its = {
+		.it_interval = { B1B_PORTMAP_REFRESH_SEC, 0 },
+		.it_value = { B1B_PORTMAP_REFRESH_SEC, 0 }
+	};
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		B1B_FATAL("Failed to create OVS port map timer: %m");
+
+	if (timerfd_settime(fd, 0, &its, NULL) < 0)
+		B1B_FATAL("Failed to arm OVS port map timer: %m");
+
+	gs->portmap_ev.cb = b1b_ovs_portmap_cb;
+	gs->portmap_ev.fd = fd;
+	b1b_ev_add(gs, &gs->portmap_ev, EPOLLIN);
+}
+
+void b1b_get_ovs_info(struct b1b_global_session *const gs,
+		      struct b1b_bond_session *const bs)
+{
+	if (gs->ovswatch_ev.cb == NULL)
+		b1b_ovs_watch(gs);
+
+	if (b1b_ovs_prefetch != 0 && gs->prefetch_ev.cb == NULL)
+		b1b_ovs_prefetch_start(gs);
+
+	if (gs->portmap_ev.cb == NULL)
+		b1b_ovs_portmap_start(gs);
+
+	if (gs->ovsretry_ev.cb == NULL)
+		b1b_ovs_retry_init(gs);
+
+	if (gs->ovssock < 0 && b1b_ovs_connect_wait(gs) < 0)
+		B1B_FATAL("Failed to get OVS info: %s", bs->ifname);
 
-	if (bs->brindex == 0)
-		B1B_FATAL("Failed to get OVS bridge index: %s", bs->brname);
+	if (b1b_ovs_resolve(gs, bs) < 0)
+		B1B_FATAL("Failed to get OVS info: %s", bs->ifname);
 }
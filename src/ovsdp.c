@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	ovsdp.c - Open vSwitch kernel datapath flows (generic netlink)
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "b1b.h"
+
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include <linux/genetlink.h>
+#include <linux/if_ether.h>
+#include <linux/openvswitch.h>
+
+
+/*
+ * The kernel datapath flow table is a cache of recently used flows, so it only
+ * contains MAC addresses that have recently sent traffic, and it only knows
+ * about VLAN tags on the wire, not OVS port tags.  A flow that entered the
+ * datapath untagged (e.g. from an access port) is assigned the VLAN that its
+ * actions push, if any.  All OVS bridges share the same datapath, so flows are
+ * matched to the bond's bridge by their input ports, using the port map (see
+ * ovs.c).  Otherwise it doesn't depend on ovs-vswitchd, so it can be used when
+ * ovs-vswitchd is slow or unavailable.
+ */
+
+#define B1B_VLAN_PRESENT	0x1000  /* VLAN_CFI_MASK in the datapath */
+#define B1B_VLAN_VID_MASK	0x0fff
+
+struct b1b_ovsdp_flow {
+	const struct ovs_key_ethernet *eth;
+	const struct ovs_key_ethernet *eth_mask;
+	uint32_t in_port;
+	_Bool has_in_port;
+	uint16_t vlan;  /* 0 if none */
+	uint16_t push_vlan;  /* first VLAN pushed by actions */
+	_Bool has_push_vlan;
+};
+
+
+/*
+ *
+ *	Find a datapath port (vport) by name
+ *
+ */
+
+struct b1b_ovsdp_vport {
+	int dp_ifindex;
+	uint32_t port_no;
+	_Bool found;
+};
+
+static int b1b_ovsdp_vport_attr_cb(const struct nlattr *const attr,
+				   void *const data)
+{
+	struct b1b_ovsdp_vport *const vport = data;
+
+	if (mnl_attr_get_type(attr) != OVS_VPORT_ATTR_PORT_NO)
+		return MNL_CB_OK;
+
+	if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+		return MNL_CB_ERROR;
+
+	vport->port_no = mnl_attr_get_u32(attr);
+	vport->found = 1;
+
+	return MNL_CB_STOP;
+}
+
+static int b1b_ovsdp_vport_msg_cb(const struct nlmsghdr *const nlmsg,
+				  void *const data)
+{
+	struct b1b_ovsdp_vport *const vport = data;
+	const struct ovs_header *ovsh;
+	size_t hdrlen;
+
+	hdrlen = MNL_ALIGN(sizeof(struct genlmsghdr)) + sizeof *ovsh;
+
+	if (mnl_nlmsg_get_payload_len(nlmsg) < hdrlen)
+		return MNL_CB_ERROR;
+
+	ovsh = mnl_nlmsg_get_payload_offset(nlmsg,
+					    sizeof(struct genlmsghdr));
+	vport->dp_ifindex = ovsh->dp_ifindex;
+
+	return mnl_attr_parse(nlmsg, hdrlen, b1b_ovsdp_vport_attr_cb, vport);
+}
+
+/*
+ * Look up a vport by name.  (If dp_ifindex is 0, the vport can be in any
+ * datapath; its datapath is returned in vport->dp_ifindex.)
+ */
+static int b1b_ovsdp_vport(struct b1b_global_session *const gs,
+			   const char *const name, const int dp_ifindex,
+			   struct b1b_ovsdp_vport *const vport)
+{
+	struct genlmsghdr *genl;
+	struct ovs_header *ovsh;
+
+	mnl_nlmsg_put_header(gs->buf);
+	gs->nlmsg.nlmsg_type = gs->ovs_vport_family;
+	genl = mnl_nlmsg_put_extra_header(&gs->nlmsg, sizeof *genl);
+	genl->cmd = OVS_VPORT_CMD_GET;
+	genl->version = OVS_VPORT_VERSION;
+	ovsh = mnl_nlmsg_put_extra_header(&gs->nlmsg, sizeof *ovsh);
+	ovsh->dp_ifindex = dp_ifindex;
+	mnl_attr_put_strz(&gs->nlmsg, OVS_VPORT_ATTR_NAME, name);
+
+	vport->found = 0;
+
+	if (b1b_genmsg_req(gs, b1b_ovsdp_vport_msg_cb, vport) < 0
+			|| !vport->found) {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ *
+ *	Parse flows
+ *
+ */
+
+static int b1b_ovsdp_key_attr_cb(const struct nlattr *const attr,
+				 void *const data)
+{
+	struct b1b_ovsdp_flow *const flow = data;
+	uint16_t tci;
+
+	switch (mnl_attr_get_type(attr)) {
+
+		case OVS_KEY_ATTR_IN_PORT:
+			if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+				return MNL_CB_ERROR;
+			flow->in_port = mnl_attr_get_u32(attr);
+			flow->has_in_port = 1;
+			break;
+
+		case OVS_KEY_ATTR_ETHERNET:
+			if (mnl_attr_get_payload_len(attr) < sizeof *flow->eth)
+				return MNL_CB_ERROR;
+			flow->eth = mnl_attr_get_payload(attr);
+			break;
+
+		case OVS_KEY_ATTR_VLAN:
+			if (mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
+				return MNL_CB_ERROR;
+			/* Only the outer tag matters */
+			tci = ntohs(mnl_attr_get_u16(attr));
+			if (flow->vlan == 0 && (tci & B1B_VLAN_PRESENT))
+				flow->vlan = tci & B1B_VLAN_VID_MASK;
+			break;
+	}
+
+	return MNL_CB_OK;
+}
+
+static int b1b_ovsdp_mask_attr_cb(const struct nlattr *const attr,
+				  void *const data)
+{
+	struct b1b_ovsdp_flow *const flow = data;
+
+	if (mnl_attr_get_type(attr) != OVS_KEY_ATTR_ETHERNET)
+		return MNL_CB_OK;
+
+	if (mnl_attr_get_payload_len(attr) < sizeof *flow->eth_mask)
+		return MNL_CB_ERROR;
+
+	flow->eth_mask = mnl_attr_get_payload(attr);
+
+	/*
+	 * Don't return MNL_CB_STOP; b1b_ovsdp_flow_attr_cb() returns the result
+	 * of the nested parse, so the rest of the flow (its actions) would be
+	 * skipped.
+	 */
+	return MNL_CB_OK;
+}
+
+static int b1b_ovsdp_action_attr_cb(const struct nlattr *const attr,
+				    void *const data)
+{
+	struct b1b_ovsdp_flow *const flow = data;
+	const struct ovs_action_push_vlan *push;
+
+	if (mnl_attr_get_type(attr) != OVS_ACTION_ATTR_PUSH_VLAN
+			|| flow->has_push_vlan) {
+		return MNL_CB_OK;
+	}
+
+	if (mnl_attr_get_payload_len(attr) < sizeof *push)
+		return MNL_CB_ERROR;
+
+	push = mnl_attr_get_payload(attr);
+	flow->push_vlan = ntohs(push->vlan_tci) & B1B_VLAN_VID_MASK;
+	flow->has_push_vlan = 1;
+
+	return MNL_CB_OK;
+}
+
+static int b1b_ovsdp_flow_attr_cb(const struct nlattr *const attr,
+				  void *const data)
+{
+	switch (mnl_attr_get_type(attr)) {
+
+		case OVS_FLOW_ATTR_KEY:
+			return mnl_attr_parse_nested(attr,
+						     b1b_ovsdp_key_attr_cb,
+						     data);
+
+		case OVS_FLOW_ATTR_MASK:
+			return mnl_attr_parse_nested(attr,
+						     b1b_ovsdp_mask_attr_cb,
+						     data);
+
+		case OVS_FLOW_ATTR_ACTIONS:
+			return mnl_attr_parse_nested(attr,
+						     b1b_ovsdp_action_attr_cb,
+						     data);
+	}
+
+	return MNL_CB_OK;
+}
+
+static int b1b_ovsdp_port_cmp(const void *const p1, const void *const p2)
+{
+	const uint32_t port1 = *(const uint32_t *)p1;
+	const uint32_t port2 = *(const uint32_t *)p2;
+
+	return (port1 > port2) - (port1 < port2);
+}
+
+/* Exported for test/check-ovsdp.c */
+int b1b_ovsdp_flow_msg_cb(const struct nlmsghdr *const nlmsg,
+			  void *const data)
+{
+	static const uint8_t ones[ETH_ALEN] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+	static const uint8_t zeros[ETH_ALEN];
+
+	struct b1b_ovsdp_dump *const dump = data;
+	struct b1b_ovsdp_flow flow;
+	union b1b_fdb_dst dst;
+	size_t hdrlen;
+	int result;
+
+	hdrlen = MNL_ALIGN(sizeof(struct genlmsghdr))
+					+ sizeof(struct ovs_header);
+
+	if (mnl_nlmsg_get_payload_len(nlmsg) < hdrlen)
+		return MNL_CB_ERROR;
+
+	memset(&flow, 0, sizeof flow);
+
+	result = mnl_attr_parse(nlmsg, hdrlen, b1b_ovsdp_flow_attr_cb, &flow);
+	if (result <= MNL_CB_ERROR)
+		return MNL_CB_ERROR;
+
+	++dump->count;
+
+	if (flow.eth == NULL || !flow.has_in_port)
+		return MNL_CB_OK;
+
+	if (flow.in_port == dump->bond_port
+			|| flow.in_port == dump->local_port) {
+		return MNL_CB_OK;
+	}
+
+	/* Flow may belong to another bridge in the same datapath */
+	if (bsearch(&flow.in_port, dump->ports, dump->nports,
+		    sizeof *dump->ports, b1b_ovsdp_port_cmp) == NULL) {
+		return MNL_CB_OK;
+	}
+
+	/* Megaflows may wildcard the source MAC */
+	if (flow.eth_mask != NULL
+			&& memcmp(flow.eth_mask->eth_src, ones,
+				  ETH_ALEN) != 0) {
+		return MNL_CB_OK;
+	}
+
+	/* Skip multicast/broadcast and all-zero source addresses */
+	if ((flow.eth->eth_src[0] & 1)
+			|| memcmp(flow.eth->eth_src, zeros, ETH_ALEN) == 0) {
+		return MNL_CB_OK;
+	}
+
+	memcpy(dst.dst.mac, flow.eth->eth_src, ETH_ALEN);
+	dst.dst.vlan = flow.vlan != 0 ? flow.vlan : flow.push_vlan;
+
+	b1b_fdb_add(dump->bs, dst);
+
+	return MNL_CB_OK;
+}
+
+
+/*
+ *
+ *	Get destinations from the datapath flow table
+ *
+ */
+
+/*
+ * Add the source MAC addresses (and VLANs) of datapath flows that entered via
+ * one of the bridge's other ports (not the bond or the bridge's internal port)
+ * to the bond's destination tree.  Returns -1 (after logging the reason) on
+ * failure.
+ */
+int b1b_ovsdp_get_fdb(struct b1b_global_session *const gs,
+		      struct b1b_bond_session *const bs)
+{
+	struct b1b_ovsdp_vport vport;
+	struct b1b_ovsdp_dump dump;
+	struct genlmsghdr *genl;
+	struct ovs_header *ovsh;
+	uint32_t *ports;
+	int dp_ifindex;
+	int result;
+
+	if (gs->gensock == NULL)
+		b1b_gensock_open(gs);
+
+	if (gs->ovs_flow_family == 0 || gs->ovs_vport_family == 0) {
+
+		gs->ovs_flow_family = b1b_genl_family(gs, OVS_FLOW_FAMILY);
+		gs->ovs_vport_family = b1b_genl_family(gs, OVS_VPORT_FAMILY);
+
+		if (gs->ovs_flow_family == 0 || gs->ovs_vport_family == 0) {
+			B1B_ERR("OVS datapath generic netlink families not "
+					"found (openvswitch module not "
+					"loaded?)");
+			return -1;
+		}
+	}
+
+	/* Port numbers may change if ovs-vswitchd restarts, so don't cache */
+	if (b1b_ovsdp_vport(gs, bs->ifname, 0, &vport) < 0) {
+		B1B_ERR("Failed to find OVS datapath port: %s", bs->ifname);
+		return -1;
+	}
+
+	memset(&dump, 0, sizeof dump);
+	dump.bs = bs;
+	dump.bond_port = vport.port_no;
+	dump.local_port = UINT32_MAX;
+	dp_ifindex = vport.dp_ifindex;
+
+	dump.nports = b1b_ovs_br_dpports(gs, bs->brname, &ports);
+	if (dump.nports == 0) {
+		B1B_ERR("OVS datapath ports of bridge unknown: %s", bs->brname);
+		free(ports);
+		return -1;
+	}
+
+	qsort(ports, dump.nports, sizeof *ports, b1b_ovsdp_port_cmp);
+	dump.ports = ports;
+
+	if (b1b_ovsdp_vport(gs, bs->brname, dp_ifindex, &vport) == 0)
+		dump.local_port = vport.port_no;
+
+	mnl_nlmsg_put_header(gs->buf);
+	gs->nlmsg.nlmsg_type = gs->ovs_flow_family;
+	gs->nlmsg.nlmsg_flags = NLM_F_DUMP;
+	genl = mnl_nlmsg_put_extra_header(&gs->nlmsg, sizeof *genl);
+	genl->cmd = OVS_FLOW_CMD_GET;
+	genl->version = OVS_FLOW_VERSION;
+	ovsh = mnl_nlmsg_put_extra_header(&gs->nlmsg, sizeof *ovsh);
+	ovsh->dp_ifindex = dp_ifindex;
+
+	result = b1b_genmsg_req(gs, b1b_ovsdp_flow_msg_cb, &dump);
+	free(ports);
+
+	if (result < 0) {
+		B1B_ERR("Failed to dump OVS datapath flows: %s", bs->brname);
+		return -1;
+	}
+
+	B1B_DEBUG("Parsed %u OVS datapath flow(s) for %s (port %" PRIu32 ")",
+		  dump.count, bs->ifname, dump.bond_port);
+
+	return 0;
+}
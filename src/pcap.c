@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	pcap.c - write "sent" frames to a pcap file (-f/--pcap)
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "b1b.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+
+
+/*
+ * Classic pcap format (nanosecond timestamps), which tcpdump, Wireshark, etc.
+ * can read.  Frames are written exactly as they would have been sent, so
+ * they are not padded to the Ethernet minimum.  Worker threads can also write
+ * frames, so writes are serialized.
+ */
+
+#define B1B_PCAP_MAGIC_NS	0xa1b23c4d
+#define B1B_PCAP_LINKTYPE_ETH	1
+
+struct b1b_pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct b1b_pcap_rec_hdr {
+	uint32_t sec;
+	uint32_t nsec;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+static FILE *b1b_pcap_file;
+static pthread_mutex_t b1b_pcap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t b1b_pcap_frames;
+
+
+void b1b_pcap_open(void)
+{
+	static const struct b1b_pcap_file_hdr hdr = {
+		.magic		= B1B_PCAP_MAGIC_NS,
+		.version_major	= 2,
+		.version_minor	= 4,
+		.snaplen	= 65535,
+		.linktype	= B1B_PCAP_LINKTYPE_ETH
+	};
+
+	if (b1b_pcap_path == NULL)
+		return;
+
+	if ((b1b_pcap_file = fopen(b1b_pcap_path, "we")) == NULL)
+		B1B_FATAL("Failed to open pcap file: %s: %m", b1b_pcap_path);
+
+	if (fwrite(&hdr, sizeof hdr, 1, b1b_pcap_file) != 1)
+		B1B_FATAL("Failed to write pcap file: %s: %m", b1b_pcap_path);
+
+	B1B_INFO("Writing gratuitous ARP frames to %s (not sending them)",
+		 b1b_pcap_path);
+}
+
+void b1b_pcap_close(void)
+{
+	if (b1b_pcap_file == NULL)
+		return;
+
+	if (fclose(b1b_pcap_file) != 0) {
+		B1B_ERR("Failed to write pcap file: %s: %m", b1b_pcap_path);
+	}
+	else {
+		B1B_INFO("Wrote %" PRIu64 " frame(s) to %s", b1b_pcap_frames,
+			 b1b_pcap_path);
+	}
+
+	b1b_pcap_file = NULL;
+}
+
+/* May be called by worker threads */
+void b1b_pcap_write(const void *const frame, const size_t len)
+{
+	struct b1b_pcap_rec_hdr hdr;
+	struct timespec now;
+
+	if (b1b_pcap_file == NULL)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	hdr.sec = now.tv_sec;
+	hdr.nsec = now.tv_nsec;
+	hdr.caplen = hdr.len = len;
+
+	pthread_mutex_lock(&b1b_pcap_mutex);
+
+	if (fwrite(&hdr, sizeof hdr, 1, b1b_pcap_file) != 1
+			|| fwrite(frame, len, 1, b1b_pcap_file) != 1) {
+		B1B_FATAL("Failed to write pcap file: %s: %m", b1b_pcap_path);
+	}
+
+	++b1b_pcap_frames;
+
+	pthread_mutex_unlock(&b1b_pcap_mutex);
+}
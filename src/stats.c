@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	stats.c - failover latency histograms and counters
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#define _GNU_SOURCE  /* for open_memstream() */
+
+#include "b1b.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/*
+ * Statistics are updated when a burst finishes, which may be in a worker
+ * thread, and read by the main thread, so all updates are atomic.  (A reader
+ * may see a histogram that is one sample ahead of its counters, which doesn't
+ * matter.)
+ */
+
+static const char *const b1b_stage_names[B1B_STAGE_COUNT] = {
+	[B1B_STAGE_FDB]		= "fdb",
+	[B1B_STAGE_FIRST]	= "first",
+	[B1B_STAGE_LAST]	= "last"
+};
+
+
+/*
+ *
+ *	Time helpers
+ *
+ */
+
+int64_t b1b_ns_between(const struct timespec *const start,
+		       const struct timespec *const end)
+{
+	return (end->tv_sec - start->tv_sec) * INT64_C(1000000000)
+			+ (end->tv_nsec - start->tv_nsec);
+}
+
+const char *b1b_stage_name(const enum b1b_stage stage)
+{
+	return b1b_stage_names[stage];
+}
+
+
+/*
+ *
+ *	Log-linear histograms
+ *
+ */
+
+/*
+ * Each power of 2 is divided into 2^B1B_HIST_SUB_BITS linear sub-buckets, so
+ * the bucket boundaries are within 25% of any value.
+ */
+unsigned int b1b_hist_bucket(const uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < (1 << B1B_HIST_SUB_BITS))
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+
+	return (msb - B1B_HIST_SUB_BITS + 1) << B1B_HIST_SUB_BITS
+			| ((ns >> (msb - B1B_HIST_SUB_BITS))
+				& ((1 << B1B_HIST_SUB_BITS) - 1));
+}
+
+/* Smallest value that falls into a bucket */
+uint64_t b1b_hist_lower(const unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < (1 << B1B_HIST_SUB_BITS))
+		return bucket;
+
+	shift = (bucket >> B1B_HIST_SUB_BITS) - 1;
+
+	return (uint64_t)((1 << B1B_HIST_SUB_BITS)
+				| (bucket & ((1 << B1B_HIST_SUB_BITS) - 1)))
+			<< shift;
+}
+
+void b1b_hist_add(struct b1b_hist *const hist, int64_t ns)
+{
+	if (ns < 0)
+		ns = 0;
+
+	__atomic_fetch_add(&hist->buckets[b1b_hist_bucket(ns)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum_ns, ns, __ATOMIC_RELAXED);
+
+	if ((uint64_t)ns > __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED))
+		__atomic_store_n(&hist->max_ns, ns, __ATOMIC_RELAXED);
+}
+
+/* Approximate percentile (upper bound of the bucket that contains it) */
+static uint64_t b1b_hist_pct(const struct b1b_hist *const hist,
+			     const unsigned int pct)
+{
+	uint64_t count, target, seen, max;
+	unsigned int i;
+
+	count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+
+	if (count == 0)
+		return 0;
+
+	target = (count * pct + 99) / 100;
+
+	for (i = 0, seen = 0; i < B1B_HIST_BUCKETS - 1; ++i) {
+		seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+		if (seen >= target)
+			break;
+	}
+
+	if (i == B1B_HIST_BUCKETS - 1 || b1b_hist_lower(i + 1) - 1 > max)
+		return max;
+
+	return b1b_hist_lower(i + 1) - 1;
+}
+
+
+/*
+ *
+ *	Record & report
+ *
+ */
+
+void b1b_stats_init(struct b1b_global_session *const gs)
+{
+	unsigned int i;
+
+	for (i = 0; i < gs->bcount; ++i)
+		gs->bonds[i].stats = B1B_ZALLOC(sizeof *gs->bonds[i].stats);
+}
+
+void b1b_stats_free(struct b1b_global_session *const gs)
+{
+	unsigned int i;
+
+	for (i = 0; i < gs->bcount; ++i) {
+		free(gs->bonds[i].stats);
+		gs->bonds[i].stats = NULL;
+	}
+}
+
+/* Log a summary of a failover, with structured fields for -j/--json-log */
+static void b1b_stats_log_burst(const struct b1b_bond_session *const bs,
+				const struct b1b_burst *const burst,
+				const int64_t *const ns)
+{
+	const struct b1b_log_field fields[] = {
+		B1B_LOGF_STR("event", "failover"),
+		B1B_LOGF_STR("bond", bs->ifname),
+		B1B_LOGF_STR("bridge", burst->brname),
+		B1B_LOGF_UINT("destinations", burst->dsts),
+		B1B_LOGF_UINT("frames", burst->sent),
+		B1B_LOGF_UINT("errors", burst->errors),
+		B1B_LOGF_UINT("fdb_bytes", burst->fdb_bytes),
+		B1B_LOGF_INT("fdb_us", ns[B1B_STAGE_FDB] / 1000),
+		/* only if frames were sent */
+		B1B_LOGF_INT("first_us", ns[B1B_STAGE_FIRST] / 1000),
+		B1B_LOGF_INT("last_us", ns[B1B_STAGE_LAST] / 1000)
+	};
+
+	if (burst->sent == 0) {
+		b1b_log_fields(__FILE__, __LINE__, LOG_INFO, fields,
+			       sizeof fields / sizeof fields[0] - 2,
+			       "Failover of %s: %u destination(s), "
+					"no frames sent, %u error(s); "
+					"FDB (%zu bytes) %" PRId64 " us",
+			       bs->ifname, burst->dsts, burst->errors,
+			       burst->fdb_bytes, ns[B1B_STAGE_FDB] / 1000);
+		return;
+	}
+
+	B1B_LOG_FIELDS(LOG_INFO, fields,
+		       "Failover of %s: %u destination(s), %u frame(s) sent, "
+				"%u error(s); FDB (%zu bytes) %" PRId64 " us, "
+				"first frame %" PRId64 " us, last frame %"
+				PRId64 " us",
+		       bs->ifname, burst->dsts, burst->sent, burst->errors,
+		       burst->fdb_bytes, ns[B1B_STAGE_FDB] / 1000,
+		       ns[B1B_STAGE_FIRST] / 1000, ns[B1B_STAGE_LAST] / 1000);
+}
+
+/*
+ * Record a completed burst (end is when its last frame was sent), and log a
+ * summary of the failover.  May be called by worker threads.
+ */
+void b1b_stats_burst(const struct b1b_bond_session *const bs,
+		     const struct b1b_burst *const burst,
+		     const struct timespec *const end)
+{
+	struct b1b_bond_stats *const stats = bs->stats;
+	int64_t ns[B1B_STAGE_COUNT] = { 0 };
+	unsigned int i;
+
+	ns[B1B_STAGE_FDB] = b1b_ns_between(&burst->event, &burst->start);
+	ns[B1B_STAGE_LAST] = b1b_ns_between(&burst->event, end);
+
+	if (burst->sent != 0) {
+		ns[B1B_STAGE_FIRST] = b1b_ns_between(&burst->event,
+						     &burst->first);
+	}
+
+	for (i = 0; i < B1B_STAGE_COUNT; ++i) {
+		/* No first frame (or last frame) if nothing was sent */
+		if (i != B1B_STAGE_FDB && burst->sent == 0)
+			continue;
+		b1b_hist_add(&stats->hist[i], ns[i]);
+	}
+
+	if (burst->sent != 0)
+		b1b_hist_add(&stats->burst, b1b_ns_between(&burst->start, end));
+
+	b1b_hist_add(&stats->size, burst->dsts);
+
+	__atomic_fetch_add(&stats->failovers, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->frames, burst->sent, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->errors, burst->errors, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->dsts, burst->dsts, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->fdb_bytes, burst->fdb_bytes,
+			   __ATOMIC_RELAXED);
+
+	b1b_stats_log_burst(bs, burst, ns);
+}
+
+/* Write the statistics of every bond, one line per bond and stage */
+void b1b_stats_print(FILE *const f, const struct b1b_global_session *const gs)
+{
+	const struct b1b_bond_stats *stats;
+	const struct b1b_hist *hist;
+	unsigned int i, j;
+
+	for (i = 0; i < gs->bcount; ++i) {
+
+		stats = gs->bonds[i].stats;
+
+		fprintf(f, "Statistics for %s: %" PRIu64 " failover(s), %"
+				PRIu64 " frame(s) sent, %" PRIu64 " error(s), %"
+				PRIu64 " destination(s), %" PRIu64
+				" FDB byte(s)\n",
+			gs->bonds[i].ifname,
+			__atomic_load_n(&stats->failovers, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->frames, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->errors, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->dsts, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->fdb_bytes, __ATOMIC_RELAXED));
+
+		for (j = 0; j < B1B_STAGE_COUNT; ++j) {
+
+			hist = &stats->hist[j];
+
+			if (__atomic_load_n(&hist->count,
+					    __ATOMIC_RELAXED) == 0) {
+				continue;
+			}
+
+			fprintf(f, "%s: %s latency (us): p50 %" PRIu64
+					", p90 %" PRIu64 ", p99 %" PRIu64
+					", max %" PRIu64 "\n",
+				gs->bonds[i].ifname, b1b_stage_name(j),
+				b1b_hist_pct(hist, 50) / 1000,
+				b1b_hist_pct(hist, 90) / 1000,
+				b1b_hist_pct(hist, 99) / 1000,
+				__atomic_load_n(&hist->max_ns,
+						__ATOMIC_RELAXED) / 1000);
+		}
+	}
+}
+
+/* Log the statistics of every bond (SIGUSR1) */
+void b1b_stats_log(const struct b1b_global_session *const gs)
+{
+	char *buf, *line, *saveptr;
+	size_t size;
+	FILE *f;
+
+	if ((f = open_memstream(&buf, &size)) == NULL)
+		B1B_FATAL("Failed to create memory stream: %m");
+
+	b1b_stats_print(f, gs);
+
+	if (fclose(f) != 0)
+		B1B_FATAL("Failed to format statistics: %m");
+
+	for (line = strtok_r(buf, "\n", &saveptr); line != NULL;
+					line = strtok_r(NULL, "\n", &saveptr)) {
+		B1B_NOTICE("%s", line);
+	}
+
+	free(buf);
+}
@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	trace.c - netlink trace recording (-t/--trace) and replay (-y/--replay)
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "b1b.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/*
+ * A trace file is a header followed by records, each of which is a
+ * b1b_trace_hdr followed by len bytes of netlink messages, exactly as they
+ * were received.  Everything is in host byte order; traces are meant to be
+ * replayed on the same architecture.
+ *
+ * Multicast messages and replies to netlink requests are recorded in the
+ * order in which they were read, which (since all netlink I/O happens in the
+ * main thread) is the order in which b1b processed them.  A replay with the
+ * same options and bond names makes the same requests in the same order, so
+ * each request consumes the replies that were recorded for it.  Requests are
+ * not sent; frames are not sent either (see b1b_null_xmit).
+ *
+ * Exchanges with ovs-vswitchd (JSON-RPC and OpenFlow) are not recorded, so
+ * OVS bonds can't be replayed realistically.
+ */
+
+static const char b1b_trace_magic[8] = "B1BTRC01";
+
+struct b1b_trace_hdr {
+	uint64_t time_ns;  /* CLOCK_MONOTONIC (kernel timestamp if available) */
+	uint32_t len;
+	uint8_t src;  /* enum b1b_trace_src */
+	uint8_t flags;
+	uint16_t reserved;
+};
+
+/* Record is the first of a multicast batch (one call to b1b_mcast_process) */
+#define B1B_TRACE_F_BATCH	0x01
+
+/* Multicast socket overrun (ENOBUFS); no data */
+#define B1B_TRACE_F_OVERRUN	0x02
+
+static const char *const b1b_trace_srcs[] = {
+	[B1B_TRACE_MCAST]	= "multicast",
+	[B1B_TRACE_ROUTE]	= "request reply",
+	[B1B_TRACE_GENL]	= "generic netlink reply"
+};
+
+static FILE *b1b_trace_file;
+
+/* Replay: header of the next record, if b1b_trace_peeked is set */
+static struct b1b_trace_hdr b1b_trace_next;
+static _Bool b1b_trace_peeked;
+static _Bool b1b_trace_eof;
+
+
+/*
+ *
+ *	Open & close
+ *
+ */
+
+void b1b_trace_open(void)
+{
+	char magic[sizeof b1b_trace_magic];
+
+	if (b1b_trace_path != NULL) {
+
+		if ((b1b_trace_file = fopen(b1b_trace_path, "we")) == NULL) {
+			B1B_FATAL("Failed to open trace file: %s: %m",
+				  b1b_trace_path);
+		}
+
+		if (fwrite(b1b_trace_magic, sizeof magic, 1,
+			   b1b_trace_file) != 1) {
+			B1B_FATAL("Failed to write trace file: %s: %m",
+				  b1b_trace_path);
+		}
+
+		B1B_INFO("Recording netlink messages to %s", b1b_trace_path);
+	}
+	else if (b1b_replay_path != NULL) {
+
+		if ((b1b_trace_file = fopen(b1b_replay_path, "re")) == NULL) {
+			B1B_FATAL("Failed to open trace file: %s: %m",
+				  b1b_replay_path);
+		}
+
+		if (fread(magic, sizeof magic, 1, b1b_trace_file) != 1
+				|| memcmp(magic, b1b_trace_magic,
+					  sizeof magic) != 0) {
+			B1B_FATAL("Not a b1b trace file: %s", b1b_replay_path);
+		}
+
+		B1B_INFO("Replaying netlink messages from %s",
+			 b1b_replay_path);
+	}
+}
+
+void b1b_trace_close(void)
+{
+	if (b1b_trace_file == NULL)
+		return;
+
+	if (fclose(b1b_trace_file) != 0 && b1b_trace_path != NULL)
+		B1B_ERR("Failed to write trace file: %s: %m", b1b_trace_path);
+
+	b1b_trace_file = NULL;
+}
+
+
+/*
+ *
+ *	Record
+ *
+ */
+
+/* time is NULL for "now" */
+void b1b_trace_record(const enum b1b_trace_src src, const _Bool batch,
+		      const struct timespec *const time,
+		      const void *const buf, const ssize_t len)
+{
+	struct b1b_trace_hdr hdr = { .src = src };
+	struct timespec now;
+
+	if (b1b_trace_file == NULL || b1b_replay_path != NULL)
+		return;
+
+	if (time == NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		hdr.time_ns = now.tv_sec * UINT64_C(1000000000) + now.tv_nsec;
+	}
+	else {
+		hdr.time_ns = time->tv_sec * UINT64_C(1000000000)
+				+ time->tv_nsec;
+	}
+
+	if (batch)
+		hdr.flags |= B1B_TRACE_F_BATCH;
+
+	if (len < 0)
+		hdr.flags |= B1B_TRACE_F_OVERRUN;
+	else
+		hdr.len = len;
+
+	if (fwrite(&hdr, sizeof hdr, 1, b1b_trace_file) != 1
+			|| fwrite(buf, 1, hdr.len, b1b_trace_file) != hdr.len) {
+		B1B_ERR("Failed to write trace file: %s: %m: "
+				"Recording stopped",
+			b1b_trace_path);
+		fclose(b1b_trace_file);
+		b1b_trace_file = NULL;
+	}
+}
+
+
+/*
+ *
+ *	Replay
+ *
+ */
+
+/* Returns false at the end of the trace */
+static _Bool b1b_trace_peek(void)
+{
+	if (b1b_trace_peeked)
+		return 1;
+
+	if (b1b_trace_eof)
+		return 0;
+
+	if (fread(&b1b_trace_next, sizeof b1b_trace_next, 1,
+		  b1b_trace_file) != 1) {
+		if (ferror(b1b_trace_file))
+			B1B_FATAL("Failed to read trace file: %m");
+		b1b_trace_eof = 1;
+		return 0;
+	}
+
+	if (b1b_trace_next.src >= B1B_TRACE_SRC_COUNT) {
+		B1B_FATAL("Invalid trace record source: %" PRIu8,
+			  b1b_trace_next.src);
+	}
+
+	b1b_trace_peeked = 1;
+
+	return 1;
+}
+
+static void b1b_trace_skip(void)
+{
+	if (fseek(b1b_trace_file, b1b_trace_next.len, SEEK_CUR) < 0)
+		B1B_FATAL("Failed to read trace file: %m");
+
+	b1b_trace_peeked = 0;
+}
+
+/*
+ * Read the next record into gs->buf, if it is from src.  Otherwise (or if it
+ * starts a new batch, and this isn't the first read of a batch) returns -1,
+ * with errno set to EAGAIN.  An overrun record returns -1 with errno set to
+ * ENOBUFS, as recvmsg() did.
+ */
+ssize_t b1b_trace_read(struct b1b_global_session *const gs,
+		       const enum b1b_trace_src src, const _Bool first)
+{
+	if (!b1b_trace_peek()) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (b1b_trace_next.src != src
+			|| (!first && (b1b_trace_next.flags
+						& B1B_TRACE_F_BATCH))) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	b1b_trace_peeked = 0;
+
+	if (b1b_trace_next.flags & B1B_TRACE_F_OVERRUN) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	if (b1b_trace_next.len > gs->bufsize) {
+		B1B_FATAL("Trace record too large: %" PRIu32 " bytes",
+			  b1b_trace_next.len);
+	}
+
+	if (fread(gs->buf, 1, b1b_trace_next.len, b1b_trace_file)
+						!= b1b_trace_next.len) {
+		B1B_FATAL("Truncated trace file: %s", b1b_replay_path);
+	}
+
+	return b1b_trace_next.len;
+}
+
+/*
+ * Feed every multicast batch in the trace through b1b_mcast_process(), as
+ * fast as possible.  Records that weren't consumed by a request (because the
+ * replay took a different path than the recording) are skipped.
+ */
+void b1b_trace_replay(struct b1b_global_session *const gs)
+{
+	struct timespec start, end;
+	unsigned int batches, skipped;
+	int64_t ns;
+
+	batches = skipped = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (b1b_trace_peek()) {
+
+		if (b1b_trace_next.src != B1B_TRACE_MCAST) {
+			B1B_DEBUG("Skipping unexpected %s record (%" PRIu32
+					" bytes)",
+				  b1b_trace_srcs[b1b_trace_next.src],
+				  b1b_trace_next.len);
+			b1b_trace_skip();
+			++skipped;
+			continue;
+		}
+
+		/* Force the next record to start a batch */
+		b1b_trace_next.flags |= B1B_TRACE_F_BATCH;
+		b1b_mcast_process(gs);
+		++batches;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = b1b_ns_between(&start, &end);
+
+	B1B_NOTICE("Replayed %u multicast batch(es) in %" PRId64 " us",
+		   batches, ns / 1000);
+
+	if (skipped != 0) {
+		B1B_WARN("Skipped %u unexpected record(s); trace may not "
+				"match options or bonds",
+			 skipped);
+	}
+}
@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	uring.c - minimal io_uring wrapper (no liburing dependency)
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#define _GNU_SOURCE  /* for syscall() */
+
+#include "b1b.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+
+struct b1b_uring {
+	/* Submission queue */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_local_tail;  /* SQEs prepared but not yet published */
+	unsigned int to_submit;
+
+	/* Completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	struct io_uring_cqe *cqes;
+	unsigned int cq_mask;
+
+	/* Mappings */
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	int fd;
+};
+
+
+/*
+ *
+ *	System call wrappers
+ *
+ */
+
+static int b1b_uring_setup(const unsigned int entries,
+			   struct io_uring_params *const p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int b1b_uring_enter(const int fd, const unsigned int to_submit,
+			   const unsigned int min_complete,
+			   const unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+static int b1b_uring_register(const int fd, const unsigned int opcode,
+			      const void *const arg, const unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+/*
+ *
+ *	Set up & tear down
+ *
+ */
+
+static void b1b_uring_unmap(struct b1b_uring *const ring)
+{
+	if (ring->sqes != MAP_FAILED && ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqes_size);
+
+	if (ring->cq_ring != ring->sq_ring && ring->cq_ring != MAP_FAILED
+			&& ring->cq_ring != NULL) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+
+	if (ring->sq_ring != MAP_FAILED && ring->sq_ring != NULL)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+}
+
+static void *b1b_uring_mmap(const int fd, const size_t size,
+			    const off_t offset)
+{
+	return mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, offset);
+}
+
+/*
+ * Create an io_uring instance with (at least) the given number of submission
+ * queue entries, and register sock as fixed file 0.  Returns NULL (after
+ * logging a warning) if io_uring is not available.
+ */
+struct b1b_uring *b1b_uring_new(const unsigned int entries, const int sock)
+{
+	struct io_uring_params p;
+	struct b1b_uring *ring;
+	const char *op;
+
+	memset(&p, 0, sizeof p);
+	ring = B1B_ZALLOC(sizeof *ring);
+
+	if ((ring->fd = b1b_uring_setup(entries, &p)) < 0) {
+		B1B_WARN("io_uring not available: %m");
+		free(ring);
+		return NULL;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes
+				+ p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	op = "map submission queue";
+	ring->sq_ring = b1b_uring_mmap(ring->fd, ring->sq_ring_size,
+				       IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto error;
+
+	op = "map completion queue";
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	}
+	else {
+		ring->cq_ring = b1b_uring_mmap(ring->fd, ring->cq_ring_size,
+					       IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+			goto error;
+	}
+
+	op = "map submission queue entries";
+	ring->sqes = b1b_uring_mmap(ring->fd, ring->sqes_size,
+				    IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto error;
+
+	ring->sq_head = (void *)((char *)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (void *)((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_array = (void *)((char *)ring->sq_ring + p.sq_off.array);
+	ring->sq_mask = *(unsigned int *)(void *)((char *)ring->sq_ring
+							+ p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+
+	ring->cq_head = (void *)((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (void *)((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cqes = (void *)((char *)ring->cq_ring + p.cq_off.cqes);
+	ring->cq_mask = *(unsigned int *)(void *)((char *)ring->cq_ring
+							+ p.cq_off.ring_mask);
+
+	op = "register socket";
+	if (b1b_uring_register(ring->fd, IORING_REGISTER_FILES, &sock, 1) < 0)
+		goto error;
+
+	B1B_DEBUG("Created io_uring with %u submission queue entries",
+		  ring->sq_entries);
+
+	return ring;
+
+error:
+	B1B_WARN("io_uring not available: Failed to %s: %m", op);
+	b1b_uring_unmap(ring);
+	close(ring->fd);
+	free(ring);
+	return NULL;
+}
+
+void b1b_uring_free(struct b1b_uring *const ring)
+{
+	b1b_uring_unmap(ring);
+
+	if (close(ring->fd) < 0)
+		B1B_ERR("Failed to close io_uring: %m");
+
+	free(ring);
+}
+
+int b1b_uring_fd(const struct b1b_uring *const ring)
+{
+	return ring->fd;
+}
+
+
+/*
+ *
+ *	Submission
+ *
+ */
+
+/*
+ * Prepare a sendmsg() request on the registered socket.  The caller must not
+ * have more requests outstanding than the number of entries requested when the
+ * ring was created.
+ *
+ * The frame arena isn't registered with IORING_REGISTER_BUFFERS.  Registered
+ * buffers can only be used by sends that are zero-copy (IORING_OP_SEND_ZC or
+ * IORING_OP_SENDMSG_ZC with IORING_RECVSEND_FIXED_BUF), and the kernel only
+ * supports zero-copy sends on TCP and UDP sockets (SOCK_SUPPORT_ZC); AF_PACKET
+ * sends fail with EOPNOTSUPP.  (For 42-46 byte frames, the copy is also much
+ * cheaper than the page pinning that zero-copy requires.)
+ *
+ * The ring is only used for sends.  Multishot receive (IORING_OP_RECVMSG with
+ * IORING_RECV_MULTISHOT) could be used for the netlink sockets, but it needs a
+ * provided buffer ring (Linux 6.0 or later), and neither socket is on a hot
+ * path.  The multicast socket gets one RTNLGRP_LINK message per link change,
+ * read (with its kernel timestamp) by a single recvmsg() per epoll wake-up,
+ * and dump responses are read by libmnl in b1b_nlmsg_req(), whose receive loop
+ * would have to be replaced.
+ */
+void b1b_uring_sendmsg(struct b1b_uring *const ring,
+		       const struct msghdr *const msg, const uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int index;
+
+	B1B_ASSERT(ring->sq_local_tail
+			- __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)
+				< ring->sq_entries);
+
+	index = ring->sq_local_tail & ring->sq_mask;
+	sqe = ring->sqes + index;
+
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;  /* index of registered socket */
+	sqe->addr = (uintptr_t)msg;
+	sqe->len = 1;
+	sqe->user_data = user_data;
+
+	ring->sq_array[index] = index;
+	++ring->sq_local_tail;
+	++ring->to_submit;
+}
+
+/*
+ * Submit all prepared requests.  If wait is true, also wait for at least one
+ * completion.
+ */
+void b1b_uring_submit(struct b1b_uring *const ring, const _Bool wait)
+{
+	unsigned int flags;
+	int result;
+
+	if (ring->to_submit == 0 && !wait)
+		return;
+
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+	do {
+		result = b1b_uring_enter(ring->fd, ring->to_submit, wait,
+					 flags);
+	} while (result < 0 && errno == EINTR);
+
+	if (result < 0)
+		B1B_FATAL("Failed to submit io_uring requests: %m");
+
+	ring->to_submit -= result;
+}
+
+
+/*
+ *
+ *	Completion
+ *
+ */
+
+/*
+ * Get the next completion, if any.  Returns false if the completion queue is
+ * empty.
+ */
+_Bool b1b_uring_reap(struct b1b_uring *const ring, uint64_t *const user_data,
+		     int32_t *const res)
+{
+	const struct io_uring_cqe *cqe;
+	unsigned int head;
+
+	head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+
+	cqe = ring->cqes + (head & ring->cq_mask);
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	worker.c - transmit worker threads
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "b1b.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+/*
+ * Each worker has a single-producer, single-consumer ring of bonds that have
+ * bursts waiting for it.  The main thread is the only producer, and the worker
+ * is the only consumer, so no locks are needed.  Each bond is always handed to
+ * the same worker, so bursts for each bond are sent in order.
+ *
+ * A bond has at most one waiting burst (in its job slot), and it is only in
+ * the ring while it has one, so the ring (sized for the worker's share of the
+ * bonds) can never overflow.  A new burst for a bond replaces any burst that
+ * is still waiting, and a burst that is in progress is abandoned as soon as a
+ * newer one is waiting, just as the main thread does (see b1b_send_garps()).
+ * Frames from an old burst, which may be addressed to the previous active
+ * slave (-s/--slave-xmit), are never sent after frames from a newer one.
+ */
+
+struct b1b_job {
+	const struct b1b_bond_session *bs;
+	struct b1b_burst burst;
+};
+
+struct b1b_worker {
+	unsigned int *ring;  /* jobs indices of bonds with waiting bursts */
+	_Atomic(struct b1b_job *) *jobs;  /* waiting burst of each bond */
+	unsigned int mask;  /* ring size - 1 (ring size is a power of 2) */
+	atomic_uint head;  /* next bond to consume (worker) */
+	atomic_uint tail;  /* next free slot (main thread) */
+	atomic_bool exit_flag;
+	pthread_t thread;
+	unsigned int index;
+	struct b1b_xmit xmit;
+	int efd;  /* eventfd; wakes the worker when jobs are added */
+};
+
+
+/*
+ *
+ *	Job ring
+ *
+ */
+
+static void b1b_ring_push(struct b1b_worker *const w, const unsigned int slot)
+{
+	unsigned int head, tail;
+
+	tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&w->head, memory_order_acquire);
+
+	/* Each bond is in the ring at most once */
+	B1B_ASSERT(tail - head <= w->mask);
+
+	w->ring[tail & w->mask] = slot;
+	atomic_store_explicit(&w->tail, tail + 1, memory_order_release);
+}
+
+/* Returns the next bond's job slot index, or -1 if the ring is empty */
+static int b1b_ring_pop(struct b1b_worker *const w)
+{
+	unsigned int head, tail, slot;
+
+	head = atomic_load_explicit(&w->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+
+	if (head == tail)
+		return -1;
+
+	slot = w->ring[head & w->mask];
+	atomic_store_explicit(&w->head, head + 1, memory_order_release);
+
+	return slot;
+}
+
+
+/*
+ *
+ *	Worker thread
+ *
+ */
+
+static void b1b_worker_burst(struct b1b_worker *const w,
+			     struct b1b_job *const job, const unsigned int slot)
+{
+	int result;
+
+	while ((result = b1b_garp_burst(&w->xmit, job->bs, &job->burst))) {
+
+		/* Don't keep sending an old burst when a newer one waits */
+		if (atomic_load(&w->jobs[slot]) != NULL) {
+			B1B_WARN("Abandoning incomplete burst for %s: "
+					"%u frames sent",
+				 job->bs->ifname, job->burst.sent);
+			b1b_garp_orphan(&w->xmit, &job->burst);
+			b1b_fdb_free(&job->burst.fdbtree);
+			return;
+		}
+
+		b1b_xmit_wait(&w->xmit, result);
+	}
+}
+
+static void *b1b_worker_main(void *const arg)
+{
+	struct b1b_worker *const w = arg;
+	struct b1b_job *job;
+	uint64_t count;
+	int slot;
+
+	B1B_DEBUG("Transmit worker %u started", w->index);
+
+	while (1) {
+
+		while ((slot = b1b_ring_pop(w)) >= 0) {
+			/* Only this thread empties slots; it can't be empty */
+			job = atomic_exchange(&w->jobs[slot], NULL);
+			B1B_ASSERT(job != NULL);
+			b1b_worker_burst(w, job, slot);
+			free(job);
+		}
+
+		if (atomic_load(&w->exit_flag))
+			break;
+
+		/* eventfd counter persists, so wake-ups can't be lost */
+		if (read(w->efd, &count, sizeof count) < 0 && errno != EINTR)
+			B1B_FATAL("Failed to read worker eventfd: %m");
+	}
+
+	B1B_DEBUG("Transmit worker %u exiting", w->index);
+
+	return NULL;
+}
+
+static void b1b_worker_wake(struct b1b_worker *const w)
+{
+	static const uint64_t one = 1;
+
+	if (write(w->efd, &one, sizeof one) < 0)
+		B1B_FATAL("Failed to wake transmit worker %u: %m", w->index);
+}
+
+
+/*
+ *
+ *	Start & stop workers (main thread)
+ *
+ */
+
+void b1b_workers_start(struct b1b_global_session *const gs)
+{
+	unsigned int i, nbonds, size;
+	struct b1b_worker *w;
+	int result;
+
+	if (b1b_nworkers == 0)
+		return;
+
+	/* More workers than bonds would never be used */
+	gs->wcount = b1b_nworkers < gs->bcount ? b1b_nworkers : gs->bcount;
+	gs->workers = B1B_ZALLOC(gs->wcount * sizeof *gs->workers);
+
+	/* Bonds per worker (rounded up), and ring size to hold them all */
+	nbonds = (gs->bcount + gs->wcount - 1) / gs->wcount;
+	for (size = 1; size < nbonds; size *= 2)
+		;
+
+	for (i = 0; i < gs->wcount; ++i) {
+
+		w = gs->workers + i;
+		w->index = i;
+		w->ring = B1B_ZALLOC(size * sizeof *w->ring);
+		w->jobs = B1B_ZALLOC(nbonds * sizeof *w->jobs);
+		w->mask = size - 1;
+		b1b_xmit_init(&w->xmit);
+
+		if ((w->efd = eventfd(0, EFD_CLOEXEC)) < 0)
+			B1B_FATAL("Failed to create worker eventfd: %m");
+
+		result = pthread_create(&w->thread, NULL, b1b_worker_main, w);
+		if (result != 0) {
+			B1B_FATAL("Failed to create transmit worker: %s",
+				  strerror(result));
+		}
+	}
+
+	B1B_INFO("Started %u transmit worker(s)", gs->wcount);
+}
+
+void b1b_workers_stop(struct b1b_global_session *const gs)
+{
+	struct b1b_worker *w;
+	unsigned int i;
+	int result;
+
+	for (i = 0; i < gs->wcount; ++i) {
+		w = gs->workers + i;
+		atomic_store(&w->exit_flag, 1);
+		b1b_worker_wake(w);
+	}
+
+	for (i = 0; i < gs->wcount; ++i) {
+
+		w = gs->workers + i;
+
+		if ((result = pthread_join(w->thread, NULL)) != 0) {
+			B1B_ERR("Failed to join transmit worker %u: %s",
+				i, strerror(result));
+		}
+
+		b1b_xmit_fini(&w->xmit);
+
+		if (close(w->efd) < 0)
+			B1B_ERR("Failed to close worker eventfd: %m");
+
+		/* Worker has sent every waiting burst */
+		free(w->ring);
+		free(w->jobs);
+	}
+
+	free(gs->workers);
+	gs->workers = NULL;
+	gs->wcount = 0;
+}
+
+
+/*
+ *
+ *	Hand a burst to a worker (main thread)
+ *
+ */
+
+/*
+ * Returns true if the burst was handed to a worker, which now owns its
+ * destination tree, or false if there are no workers.  Any burst for the same
+ * bond that the worker hasn't started yet is discarded.
+ */
+_Bool b1b_worker_submit(struct b1b_global_session *const gs,
+			const struct b1b_bond_session *const bs,
+			const struct b1b_burst *const burst)
+{
+	struct b1b_job *job, *old;
+	struct b1b_worker *w;
+	unsigned int slot;
+
+	if (gs->wcount == 0)
+		return 0;
+
+	w = gs->workers + (bs - gs->bonds) % gs->wcount;
+	slot = (bs - gs->bonds) / gs->wcount;
+
+	job = B1B_ZALLOC(sizeof *job);
+	job->bs = bs;
+	job->burst = *burst;
+
+	/* If a burst was still waiting, the bond is already in the ring */
+	if ((old = atomic_exchange(&w->jobs[slot], job)) != NULL) {
+		B1B_WARN("Discarding waiting burst for %s: superseded",
+			 bs->ifname);
+		b1b_fdb_free(&old->burst.fdbtree);
+		free(old);
+		return 1;
+	}
+
+	b1b_ring_push(w, slot);
+	b1b_worker_wake(w);
+
+	return 1;
+}
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	bench-fdb.c - destination tree insertion, iteration & freeing
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+/*
+ * Usage: bench-fdb [ENTRIES ...]
+ *
+ * Variants:
+ *
+ *	add		b1b_fdb_add() of each destination, into an empty tree
+ *	iterate		walk the tree (as a burst does)
+ *	free		b1b_fdb_free()
+ */
+
+#include "bench.h"
+
+
+int main(int argc, char **argv)
+{
+	struct b1b_bench add = { 0 }, iter = { 0 }, fr = { 0 };
+	struct b1b_global_session *gs;
+	struct b1b_bond_session *bs;
+	const struct b1b_dst_node *dn;
+	unsigned int *sizes, nsizes, i, r, reps;
+	struct savl_node *node;
+	volatile uint64_t sum;
+	uint64_t s;
+
+	nsizes = b1b_bench_init(argc, argv, &sizes);
+
+	gs = b1b_bench_gs();
+	bs = b1b_bench_bond(gs);
+
+	for (i = 0; i < nsizes; ++i) {
+
+		reps = b1b_bench_reps(sizes[i]);
+
+		for (r = 0; r < reps; ++r) {
+
+			b1b_bench_start(&add);
+			b1b_bench_fdb(bs, sizes[i]);
+			b1b_bench_stop(&add);
+
+			b1b_bench_start(&iter);
+			s = 0;
+			for (node = savl_first(bs->fdbtree); node != NULL;
+						node = savl_next(node)) {
+				dn = SAVL_NODE_CONTAINER(node,
+							 struct b1b_dst_node,
+							 avl);
+				s += dn->dst.u64;
+			}
+			b1b_bench_stop(&iter);
+			sum = s;
+
+			if (r == 0)
+				b1b_bench_check(bs, sizes[i]);
+
+			b1b_bench_start(&fr);
+			b1b_fdb_free(&bs->fdbtree);
+			b1b_bench_stop(&fr);
+		}
+
+		b1b_bench_report(&add, "fdb", "add", sizes[i], reps);
+		b1b_bench_report(&iter, "fdb", "iterate", sizes[i], reps);
+		b1b_bench_report(&fr, "fdb", "free", sizes[i], reps);
+	}
+
+	(void)sum;
+
+	b1b_bench_fini();
+	return 0;
+}
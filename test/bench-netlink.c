@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	bench-netlink.c - Linux bridge FDB dump processing
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+/*
+ * Usage: bench-netlink [ENTRIES ...]
+ *
+ * Runs b1b_br_fdb_msg_cb() (via mnl_cb_run(), as b1b_nlmsg_req() does) over a
+ * synthetic RTM_NEWNEIGH dump, in the same form as the kernel's, of ENTRIES
+ * forwarding database entries.  Variants:
+ *
+ *	new		entries on another bridge port, each added to the
+ *			destination tree
+ *	skip		entries on the bond's own port, which are parsed no
+ *			further than the ndmsg header
+ *
+ * Only processing is measured; the dump is built (and the destination tree
+ * freed) outside of the timed sections.
+ */
+
+#include "bench.h"
+
+#include <linux/neighbour.h>
+#include <linux/rtnetlink.h>
+
+
+/* Message header, ndmsg, NDA_LLADDR, NDA_VLAN & NDA_MASTER */
+#define B1B_BENCH_NEIGH_SIZE	64
+
+static size_t b1b_bench_dump(char *const buf,
+			     const struct b1b_bond_session *const bs,
+			     const unsigned int entries, const int32_t ifindex)
+{
+	struct nlmsghdr *nlmsg;
+	union b1b_fdb_dst dst;
+	struct ndmsg *ndm;
+	unsigned int i;
+	size_t len;
+
+	for (i = 0, len = 0; i < entries; ++i) {
+
+		dst = b1b_bench_dst(i);
+
+		nlmsg = mnl_nlmsg_put_header(buf + len);
+		nlmsg->nlmsg_type = RTM_NEWNEIGH;
+		nlmsg->nlmsg_flags = NLM_F_MULTI;
+
+		ndm = mnl_nlmsg_put_extra_header(nlmsg, sizeof *ndm);
+		ndm->ndm_family = AF_BRIDGE;
+		ndm->ndm_ifindex = ifindex;
+		ndm->ndm_state = NUD_REACHABLE;
+		ndm->ndm_flags = NTF_MASTER;
+
+		mnl_attr_put(nlmsg, NDA_LLADDR, sizeof dst.dst.mac,
+			     dst.dst.mac);
+		if (dst.dst.vlan != 0)
+			mnl_attr_put_u16(nlmsg, NDA_VLAN, dst.dst.vlan);
+		mnl_attr_put_u32(nlmsg, NDA_MASTER, bs->brindex);
+
+		len += MNL_ALIGN(nlmsg->nlmsg_len);
+	}
+
+	nlmsg = mnl_nlmsg_put_header(buf + len);
+	nlmsg->nlmsg_type = NLMSG_DONE;
+	nlmsg->nlmsg_flags = NLM_F_MULTI;
+
+	return len + MNL_ALIGN(nlmsg->nlmsg_len);
+}
+
+static void b1b_bench_netlink(struct b1b_bond_session *const bs,
+			      const char *const variant, const int32_t ifindex,
+			      const _Bool expected,
+			      const unsigned int *const sizes,
+			      const unsigned int nsizes)
+{
+	struct b1b_bench b = { 0 };
+	unsigned int i, r, reps;
+	size_t len;
+	char *buf;
+
+	for (i = 0; i < nsizes; ++i) {
+
+		buf = B1B_ZALLOC((sizes[i] + 1) * B1B_BENCH_NEIGH_SIZE);
+		len = b1b_bench_dump(buf, bs, sizes[i], ifindex);
+		reps = b1b_bench_reps(sizes[i]);
+
+		for (r = 0; r < reps; ++r) {
+
+			b1b_bench_start(&b);
+			if (mnl_cb_run(buf, len, 0, 0, b1b_br_fdb_msg_cb, bs)
+							!= MNL_CB_STOP) {
+				B1B_FATAL("Failed to process dump");
+			}
+			b1b_bench_stop(&b);
+
+			if (r == 0)
+				b1b_bench_check(bs, expected ? sizes[i] : 0);
+
+			b1b_fdb_free(&bs->fdbtree);
+		}
+
+		b1b_bench_report(&b, "netlink", variant, sizes[i], reps);
+		free(buf);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct b1b_global_session *gs;
+	struct b1b_bond_session *bs;
+	unsigned int *sizes, nsizes;
+
+	nsizes = b1b_bench_init(argc, argv, &sizes);
+
+	gs = b1b_bench_gs();
+	bs = b1b_bench_bond(gs);
+
+	/* Another port of the bridge (whose index is bs->brindex) */
+	b1b_bench_netlink(bs, "new", bs->brindex + 1, 1, sizes, nsizes);
+	b1b_bench_netlink(bs, "skip", bs->ifindex, 0, sizes, nsizes);
+
+	b1b_bench_fini();
+	return 0;
+}
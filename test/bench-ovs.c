@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	bench-ovs.c - Open vSwitch fdb/show response processing
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+/*
+ * Usage: bench-ovs [ENTRIES ...]
+ *
+ * Processes synthetic ovs-vswitchd fdb/show output (in the same format as
+ * ovs-vswitchd and mock-ovs) of ENTRIES forwarding database entries, none of
+ * which are on the bond's port.  Variants:
+ *
+ *	parse		b1b_ovs_parse_fdb() of the result text
+ *	jsonrpc		b1b_jsonrpc_scan() of the complete JSON-RPC response
+ *			(decoding the result string in place), then
+ *			b1b_ovs_parse_fdb()
+ *
+ * Building the response, copying it for each repetition (since it is decoded
+ * in place), and freeing the destination tree aren't measured.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/* Longest fdb/show line, with room for JSON escaping */
+#define B1B_BENCH_OVS_LINE	64
+
+/* Result text; lines end with "\n", or "\\n" (JSON-escaped) if json is set */
+static size_t b1b_bench_fdb_show(char *const buf, const unsigned int entries,
+				 const _Bool json)
+{
+	const char *const nl = json ? "\\n" : "\n";
+	union b1b_fdb_dst dst;
+	unsigned int i;
+	size_t len;
+
+	len = sprintf(buf, " port  VLAN  MAC                Age%s", nl);
+
+	for (i = 0; i < entries; ++i) {
+
+		dst = b1b_bench_dst(i);
+
+		/* Bond is on port 1; others are 2 - 5 */
+		len += sprintf(buf + len, "%5u  %4" PRIu16 "  %02" PRIx8 ":%02"
+					PRIx8 ":%02" PRIx8 ":%02" PRIx8 ":%02"
+					PRIx8 ":%02" PRIx8 "  %3u%s",
+			       i % 4 + 2, dst.dst.vlan, dst.dst.mac[0],
+			       dst.dst.mac[1], dst.dst.mac[2], dst.dst.mac[3],
+			       dst.dst.mac[4], dst.dst.mac[5], i % 300, nl);
+	}
+
+	len += sprintf(buf + len, "LOCAL     0  02:00:ff:ff:ff:ff    0%s", nl);
+
+	return len;
+}
+
+static size_t b1b_bench_resp(char *const buf, const unsigned int entries)
+{
+	size_t len;
+
+	len = sprintf(buf, "{\"id\":1,\"result\":\"");
+	len += b1b_bench_fdb_show(buf + len, entries, 1);
+	len += sprintf(buf + len, "\",\"error\":null}");
+
+	return len;
+}
+
+static void b1b_bench_ovs(struct b1b_bond_session *const bs,
+			  const _Bool json, const unsigned int *const sizes,
+			  const unsigned int nsizes)
+{
+	struct b1b_jsonrpc_resp resp;
+	struct b1b_bench b = { 0 };
+	unsigned int i, r, reps;
+	char *src, *buf;
+	size_t len;
+	int result;
+
+	for (i = 0; i < nsizes; ++i) {
+
+		src = B1B_ZALLOC((sizes[i] + 2) * B1B_BENCH_OVS_LINE);
+		buf = B1B_ZALLOC((sizes[i] + 2) * B1B_BENCH_OVS_LINE);
+
+		if (json)
+			len = b1b_bench_resp(src, sizes[i]);
+		else
+			len = b1b_bench_fdb_show(src, sizes[i], 0);
+
+		reps = b1b_bench_reps(sizes[i]);
+
+		for (r = 0; r < reps; ++r) {
+
+			memcpy(buf, src, len);
+
+			b1b_bench_start(&b);
+
+			if (json) {
+				if (b1b_jsonrpc_scan(buf, len, &resp) != 0)
+					B1B_FATAL("Failed to scan response");
+				result = b1b_ovs_parse_fdb(bs, resp.result,
+							   resp.len);
+			}
+			else {
+				result = b1b_ovs_parse_fdb(bs, buf, len);
+			}
+
+			if (result < 0)
+				B1B_FATAL("Failed to parse result");
+
+			b1b_bench_stop(&b);
+
+			if (r == 0)
+				b1b_bench_check(bs, sizes[i]);
+
+			b1b_fdb_free(&bs->fdbtree);
+		}
+
+		b1b_bench_report(&b, "ovs", json ? "jsonrpc" : "parse",
+				 sizes[i], reps);
+
+		free(src);
+		free(buf);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct b1b_global_session *gs;
+	struct b1b_bond_session *bs;
+	unsigned int *sizes, nsizes;
+
+	nsizes = b1b_bench_init(argc, argv, &sizes);
+
+	gs = b1b_bench_gs();
+	bs = b1b_bench_bond(gs);
+	bs->brtype = B1B_BR_TYPE_OVS;
+	bs->ofport = 1;
+
+	b1b_bench_ovs(bs, 0, sizes, nsizes);
+	b1b_bench_ovs(bs, 1, sizes, nsizes);
+
+	b1b_bench_fini();
+	return 0;
+}
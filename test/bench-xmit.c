@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	bench-xmit.c - gratuitous ARP burst cost, by transmit backend
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+/*
+ * Usage: bench-xmit [ENTRIES ...]
+ *
+ * Sends complete bursts (in the calling thread, as a worker does) via the
+ * interface named by $B1B_BENCH_IF (default "lo").  Variants:
+ *
+ *	null		frame construction only (-n/--dry-run)
+ *	sendto		one sendto() per frame
+ *	io_uring	batched IORING_OP_SENDMSG (-u/--io-uring)
+ *
+ * If $B1B_BENCH_BOND names an active-backup bond, two more variants (both with
+ * one sendto() per frame) compare sending via the bond with sending directly
+ * via its active slave (-s/--slave-xmit):
+ *
+ *	bond		frames sent via the bond
+ *	slave		frames sent via the bond's active slave
+ *
+ * The variants that send frames require CAP_NET_RAW; they are skipped (with a
+ * message on stderr) if an AF_PACKET socket can't be created, or if io_uring
+ * isn't available.  Building the destination tree isn't measured.
+ */
+
+#include "bench.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <net/if.h>
+
+
+static _Bool b1b_bench_can_xmit(void)
+{
+	int fd;
+
+	if ((fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0) {
+		B1B_WARN("Skipping variants that send frames: %m");
+		return 0;
+	}
+
+	close(fd);
+	return 1;
+}
+
+static int32_t b1b_bench_ifindex(const char *const ifname)
+{
+	unsigned int ifindex;
+
+	if ((ifindex = if_nametoindex(ifname)) == 0)
+		B1B_FATAL("Failed to get index of %s: %m", ifname);
+
+	return ifindex;
+}
+
+/* Index of a bond's active slave (from sysfs) */
+static int32_t b1b_bench_active_slave(const char *const bond)
+{
+	char path[sizeof "/sys/class/net//bonding/active_slave" + IFNAMSIZ];
+	char slave[IFNAMSIZ + 1];
+	FILE *fp;
+
+	snprintf(path, sizeof path, "/sys/class/net/%s/bonding/active_slave",
+		 bond);
+
+	if ((fp = fopen(path, "re")) == NULL)
+		B1B_FATAL("Failed to open %s: %m", path);
+
+	if (fgets(slave, sizeof slave, fp) == NULL)
+		slave[0] = 0;
+
+	fclose(fp);
+
+	slave[strcspn(slave, "\n")] = 0;
+	if (slave[0] == 0)
+		B1B_FATAL("Bond has no active slave: %s", bond);
+
+	return b1b_bench_ifindex(slave);
+}
+
+/*
+ * Frames are sent via ifindex (the burst's interface).  Variants other than
+ * null and io_uring use sendto().
+ */
+static void b1b_bench_xmit(struct b1b_bond_session *const bs,
+			   const char *const variant, const int32_t ifindex,
+			   const unsigned int *const sizes,
+			   const unsigned int nsizes)
+{
+	struct b1b_bench b = { 0 };
+	struct b1b_burst burst;
+	struct b1b_xmit xmit;
+	unsigned int i, r, reps;
+	int result;
+
+	b1b_null_xmit = (strcmp(variant, "null") == 0);
+	b1b_io_uring = (strcmp(variant, "io_uring") == 0);
+
+	b1b_xmit_init(&xmit);
+
+	if (b1b_io_uring && xmit.uring == NULL) {
+		B1B_WARN("Skipping io_uring variant");
+		b1b_xmit_fini(&xmit);
+		return;
+	}
+
+	for (i = 0; i < nsizes; ++i) {
+
+		reps = b1b_bench_reps(sizes[i]);
+
+		for (r = 0; r < reps; ++r) {
+
+			b1b_bench_burst(bs, &burst, sizes[i]);
+			burst.ifindex = ifindex;
+
+			b1b_bench_start(&b);
+			while ((result = b1b_garp_burst(&xmit, bs, &burst)))
+				b1b_xmit_wait(&xmit, result);
+			b1b_bench_stop(&b);
+		}
+
+		b1b_bench_report(&b, "xmit", variant, sizes[i], reps);
+	}
+
+	b1b_xmit_fini(&xmit);
+}
+
+int main(int argc, char **argv)
+{
+	struct b1b_global_session *gs;
+	struct b1b_bond_session *bs;
+	unsigned int *sizes, nsizes;
+	const char *ifname, *bond;
+	int32_t slave;
+
+	nsizes = b1b_bench_init(argc, argv, &sizes);
+
+	gs = b1b_bench_gs();
+	bs = b1b_bench_bond(gs);
+
+	if ((ifname = getenv("B1B_BENCH_IF")) == NULL)
+		ifname = "lo";
+	bs->ifindex = b1b_bench_ifindex(ifname);
+
+	b1b_bench_xmit(bs, "null", bs->ifindex, sizes, nsizes);
+
+	if (!b1b_bench_can_xmit()) {
+		b1b_bench_fini();
+		return 0;
+	}
+
+	b1b_bench_xmit(bs, "sendto", bs->ifindex, sizes, nsizes);
+	b1b_bench_xmit(bs, "io_uring", bs->ifindex, sizes, nsizes);
+
+	/* The bond is the fallback if the active slave goes away */
+	if ((bond = getenv("B1B_BENCH_BOND")) != NULL) {
+		slave = b1b_bench_active_slave(bond);
+		bs->ifindex = b1b_bench_ifindex(bond);
+		b1b_bench_xmit(bs, "bond", bs->ifindex, sizes, nsizes);
+		b1b_bench_xmit(bs, "slave", slave, sizes, nsizes);
+	}
+
+	b1b_bench_fini();
+	return 0;
+}
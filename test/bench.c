@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	bench.c - microbenchmark helpers
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#include "bench.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each benchmark processes (roughly) this many entries per size */
+#define B1B_BENCH_TARGET	1000000
+#define B1B_BENCH_MIN_REPS	5
+
+static unsigned int b1b_bench_sizes[] = { 100, 1000, 10000, 100000 };
+
+
+/*
+ *
+ *	Allocation counting
+ *
+ */
+
+/*
+ * Interpose the allocator (glibc only).  Allocations in all threads are
+ * counted, so benchmarks should run without workers.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_uint_fast64_t b1b_bench_nallocs;
+
+void *malloc(const size_t size)
+{
+	atomic_fetch_add_explicit(&b1b_bench_nallocs, 1, memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+void *calloc(const size_t nmemb, const size_t size)
+{
+	atomic_fetch_add_explicit(&b1b_bench_nallocs, 1, memory_order_relaxed);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *const ptr, const size_t size)
+{
+	atomic_fetch_add_explicit(&b1b_bench_nallocs, 1, memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+
+static uint64_t b1b_bench_allocs(void)
+{
+	return atomic_load_explicit(&b1b_bench_nallocs, memory_order_relaxed);
+}
+
+
+/*
+ *
+ *	Setup, timing & results
+ *
+ */
+
+/*
+ * Parse the (optional) list of sizes on the command line and start the logging
+ * thread.  Returns the number of sizes.
+ */
+unsigned int b1b_bench_init(const int argc, char **const argv,
+			    unsigned int **const sizes)
+{
+	unsigned long n;
+	char *end;
+	int i;
+
+	b1b_use_syslog = 0;
+	b1b_log_start();
+
+	if (argc < 2) {
+		*sizes = b1b_bench_sizes;
+		return sizeof b1b_bench_sizes / sizeof b1b_bench_sizes[0];
+	}
+
+	*sizes = B1B_ZALLOC((argc - 1) * sizeof **sizes);
+
+	for (i = 1; i < argc; ++i) {
+		errno = 0;
+		n = strtoul(argv[i], &end, 10);
+		if (errno != 0 || *end != 0 || n == 0 || n > UINT32_MAX)
+			B1B_FATAL("Invalid number of entries: %s", argv[i]);
+		(*sizes)[i - 1] = n;
+	}
+
+	return argc - 1;
+}
+
+void b1b_bench_fini(void)
+{
+	b1b_log_stop();
+}
+
+unsigned int b1b_bench_reps(const unsigned int entries)
+{
+	unsigned int reps;
+
+	reps = B1B_BENCH_TARGET / entries;
+
+	return reps < B1B_BENCH_MIN_REPS ? B1B_BENCH_MIN_REPS : reps;
+}
+
+void b1b_bench_start(struct b1b_bench *const b)
+{
+	b->start_allocs = b1b_bench_allocs();
+	clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+void b1b_bench_stop(struct b1b_bench *const b)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	b->ns += b1b_ns_between(&b->start, &end);
+	b->allocs += b1b_bench_allocs() - b->start_allocs;
+}
+
+/* Print a result (as JSON) and reset the accumulated counters */
+void b1b_bench_report(struct b1b_bench *const b, const char *restrict bench,
+		      const char *restrict variant, const unsigned int entries,
+		      const unsigned int reps)
+{
+	double n;
+
+	n = (double)entries * reps;
+
+	printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"entries\":%u,"
+			"\"reps\":%u,\"ns_per_entry\":%.1f,"
+			"\"allocs_per_entry\":%.3f}\n",
+	       bench, variant, entries, reps, b->ns / n, b->allocs / n);
+	fflush(stdout);
+
+	b->ns = 0;
+	b->allocs = 0;
+}
+
+
+/*
+ *
+ *	Synthetic sessions
+ *
+ */
+
+/* Same as b1b_gs_alloc() (main.c), but without an epoll instance */
+struct b1b_global_session *b1b_bench_gs(void)
+{
+	struct b1b_global_session *gs;
+	size_t size;
+
+	size = sizeof *gs - sizeof gs->nlmsg + MNL_SOCKET_BUFFER_SIZE;
+	gs = B1B_ZALLOC(size);
+	gs->bufsize = MNL_SOCKET_BUFFER_SIZE;
+	gs->ovssock = -1;
+	gs->epfd = -1;
+
+	return gs;
+}
+
+/* Add a single bond (bench0 on a Linux bridge) to the global session */
+struct b1b_bond_session *b1b_bench_bond(struct b1b_global_session *const gs)
+{
+	struct b1b_bond_session *bs;
+
+	gs->bonds = B1B_ZALLOC(sizeof *gs->bonds);
+	gs->bcount = 1;
+	b1b_stats_init(gs);
+
+	bs = gs->bonds;
+	bs->ifname = B1B_STRDUP("bench0");
+	bs->brname = B1B_STRDUP("br-bench");
+	bs->ifindex = 1;
+	bs->brindex = 2;
+	bs->brtype = B1B_BR_TYPE_LINUX;
+	bs->mode = 1;
+
+	return bs;
+}
+
+/*
+ * The i-th synthetic destination: a locally administered unicast MAC address
+ * (02:00:xx:xx:xx:xx) on one of 4 VLANs (0, 100, 200 & 300).
+ */
+union b1b_fdb_dst b1b_bench_dst(const unsigned int i)
+{
+	union b1b_fdb_dst dst;
+
+	dst.u64 = 0;
+	dst.dst.vlan = (i % 4) * 100;
+	dst.dst.mac[0] = 0x02;
+	dst.dst.mac[1] = 0x00;
+	dst.dst.mac[2] = i >> 24;
+	dst.dst.mac[3] = i >> 16;
+	dst.dst.mac[4] = i >> 8;
+	dst.dst.mac[5] = i;
+
+	return dst;
+}
+
+void b1b_bench_fdb(struct b1b_bond_session *const bs,
+		   const unsigned int entries)
+{
+	unsigned int i;
+
+	for (i = 0; i < entries; ++i)
+		b1b_fdb_add(bs, b1b_bench_dst(i));
+}
+
+/* Make sure that a benchmark built the expected destination tree */
+void b1b_bench_check(const struct b1b_bond_session *const bs,
+		     const unsigned int entries)
+{
+	struct savl_node *node;
+	unsigned int n;
+
+	for (node = savl_first(bs->fdbtree), n = 0; node != NULL;
+						node = savl_next(node)) {
+		++n;
+	}
+
+	if (n != entries)
+		B1B_FATAL("Expected %u destinations, found %u", entries, n);
+}
+
+/* Fill a bond's FDB and hand it to a burst, as b1b_send_garps() does */
+void b1b_bench_burst(struct b1b_bond_session *const bs,
+		     struct b1b_burst *const burst, const unsigned int entries)
+{
+	b1b_bench_fdb(bs, entries);
+
+	clock_gettime(CLOCK_MONOTONIC, &burst->start);
+	burst->event = burst->start;
+	burst->fdb_bytes = 0;
+	burst->fdbtree = bs->fdbtree;
+	burst->next = savl_first(bs->fdbtree);
+	burst->sent = 0;
+	burst->errors = 0;
+	burst->retries = 0;
+	burst->inflight = 0;
+	burst->dsts = entries;
+	burst->ifindex = bs->ifindex;
+	burst->pvid = bs->pvid;
+	snprintf(burst->brname, sizeof burst->brname, "%s", bs->brname);
+	bs->fdbtree = NULL;
+}
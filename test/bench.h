@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	bench.h - microbenchmark helpers
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+#ifndef B1B_BENCH_H_INCLUDED
+#define B1B_BENCH_H_INCLUDED
+
+#include "b1b.h"
+
+
+/*
+ * Benchmarks link with all of the daemon's code (main() is renamed; see
+ * Makefile), and write one JSON object per result to stdout:
+ *
+ *	{"bench":"xmit","variant":"sendto","entries":1000,"reps":50,
+ *	 "ns_per_entry":812.4,"allocs_per_entry":0.000}
+ *
+ * Log messages (e.g. failover summaries) go to stderr, as usual.
+ */
+
+/* Time and allocations of the measured parts of a benchmark */
+struct b1b_bench {
+	struct timespec start;
+	uint64_t start_allocs;
+	uint64_t ns;  /* accumulated by b1b_bench_stop() */
+	uint64_t allocs;
+};
+
+unsigned int b1b_bench_init(int argc, char **argv, unsigned int **sizes);
+void b1b_bench_fini(void);
+unsigned int b1b_bench_reps(unsigned int entries);
+void b1b_bench_start(struct b1b_bench *b);
+void b1b_bench_stop(struct b1b_bench *b);
+void b1b_bench_report(struct b1b_bench *b, const char *restrict bench,
+		      const char *restrict variant, unsigned int entries,
+		      unsigned int reps);
+
+struct b1b_global_session *b1b_bench_gs(void);
+struct b1b_bond_session *b1b_bench_bond(struct b1b_global_session *gs);
+union b1b_fdb_dst b1b_bench_dst(unsigned int i);
+void b1b_bench_fdb(struct b1b_bond_session *bs, unsigned int entries);
+void b1b_bench_check(const struct b1b_bond_session *bs, unsigned int entries);
+void b1b_bench_burst(struct b1b_bond_session *bs, struct b1b_burst *burst,
+		     unsigned int entries);
+
+#endif  /* B1B_BENCH_H_INCLUDED */
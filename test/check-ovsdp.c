@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	check-ovsdp.c - OVS datapath flow parsing
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+/*
+ * Usage: check-ovsdp
+ *
+ * Runs b1b_ovsdp_flow_msg_cb() (via mnl_cb_run(), as b1b_genmsg_req() does)
+ * over a synthetic flow dump, in the same form as the kernel's (key, mask,
+ * then actions), and checks the resulting destination tree.  The bond's bridge
+ * has datapath ports 1 (internal), 2 (bond), 3 and 4; port 9 belongs to
+ * another bridge.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include <linux/genetlink.h>
+#include <linux/openvswitch.h>
+
+
+#define B1B_CHECK_VLAN_PRESENT	0x1000
+
+struct b1b_check_flow {
+	uint32_t in_port;
+	uint8_t src;  /* last octet of source MAC */
+	uint16_t vlan;  /* tag on the wire (0 if none) */
+	uint16_t push_vlan;  /* pushed by actions (0 if none) */
+	_Bool wildcard;  /* mask wildcards the source MAC */
+};
+
+static const struct b1b_check_flow b1b_check_flows[] = {
+	{ .in_port = 3, .src = 1, .push_vlan = 10 },  /* access port */
+	{ .in_port = 4, .src = 2, .vlan = 20 },  /* trunk port */
+	{ .in_port = 4, .src = 3 },  /* untagged */
+	{ .in_port = 9, .src = 4, .push_vlan = 30 },  /* other bridge */
+	{ .in_port = 2, .src = 5, .vlan = 40 },  /* bond */
+	{ .in_port = 1, .src = 6 },  /* bridge internal port */
+	{ .in_port = 3, .src = 7, .push_vlan = 10, .wildcard = 1 },
+};
+
+/* Destinations (source MAC & VLAN) that should be found */
+static const struct {
+	uint8_t src;
+	uint16_t vlan;
+} b1b_check_expected[] = {
+	{ 1, 10 }, { 2, 20 }, { 3, 0 }
+};
+
+#define B1B_CHECK_NFLOWS	\
+	(sizeof b1b_check_flows / sizeof b1b_check_flows[0])
+#define B1B_CHECK_NEXPECTED	\
+	(sizeof b1b_check_expected / sizeof b1b_check_expected[0])
+
+static void b1b_check_put_eth(struct nlmsghdr *const nlmsg,
+			      const uint8_t src, const uint8_t fill)
+{
+	struct ovs_key_ethernet eth;
+
+	memset(&eth, fill, sizeof eth);
+	if (src != 0) {
+		memcpy(eth.eth_src, "\x02\x00\x00\x00\x00", 5);
+		eth.eth_src[5] = src;
+	}
+
+	mnl_attr_put(nlmsg, OVS_KEY_ATTR_ETHERNET, sizeof eth, &eth);
+}
+
+static size_t b1b_check_dump(char *const buf)
+{
+	const struct b1b_check_flow *flow;
+	struct ovs_action_push_vlan push;
+	struct nlmsghdr *nlmsg;
+	struct genlmsghdr *genl;
+	struct ovs_header *ovsh;
+	struct nlattr *nest;
+	unsigned int i;
+	size_t len;
+
+	for (i = 0, len = 0; i < B1B_CHECK_NFLOWS; ++i) {
+
+		flow = &b1b_check_flows[i];
+
+		nlmsg = mnl_nlmsg_put_header(buf + len);
+		nlmsg->nlmsg_type = GENL_ID_CTRL + 1;
+		nlmsg->nlmsg_flags = NLM_F_MULTI;
+		genl = mnl_nlmsg_put_extra_header(nlmsg, sizeof *genl);
+		genl->cmd = OVS_FLOW_CMD_NEW;
+		genl->version = OVS_FLOW_VERSION;
+		ovsh = mnl_nlmsg_put_extra_header(nlmsg, sizeof *ovsh);
+		ovsh->dp_ifindex = 1;
+
+		nest = mnl_attr_nest_start(nlmsg, OVS_FLOW_ATTR_KEY);
+		mnl_attr_put_u32(nlmsg, OVS_KEY_ATTR_IN_PORT, flow->in_port);
+		b1b_check_put_eth(nlmsg, flow->src, 0);
+		if (flow->vlan != 0) {
+			mnl_attr_put_u16(nlmsg, OVS_KEY_ATTR_VLAN,
+					 htons(B1B_CHECK_VLAN_PRESENT
+							| flow->vlan));
+		}
+		mnl_attr_nest_end(nlmsg, nest);
+
+		nest = mnl_attr_nest_start(nlmsg, OVS_FLOW_ATTR_MASK);
+		mnl_attr_put_u32(nlmsg, OVS_KEY_ATTR_IN_PORT, UINT32_MAX);
+		b1b_check_put_eth(nlmsg, 0, flow->wildcard ? 0 : 0xff);
+		mnl_attr_nest_end(nlmsg, nest);
+
+		nest = mnl_attr_nest_start(nlmsg, OVS_FLOW_ATTR_ACTIONS);
+		if (flow->push_vlan != 0) {
+			push.vlan_tpid = htons(0x8100);
+			push.vlan_tci = htons(B1B_CHECK_VLAN_PRESENT
+							| flow->push_vlan);
+			mnl_attr_put(nlmsg, OVS_ACTION_ATTR_PUSH_VLAN,
+				     sizeof push, &push);
+		}
+		mnl_attr_put_u32(nlmsg, OVS_ACTION_ATTR_OUTPUT, 2);
+		mnl_attr_nest_end(nlmsg, nest);
+
+		len += MNL_ALIGN(nlmsg->nlmsg_len);
+	}
+
+	nlmsg = mnl_nlmsg_put_header(buf + len);
+	nlmsg->nlmsg_type = NLMSG_DONE;
+	nlmsg->nlmsg_flags = NLM_F_MULTI;
+
+	return len + MNL_ALIGN(nlmsg->nlmsg_len);
+}
+
+static _Bool b1b_check_found(const struct b1b_bond_session *const bs,
+			     const uint8_t src, const uint16_t vlan)
+{
+	const struct b1b_dst_node *dn;
+	struct savl_node *node;
+
+	for (node = savl_first(bs->fdbtree); node != NULL;
+						node = savl_next(node)) {
+		dn = SAVL_NODE_CONTAINER(node, struct b1b_dst_node, avl);
+		if (dn->dst.dst.mac[5] == src && dn->dst.dst.vlan == vlan)
+			return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	static const uint32_t ports[] = { 1, 2, 3, 4 };
+
+	char buf[B1B_CHECK_NFLOWS * 256 + MNL_NLMSG_HDRLEN];
+	struct b1b_global_session *gs;
+	struct b1b_ovsdp_dump dump;
+	struct b1b_bond_session *bs;
+	unsigned int i;
+	size_t len;
+
+	b1b_use_syslog = 0;
+	b1b_log_start();
+
+	gs = b1b_bench_gs();
+	bs = b1b_bench_bond(gs);
+	bs->brtype = B1B_BR_TYPE_OVS;
+
+	memset(&dump, 0, sizeof dump);
+	dump.bs = bs;
+	dump.ports = ports;
+	dump.nports = sizeof ports / sizeof ports[0];
+	dump.bond_port = 2;
+	dump.local_port = 1;
+
+	len = b1b_check_dump(buf);
+
+	if (mnl_cb_run(buf, len, 0, 0, b1b_ovsdp_flow_msg_cb, &dump)
+							!= MNL_CB_STOP) {
+		B1B_FATAL("Failed to process flow dump");
+	}
+
+	if (dump.count != B1B_CHECK_NFLOWS) {
+		B1B_FATAL("Expected %zu flows, parsed %u",
+			  B1B_CHECK_NFLOWS, dump.count);
+	}
+
+	b1b_bench_check(bs, B1B_CHECK_NEXPECTED);
+
+	for (i = 0; i < B1B_CHECK_NEXPECTED; ++i) {
+		if (!b1b_check_found(bs, b1b_check_expected[i].src,
+				     b1b_check_expected[i].vlan)) {
+			B1B_FATAL("Destination 02:00:00:00:00:%02" PRIx8
+					" (VLAN %" PRIu16 ") not found",
+				  b1b_check_expected[i].src,
+				  b1b_check_expected[i].vlan);
+		}
+	}
+
+	b1b_fdb_free(&bs->fdbtree);
+
+	printf("check-ovsdp: OK\n");
+
+	b1b_log_stop();
+	return 0;
+}
@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	garp-capture.c - capture and count gratuitous ARPs
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+/*
+ * Usage: garp-capture -i IFNAME -n ENTRIES [OPTIONS]
+ *
+ *	-i IFNAME	interface on which to capture
+ *	-n ENTRIES	number of destinations expected
+ *	-f PATH=VALUE	write VALUE to PATH (e.g. a bond's active_slave sysfs
+ *			file) once capturing has started; times are measured
+ *			from this write (default: from the first frame)
+ *	-w MSECS	stop if no frame arrives for MSECS, once at least one
+ *			frame has been captured (default: 2000)
+ *	-t MSECS	stop after MSECS in any case (default: 60000)
+ *
+ * Captures gratuitous ARPs in the form that b1b sends (broadcast ARP replies
+ * with zero IP addresses), until one has been seen from each of ENTRIES
+ * distinct MAC address & VLAN pairs or one of the timeouts expires, then
+ * writes one JSON object to stdout:
+ *
+ *	{"entries":1000,"frames":1000,"unique":1000,"complete":1.0000,
+ *	 "first_us":1520,"last_us":9811,"drops":0}
+ *
+ * first_us and last_us are based on kernel receive timestamps (and are null if
+ * nothing was captured).  drops is the number of frames that the kernel
+ * dropped because the socket's receive buffer was full; if it isn't 0, unique
+ * understates what was actually sent.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/socket.h>
+
+#include <linux/if_packet.h>
+
+/* Large enough for a 100,000 frame burst, if the capture keeps up at all */
+#define CAP_RCVBUF		(256 * 1024 * 1024)
+
+struct cap_arp {
+	uint16_t htype;
+	uint16_t ptype;
+	uint8_t hlen;
+	uint8_t plen;
+	uint16_t op;
+	uint8_t sha[ETH_ALEN];
+	uint8_t spa[4];
+	uint8_t tha[ETH_ALEN];
+	uint8_t tpa[4];
+} __attribute__((packed));
+
+/* Open addressing hash set of (MAC address, VLAN) keys; 0 is empty */
+static uint64_t *cap_set;
+static uint64_t cap_mask;
+
+static unsigned int cap_entries;
+static unsigned int cap_frames;
+static unsigned int cap_unique;
+static struct timespec cap_start, cap_first, cap_last;
+
+
+/*
+ *
+ *	Utilities
+ *
+ */
+
+static unsigned long cap_parse_ulong(const char *const s,
+				     const unsigned long max)
+{
+	unsigned long n;
+	char *end;
+
+	errno = 0;
+	n = strtoul(s, &end, 10);
+	if (errno != 0 || end == s || *end != 0 || n == 0 || n > max)
+		errx(1, "invalid number: %s", s);
+
+	return n;
+}
+
+static int64_t cap_us_between(const struct timespec *const start,
+			      const struct timespec *const end)
+{
+	return ((int64_t)(end->tv_sec - start->tv_sec) * 1000000000
+			+ (end->tv_nsec - start->tv_nsec)) / 1000;
+}
+
+static int64_t cap_ms_since(const struct timespec *const ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	return cap_us_between(ts, &now) / 1000;
+}
+
+static void cap_set_init(const unsigned int entries)
+{
+	uint64_t size;
+
+	for (size = 1024; size < 2 * (uint64_t)entries; size *= 2)
+		;
+
+	if ((cap_set = calloc(size, sizeof *cap_set)) == NULL)
+		err(1, "calloc");
+
+	cap_mask = size - 1;
+}
+
+/* Returns true if the key wasn't already in the set */
+static _Bool cap_set_add(const uint64_t key)
+{
+	uint64_t i;
+
+	/* Synthetic addresses differ in the low bytes; mix them up */
+	i = (key * UINT64_C(0x9e3779b97f4a7c15)) >> 32;
+
+	while (1) {
+
+		i &= cap_mask;
+
+		if (cap_set[i] == key)
+			return 0;
+
+		if (cap_set[i] == 0) {
+			cap_set[i] = key;
+			return 1;
+		}
+
+		++i;
+	}
+}
+
+
+/*
+ *
+ *	Capture
+ *
+ */
+
+static int cap_socket(const char *const ifname)
+{
+	struct sockaddr_ll sll;
+	int fd, opt;
+
+	if ((fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC,
+			 htons(ETH_P_ALL))) < 0) {
+		err(1, "socket");
+	}
+
+	memset(&sll, 0, sizeof sll);
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+
+	if ((sll.sll_ifindex = if_nametoindex(ifname)) == 0)
+		err(1, "%s", ifname);
+
+	if (bind(fd, (struct sockaddr *)&sll, sizeof sll) < 0)
+		err(1, "bind");
+
+	/* SO_RCVBUFFORCE ignores rmem_max, but requires CAP_NET_ADMIN */
+	opt = CAP_RCVBUF;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &opt, sizeof opt) < 0
+			&& setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+				      &opt, sizeof opt) < 0) {
+		err(1, "SO_RCVBUF");
+	}
+
+	opt = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &opt, sizeof opt) < 0)
+		err(1, "SO_TIMESTAMPNS");
+
+	/* VLAN tags are usually removed (and reported in auxiliary data) */
+	if (setsockopt(fd, SOL_PACKET, PACKET_AUXDATA, &opt, sizeof opt) < 0)
+		err(1, "PACKET_AUXDATA");
+
+	return fd;
+}
+
+/* Count a frame, if it's a gratuitous ARP */
+static void cap_frame(const uint8_t *const buf, const ssize_t len,
+		      struct msghdr *const msg)
+{
+	static const uint8_t zero[4];
+
+	const struct tpacket_auxdata *aux;
+	const struct cap_arp *arp;
+	struct timespec ts;
+	struct cmsghdr *cmsg;
+	size_t offset;
+	uint16_t etype, vlan;
+	uint64_t key;
+
+	if (len < ETH_HLEN)
+		return;
+
+	memcpy(&etype, buf + 12, sizeof etype);
+	offset = ETH_HLEN;
+	vlan = 0;
+
+	/* Tag left in the frame */
+	if (etype == htons(ETH_P_8021Q) && len >= ETH_HLEN + 4) {
+		memcpy(&vlan, buf + 14, sizeof vlan);
+		vlan = ntohs(vlan) & 0xfff;
+		memcpy(&etype, buf + 16, sizeof etype);
+		offset += 4;
+	}
+
+	if (etype != htons(ETH_P_ARP)
+			|| (size_t)len < offset + sizeof *arp
+			|| memcmp(buf, "\xff\xff\xff\xff\xff\xff", ETH_ALEN)
+								!= 0) {
+		return;
+	}
+
+	arp = (const void *)(buf + offset);
+
+	if (arp->op != htons(ARPOP_REPLY) || memcmp(arp->spa, zero, 4) != 0
+			|| memcmp(arp->tpa, zero, 4) != 0) {
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+					cmsg = CMSG_NXTHDR(msg, cmsg)) {
+
+		if (cmsg->cmsg_level == SOL_SOCKET
+				&& cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+		}
+		else if (cmsg->cmsg_level == SOL_PACKET
+				&& cmsg->cmsg_type == PACKET_AUXDATA) {
+			aux = (const void *)CMSG_DATA(cmsg);
+			if (aux->tp_status & TP_STATUS_VLAN_VALID)
+				vlan = aux->tp_vlan_tci & 0xfff;
+		}
+	}
+
+	if (cap_frames++ == 0)
+		cap_first = ts;
+	cap_last = ts;
+
+	/* VLAN in the top 16 bits, and never 0 (the empty key) */
+	key = (uint64_t)(vlan | 0x8000) << 48;
+	key |= (uint64_t)arp->sha[0] << 40 | (uint64_t)arp->sha[1] << 32
+		| (uint64_t)arp->sha[2] << 24 | (uint64_t)arp->sha[3] << 16
+		| (uint64_t)arp->sha[4] << 8 | arp->sha[5];
+
+	if (cap_set_add(key))
+		++cap_unique;
+}
+
+/* PATH=VALUE */
+static void cap_write(char *const arg)
+{
+	char *value;
+	int fd;
+
+	if ((value = strchr(arg, '=')) == NULL)
+		errx(1, "invalid write (PATH=VALUE): %s", arg);
+
+	*value++ = 0;
+
+	if ((fd = open(arg, O_WRONLY | O_CLOEXEC)) < 0)
+		err(1, "%s", arg);
+
+	clock_gettime(CLOCK_REALTIME, &cap_start);
+
+	if (write(fd, value, strlen(value)) < 0)
+		err(1, "%s", arg);
+
+	if (close(fd) < 0)
+		err(1, "%s", arg);
+}
+
+static void cap_report(const unsigned int drops)
+{
+	printf("{\"entries\":%u,\"frames\":%u,\"unique\":%u,"
+			"\"complete\":%.4f,",
+	       cap_entries, cap_frames, cap_unique,
+	       (double)cap_unique / cap_entries);
+
+	if (cap_frames == 0) {
+		printf("\"first_us\":null,\"last_us\":null,");
+	}
+	else {
+		if (cap_start.tv_sec == 0)
+			cap_start = cap_first;
+		printf("\"first_us\":%" PRId64 ",\"last_us\":%" PRId64 ",",
+		       cap_us_between(&cap_start, &cap_first),
+		       cap_us_between(&cap_start, &cap_last));
+	}
+
+	printf("\"drops\":%u}\n", drops);
+}
+
+int main(int argc, char **argv)
+{
+	union {
+		struct cmsghdr align;
+		uint8_t buf[CMSG_SPACE(sizeof(struct timespec))
+				+ CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+	} ctl;
+	struct tpacket_stats stats;
+	struct timespec begin;
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct iovec iov;
+	uint8_t buf[2048];
+	const char *ifname;
+	char *write_arg;
+	unsigned int idle_ms, max_ms;
+	socklen_t slen;
+	int64_t timeout;
+	ssize_t len;
+	int opt;
+
+	ifname = NULL;
+	write_arg = NULL;
+	idle_ms = 2000;
+	max_ms = 60000;
+
+	while ((opt = getopt(argc, argv, "i:n:f:w:t:")) != -1) {
+
+		switch (opt) {
+			case 'i':
+				ifname = optarg;
+				break;
+			case 'n':
+				cap_entries = cap_parse_ulong(optarg,
+							      UINT32_MAX / 2);
+				break;
+			case 'f':
+				write_arg = optarg;
+				break;
+			case 'w':
+				idle_ms = cap_parse_ulong(optarg, 3600000);
+				break;
+			case 't':
+				max_ms = cap_parse_ulong(optarg, 3600000);
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	if (ifname == NULL || cap_entries == 0)
+		errx(1, "usage: %s -i IFNAME -n ENTRIES [OPTIONS]", argv[0]);
+
+	cap_set_init(cap_entries);
+
+	pfd.fd = cap_socket(ifname);
+	pfd.events = POLLIN;
+
+	/* Reset the drop counter, now that the socket is set up */
+	slen = sizeof stats;
+	if (getsockopt(pfd.fd, SOL_PACKET, PACKET_STATISTICS,
+		       &stats, &slen) < 0) {
+		err(1, "PACKET_STATISTICS");
+	}
+
+	if (write_arg != NULL)
+		cap_write(write_arg);
+
+	clock_gettime(CLOCK_REALTIME, &begin);
+
+	iov.iov_base = buf;
+	iov.iov_len = sizeof buf;
+
+	while (cap_unique < cap_entries) {
+
+		if (cap_frames == 0)
+			timeout = max_ms - cap_ms_since(&begin);
+		else
+			timeout = idle_ms - cap_ms_since(&cap_last);
+
+		if (timeout > max_ms - cap_ms_since(&begin))
+			timeout = max_ms - cap_ms_since(&begin);
+
+		if (timeout <= 0)
+			break;
+
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+
+		while (1) {
+
+			memset(&msg, 0, sizeof msg);
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = &ctl;
+			msg.msg_controllen = sizeof ctl;
+
+			len = recvmsg(pfd.fd, &msg, MSG_DONTWAIT);
+			if (len < 0) {
+				if (errno == EAGAIN)
+					break;
+				err(1, "recvmsg");
+			}
+
+			cap_frame(buf, len, &msg);
+		}
+	}
+
+	slen = sizeof stats;
+	if (getsockopt(pfd.fd, SOL_PACKET, PACKET_STATISTICS,
+		       &stats, &slen) < 0) {
+		err(1, "PACKET_STATISTICS");
+	}
+
+	cap_report(stats.tp_drops);
+
+	return 0;
+}
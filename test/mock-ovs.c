@@ -0,0 +1,856 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ *	B1B - Bonding mode 1 bridge helper
+ *
+ *	mock-ovs.c - mock ovs-vswitchd unixctl server
+ *
+ *	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+
+/*
+ * Usage: mock-ovs [OPTIONS]
+ *
+ *	-d DIR		run directory (default: current directory); use the
+ *			same directory with b1b -r/--ovs-rundir
+ *	-b BOND=BRIDGE:PORT
+ *			OVS bond, its bridge, and its OpenFlow port number
+ *			(repeatable; default: bond0=br0:1)
+ *	-n ENTRIES	fdb/show entries per bridge (default: 1000)
+ *	-p PORTS	other (non-bond) ports per bridge (default: 4)
+ *	-v VLANS	number of VLANs (0, 10, 20, ...) in FDBs (default: 4)
+ *	-l MSECS	latency of each response (default: 0); pipelined
+ *			requests are answered one after another, as
+ *			ovs-vswitchd does
+ *	-c BYTES	write responses in chunks of (at most) BYTES (default:
+ *			all at once)
+ *	-g USECS	delay between chunks (default: 1000)
+ *
+ * Like ovs-vswitchd, it holds a write lock on DIR/ovs-vswitchd.pid (which
+ * contains its PID) and listens on DIR/ovs-vswitchd.PID.ctl.  It implements
+ * only the dpif/show and fdb/show commands, with synthetic output in the same
+ * format as ovs-vswitchd; fdb/show entries are spread across the bridge's
+ * ports (including the bond's) and VLANs.  Both files are removed on SIGINT or
+ * SIGTERM.
+ */
+
+#define _GNU_SOURCE  /* for asprintf() */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MOCK_MAX_BONDS		16
+#define MOCK_MAX_CLIENTS	16
+
+struct mock_bond {
+	char ifname[IFNAMSIZ];
+	char brname[IFNAMSIZ];
+	uint32_t ofport;
+};
+
+/* A response that has been generated, but not (completely) written */
+struct mock_resp {
+	struct mock_resp *next;
+	struct timespec ready;  /* when it (or its next chunk) can be written */
+	size_t len;
+	size_t sent;
+	char data[];
+};
+
+struct mock_client {
+	struct mock_resp *head;
+	struct mock_resp *tail;
+	char *in;
+	size_t inlen;
+	size_t insize;
+	int fd;
+};
+
+static struct mock_bond mock_bonds[MOCK_MAX_BONDS];
+static unsigned int mock_nbonds;
+static unsigned int mock_entries = 1000;
+static unsigned int mock_ports = 4;
+static unsigned int mock_vlans = 4;
+static uint64_t mock_latency_ns;
+static size_t mock_chunk;
+static uint64_t mock_gap_ns = 1000000;
+
+static volatile sig_atomic_t mock_exit_flag;
+
+
+/*
+ *
+ *	Utilities
+ *
+ */
+
+static void *mock_alloc(const size_t size)
+{
+	void *p;
+
+	if ((p = calloc(1, size)) == NULL)
+		err(1, "calloc");
+
+	return p;
+}
+
+static void mock_ts_add(struct timespec *const ts, const uint64_t nsec)
+{
+	ts->tv_sec += nsec / 1000000000;
+	ts->tv_nsec += nsec % 1000000000;
+
+	if (ts->tv_nsec >= 1000000000) {
+		++ts->tv_sec;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int64_t mock_ns_until(const struct timespec *const ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int64_t)(ts->tv_sec - now.tv_sec) * 1000000000
+			+ (ts->tv_nsec - now.tv_nsec);
+}
+
+static unsigned long mock_parse_ulong(const char *const s,
+				      const unsigned long max)
+{
+	unsigned long n;
+	char *end;
+
+	errno = 0;
+	n = strtoul(s, &end, 10);
+	if (errno != 0 || end == s || *end != 0 || n > max)
+		errx(1, "invalid number: %s", s);
+
+	return n;
+}
+
+/* BOND=BRIDGE:PORT */
+static void mock_parse_bond(char *const arg)
+{
+	struct mock_bond *bond;
+	char *brname, *port;
+
+	if (mock_nbonds == MOCK_MAX_BONDS)
+		errx(1, "too many bonds");
+
+	if ((brname = strchr(arg, '=')) == NULL
+			|| (port = strchr(brname, ':')) == NULL) {
+		errx(1, "invalid bond (BOND=BRIDGE:PORT): %s", arg);
+	}
+
+	*brname++ = 0;
+	*port++ = 0;
+
+	if (strlen(arg) >= IFNAMSIZ || strlen(brname) >= IFNAMSIZ)
+		errx(1, "interface name too long: %s", arg);
+
+	bond = mock_bonds + mock_nbonds++;
+	strcpy(bond->ifname, arg);
+	strcpy(bond->brname, brname);
+	bond->ofport = mock_parse_ulong(port, 65279);
+}
+
+static _Bool mock_have_bridge(const char *const brname)
+{
+	unsigned int i;
+
+	for (i = 0; i < mock_nbonds; ++i) {
+		if (strcmp(mock_bonds[i].brname, brname) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Other ports are numbered after the highest bond port */
+static uint32_t mock_first_port(void)
+{
+	uint32_t max;
+	unsigned int i;
+
+	for (i = 0, max = 0; i < mock_nbonds; ++i) {
+		if (mock_bonds[i].ofport > max)
+			max = mock_bonds[i].ofport;
+	}
+
+	return max + 1;
+}
+
+
+/*
+ *
+ *	Command output
+ *
+ */
+
+/* A growable string */
+struct mock_str {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+__attribute__((format(printf, 2, 3)))
+static void mock_printf(struct mock_str *const s, const char *const format, ...)
+{
+	va_list ap;
+	int len;
+
+	while (1) {
+
+		va_start(ap, format);
+		len = vsnprintf(s->buf + s->len, s->size - s->len, format, ap);
+		va_end(ap);
+
+		if (len < 0)
+			err(1, "vsnprintf");
+
+		if ((size_t)len < s->size - s->len)
+			break;
+
+		s->size = s->size == 0 ? 4096 : s->size * 2;
+		if ((s->buf = realloc(s->buf, s->size)) == NULL)
+			err(1, "realloc");
+	}
+
+	s->len += len;
+}
+
+static void mock_dpif_show(struct mock_str *const out)
+{
+	const char *brname;
+	unsigned int i, j, k, index;
+	uint32_t port;
+
+	mock_printf(out, "system@ovs-system: hit:0 missed:0\n");
+
+	for (i = 0, index = 1; i < mock_nbonds; ++i) {
+
+		brname = mock_bonds[i].brname;
+
+		/* Each bridge once, at its first bond */
+		for (j = 0; j < i; ++j) {
+			if (strcmp(mock_bonds[j].brname, brname) == 0)
+				break;
+		}
+		if (j < i)
+			continue;
+
+		mock_printf(out, "  %s:\n", brname);
+		mock_printf(out, "    %s 65534/%u: (internal)\n",
+			    brname, index++);
+
+		for (j = i; j < mock_nbonds; ++j) {
+			if (strcmp(mock_bonds[j].brname, brname) != 0)
+				continue;
+			mock_printf(out, "    %s %" PRIu32 "/%u: (system)\n",
+				    mock_bonds[j].ifname, mock_bonds[j].ofport,
+				    index++);
+		}
+
+		for (k = 0, port = mock_first_port(); k < mock_ports;
+							++k, ++port) {
+			mock_printf(out, "    %s-p%u %" PRIu32
+						"/%u: (system)\n",
+				    brname, k, port, index++);
+		}
+	}
+}
+
+/* The bridge's ports that FDB entries can be on */
+static unsigned int mock_fdb_ports(const char *const brname,
+				   uint32_t *const ports)
+{
+	unsigned int i, count;
+	uint32_t port;
+
+	for (i = 0, count = 0; i < mock_nbonds; ++i) {
+		if (strcmp(mock_bonds[i].brname, brname) == 0)
+			ports[count++] = mock_bonds[i].ofport;
+	}
+
+	for (i = 0, port = mock_first_port(); i < mock_ports; ++i, ++port)
+		ports[count++] = port;
+
+	return count;
+}
+
+static void mock_fdb_show(struct mock_str *const out, const char *const brname)
+{
+	uint32_t ports[MOCK_MAX_BONDS + 256];
+	unsigned int i, nports, bridx;
+
+	/* Different bridges get different MAC addresses */
+	bridx = (unsigned char)brname[strlen(brname) - 1];
+
+	nports = mock_fdb_ports(brname, ports);
+
+	mock_printf(out, " port  VLAN  MAC                Age\n");
+
+	for (i = 0; i < mock_entries; ++i) {
+		mock_printf(out, "%5" PRIu32 "  %4u  "
+					"02:%02x:%02x:%02x:%02x:%02x  %3u\n",
+			    ports[i % nports], (i % mock_vlans) * 10, bridx,
+			    (i >> 24) & 0xff, (i >> 16) & 0xff,
+			    (i >> 8) & 0xff, i & 0xff, i % 300);
+	}
+
+	mock_printf(out, "LOCAL     0  02:%02x:ff:ff:ff:ff    0\n", bridx);
+}
+
+
+/*
+ *
+ *	JSON-RPC
+ *
+ */
+
+/*
+ * Find the end of a complete JSON object at the start of buf.  Returns its
+ * length, 0 if it's incomplete, or -1 if buf doesn't start with an object.
+ */
+static ssize_t mock_json_frame(const char *const buf, const size_t len)
+{
+	_Bool in_string, escape;
+	unsigned int depth;
+	size_t i;
+
+	in_string = escape = 0;
+	depth = 0;
+
+	for (i = 0; i < len; ++i) {
+
+		if (in_string) {
+			if (escape)
+				escape = 0;
+			else if (buf[i] == '\\')
+				escape = 1;
+			else if (buf[i] == '"')
+				in_string = 0;
+			continue;
+		}
+
+		switch (buf[i]) {
+			case '"':
+				in_string = 1;
+				break;
+			case '{':
+			case '[':
+				++depth;
+				break;
+			case '}':
+			case ']':
+				if (depth == 0)
+					return -1;
+				if (--depth == 0)
+					return i + 1;
+				break;
+			case ' ':
+			case '\t':
+			case '\r':
+			case '\n':
+				break;
+			default:
+				if (depth == 0)
+					return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Returns a pointer to the value of a member of a (NUL-terminated) request
+ * object, or NULL.  Good enough for the requests that b1b (and ovs-appctl)
+ * send.
+ */
+static const char *mock_json_member(const char *const obj,
+				    const char *const name)
+{
+	const char *p;
+	char key[32];
+
+	snprintf(key, sizeof key, "\"%s\"", name);
+
+	if ((p = strstr(obj, key)) == NULL)
+		return NULL;
+
+	p += strlen(key);
+	p += strspn(p, " \t\r\n");
+	if (*p != ':')
+		return NULL;
+	++p;
+
+	return p + strspn(p, " \t\r\n");
+}
+
+/* Copy a JSON string (only \" and \\ escapes), returning false on error */
+static _Bool mock_json_str(const char *p, char *const out, const size_t size)
+{
+	size_t len;
+
+	if (p == NULL || *p++ != '"')
+		return 0;
+
+	for (len = 0; *p != '"'; ++p) {
+		if (*p == 0 || len + 1 == size)
+			return 0;
+		if (*p == '\\' && *++p == 0)
+			return 0;
+		out[len++] = *p;
+	}
+
+	out[len] = 0;
+
+	return 1;
+}
+
+/* Appends a JSON string (with quotes) */
+static void mock_put_json_str(struct mock_str *const out, const char *s,
+			      const size_t len)
+{
+	const char *const end = s + len;
+
+	mock_printf(out, "\"");
+
+	for (; s < end; ++s) {
+		if (*s == '\n')
+			mock_printf(out, "\\n");
+		else if (*s == '"' || *s == '\\')
+			mock_printf(out, "\\%c", *s);
+		else
+			mock_printf(out, "%c", *s);
+	}
+
+	mock_printf(out, "\"");
+}
+
+/*
+ * Queue a response.  Requests are answered in order, each mock_latency_ns
+ * after the previous one (or after it was received, if later).
+ */
+static void mock_queue(struct mock_client *const c,
+		       const struct mock_str *const resp)
+{
+	struct mock_resp *r;
+
+	r = mock_alloc(sizeof *r + resp->len);
+	memcpy(r->data, resp->buf, resp->len);
+	r->len = resp->len;
+
+	clock_gettime(CLOCK_MONOTONIC, &r->ready);
+	if (c->tail != NULL && mock_ns_until(&c->tail->ready) > 0)
+		r->ready = c->tail->ready;
+	mock_ts_add(&r->ready, mock_latency_ns);
+
+	if (c->tail == NULL)
+		c->head = r;
+	else
+		c->tail->next = r;
+	c->tail = r;
+}
+
+/* Handle one request (a NUL-terminated JSON object) */
+static void mock_request(struct mock_client *const c, const char *const req)
+{
+	struct mock_str result = { 0 }, resp = { 0 };
+	char method[64], param[256];
+	const char *id, *params;
+	size_t idlen;
+
+	if ((id = mock_json_member(req, "id")) == NULL
+			|| !mock_json_str(mock_json_member(req, "method"),
+					  method, sizeof method)) {
+		errx(1, "invalid request: %s", req);
+	}
+
+	idlen = strcspn(id, ", \t\r\n}");
+
+	/* First parameter (if any) */
+	param[0] = 0;
+	if ((params = mock_json_member(req, "params")) != NULL
+			&& *params == '[') {
+		++params;
+		params += strspn(params, " \t\r\n");
+		if (*params == '"' && !mock_json_str(params, param,
+						     sizeof param)) {
+			errx(1, "invalid parameter: %s", req);
+		}
+	}
+
+	mock_printf(&resp, "{\"id\":%.*s,", (int)idlen, id);
+
+	if (strcmp(method, "dpif/show") == 0) {
+		mock_dpif_show(&result);
+	}
+	else if (strcmp(method, "fdb/show") == 0) {
+		if (!mock_have_bridge(param)) {
+			mock_printf(&resp, "\"result\":null,\"error\":"
+					"\"no such bridge\\n\"}");
+			goto done;
+		}
+		mock_fdb_show(&result, param);
+	}
+	else {
+		mock_printf(&resp, "\"result\":null,\"error\":"
+				"\"\\\"%s\\\" is not a valid command\\n\"}",
+			    method);
+		goto done;
+	}
+
+	mock_printf(&resp, "\"result\":");
+	mock_put_json_str(&resp, result.buf, result.len);
+	mock_printf(&resp, ",\"error\":null}");
+
+done:
+	mock_queue(c, &resp);
+	free(result.buf);
+	free(resp.buf);
+}
+
+
+/*
+ *
+ *	Clients
+ *
+ */
+
+static void mock_client_free(struct mock_client *const c)
+{
+	struct mock_resp *r;
+
+	while ((r = c->head) != NULL) {
+		c->head = r->next;
+		free(r);
+	}
+
+	if (close(c->fd) < 0)
+		warn("close");
+
+	free(c->in);
+	memset(c, 0, sizeof *c);
+	c->fd = -1;
+}
+
+/* Returns false if the client has disconnected */
+static _Bool mock_client_read(struct mock_client *const c)
+{
+	ssize_t bytes, len;
+	char next;
+
+	if (c->inlen == c->insize) {
+		c->insize = c->insize == 0 ? 4096 : c->insize * 2;
+		if ((c->in = realloc(c->in, c->insize + 1)) == NULL)
+			err(1, "realloc");
+	}
+
+	bytes = read(c->fd, c->in + c->inlen, c->insize - c->inlen);
+	if (bytes < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 1;
+		warn("read");
+		return 0;
+	}
+
+	if (bytes == 0)
+		return 0;
+
+	c->inlen += bytes;
+
+	while ((len = mock_json_frame(c->in, c->inlen)) > 0) {
+		next = c->in[len];
+		c->in[len] = 0;  /* insize + 1 bytes allocated */
+		mock_request(c, c->in);
+		c->in[len] = next;
+		c->inlen -= len;
+		memmove(c->in, c->in + len, c->inlen);
+	}
+
+	if (len < 0) {
+		warnx("invalid request");
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Write (part of) the first response, if it's ready.  Returns false if the
+ * client has disconnected.
+ */
+static _Bool mock_client_write(struct mock_client *const c)
+{
+	struct mock_resp *const r = c->head;
+	ssize_t bytes;
+	size_t len;
+
+	if (r == NULL || mock_ns_until(&r->ready) > 0)
+		return 1;
+
+	len = r->len - r->sent;
+	if (mock_chunk != 0 && len > mock_chunk)
+		len = mock_chunk;
+
+	bytes = send(c->fd, r->data + r->sent, len, MSG_NOSIGNAL);
+	if (bytes < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 1;
+		warn("send");
+		return 0;
+	}
+
+	r->sent += bytes;
+
+	if (r->sent < r->len) {
+		/* Give the client a chance to read each chunk separately */
+		if (mock_chunk != 0)
+			mock_ts_add(&r->ready, mock_gap_ns);
+		return 1;
+	}
+
+	c->head = r->next;
+	if (c->head == NULL)
+		c->tail = NULL;
+	free(r);
+
+	return 1;
+}
+
+
+/*
+ *
+ *	Setup & main loop
+ *
+ */
+
+static void mock_catch_signal(const int signum __attribute__((unused)))
+{
+	mock_exit_flag = 1;
+}
+
+/* Create and lock the PID file; it stays open (and locked) until exit */
+static char *mock_pid_file(const char *const dir)
+{
+	struct flock lck = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+	char *path, pid[24];
+	int fd, len;
+
+	if (asprintf(&path, "%s/ovs-vswitchd.pid", dir) < 0)
+		err(1, "asprintf");
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+		err(1, "%s", path);
+
+	if (fcntl(fd, F_SETLK, &lck) < 0)
+		err(1, "%s: lock", path);
+
+	len = snprintf(pid, sizeof pid, "%jd\n", (intmax_t)getpid());
+
+	if (ftruncate(fd, 0) < 0 || write(fd, pid, len) != len)
+		err(1, "%s: write", path);
+
+	return path;
+}
+
+static int mock_listen(const char *const dir, char **const path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (asprintf(path, "%s/ovs-vswitchd.%jd.ctl", dir,
+		     (intmax_t)getpid()) < 0) {
+		err(1, "asprintf");
+	}
+
+	if (strlen(*path) >= sizeof sun.sun_path)
+		errx(1, "socket path too long: %s", *path);
+
+	strcpy(sun.sun_path, *path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		err(1, "socket");
+
+	if (unlink(*path) < 0 && errno != ENOENT)
+		err(1, "%s: unlink", *path);
+
+	if (bind(fd, (struct sockaddr *)&sun, sizeof sun) < 0)
+		err(1, "%s: bind", *path);
+
+	if (listen(fd, MOCK_MAX_CLIENTS) < 0)
+		err(1, "%s: listen", *path);
+
+	return fd;
+}
+
+/* Poll timeout (ms): until the earliest queued response is ready */
+static int mock_timeout(const struct mock_client *const clients)
+{
+	int64_t ns, min;
+	unsigned int i;
+
+	for (i = 0, min = -1; i < MOCK_MAX_CLIENTS; ++i) {
+
+		if (clients[i].fd < 0 || clients[i].head == NULL)
+			continue;
+
+		if ((ns = mock_ns_until(&clients[i].head->ready)) < 0)
+			ns = 0;
+
+		if (min < 0 || ns < min)
+			min = ns;
+	}
+
+	return min < 0 ? -1 : (int)((min + 999999) / 1000000);
+}
+
+int main(int argc, char **argv)
+{
+	struct mock_client clients[MOCK_MAX_CLIENTS];
+	struct pollfd pfds[MOCK_MAX_CLIENTS + 1];
+	char *pid_path, *sock_path, bond0[] = "bond0=br0:1";
+	const char *dir;
+	unsigned int i;
+	int lfd, fd, opt, timeout;
+
+	dir = ".";
+
+	while ((opt = getopt(argc, argv, "d:b:n:p:v:l:c:g:")) != -1) {
+
+		switch (opt) {
+			case 'd':
+				dir = optarg;
+				break;
+			case 'b':
+				mock_parse_bond(optarg);
+				break;
+			case 'n':
+				mock_entries = mock_parse_ulong(optarg,
+								UINT32_MAX);
+				break;
+			case 'p':
+				mock_ports = mock_parse_ulong(optarg, 256);
+				break;
+			case 'v':
+				mock_vlans = mock_parse_ulong(optarg, 409);
+				if (mock_vlans == 0)
+					errx(1, "invalid number: %s", optarg);
+				break;
+			case 'l':
+				mock_latency_ns = mock_parse_ulong(optarg,
+								   3600000)
+							* 1000000;
+				break;
+			case 'c':
+				mock_chunk = mock_parse_ulong(optarg,
+							      UINT32_MAX);
+				break;
+			case 'g':
+				mock_gap_ns = mock_parse_ulong(optarg,
+							       1000000000)
+							* 1000;
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	if (mock_nbonds == 0)
+		mock_parse_bond(bond0);
+
+	signal(SIGINT, mock_catch_signal);
+	signal(SIGTERM, mock_catch_signal);
+
+	pid_path = mock_pid_file(dir);
+	lfd = mock_listen(dir, &sock_path);
+
+	fprintf(stderr, "Listening on %s\n", sock_path);
+
+	for (i = 0; i < MOCK_MAX_CLIENTS; ++i) {
+		memset(clients + i, 0, sizeof clients[i]);
+		clients[i].fd = -1;
+	}
+
+	while (!mock_exit_flag) {
+
+		pfds[0].fd = lfd;
+		pfds[0].events = POLLIN;
+
+		for (i = 0; i < MOCK_MAX_CLIENTS; ++i) {
+			pfds[i + 1].fd = clients[i].fd;
+			pfds[i + 1].events = POLLIN;
+		}
+
+		timeout = mock_timeout(clients);
+
+		if (poll(pfds, MOCK_MAX_CLIENTS + 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+
+		if (pfds[0].revents & POLLIN) {
+
+			if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+				err(1, "accept");
+
+			for (i = 0; i < MOCK_MAX_CLIENTS; ++i) {
+				if (clients[i].fd < 0)
+					break;
+			}
+
+			if (i == MOCK_MAX_CLIENTS) {
+				warnx("too many clients");
+				close(fd);
+			}
+			else {
+				clients[i].fd = fd;
+			}
+		}
+
+		for (i = 0; i < MOCK_MAX_CLIENTS; ++i) {
+
+			if (clients[i].fd < 0)
+				continue;
+
+			if ((pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+					&& !mock_client_read(clients + i)) {
+				mock_client_free(clients + i);
+				continue;
+			}
+
+			if (!mock_client_write(clients + i))
+				mock_client_free(clients + i);
+		}
+	}
+
+	for (i = 0; i < MOCK_MAX_CLIENTS; ++i) {
+		if (clients[i].fd >= 0)
+			mock_client_free(clients + i);
+	}
+
+	unlink(sock_path);
+	unlink(pid_path);
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+#	B1B - Bonding mode 1 bridge helper
+#
+#	netns-bench.sh - end-to-end failover benchmark in a network namespace
+#
+#	Copyright 2024 Ian Pilcher <arequipeno@gmail.com>
+#
+# Usage: netns-bench.sh [-b B1B] [-r RUNS] [-o OPTIONS] [ENTRIES ...]
+#
+#	-b B1B		b1b executable (default: ../src/b1b, relative to this
+#			script)
+#	-r RUNS		failovers per number of entries (default: 3)
+#	-o OPTIONS	extra b1b options (e.g. "-u -s")
+#
+# Must be run as root (in the test directory, after make).  Builds this
+# topology in a new network namespace (b1b-bench):
+#
+#	p0 --- s0 --+
+#	            +-- bond0 (active-backup) --+
+#	p1 --- s1 --+                           +-- br0
+#	                          ep0 ----------+
+#
+# For each number of entries (default: 100 1000 10000 100000), it adds that
+# many static FDB entries (simulated endpoints) on ep0, starts b1b, and forces
+# RUNS failovers by writing to bond0's active_slave sysfs file.  garp-capture
+# does the write, captures the gratuitous ARPs on the new active slave's peer,
+# and writes one JSON object per failover to stdout, e.g.:
+#
+#	{"run":1,"entries":1000,"frames":1000,"unique":1000,"complete":1.0000,
+#	 "first_us":1520,"last_us":9811,"drops":0}
+#
+# (See garp-capture.c.)  b1b's log messages (including its own failover
+# summaries) go to stderr.  The namespace is deleted on exit.
+#
+
+set -e
+
+NS=b1b-bench
+DIR=$(cd "$(dirname "$0")" && pwd)
+B1B=$DIR/../src/b1b
+CAPTURE=$DIR/garp-capture
+RUNS=3
+OPTS=
+
+while getopts b:r:o: opt; do
+	case $opt in
+		b)	B1B=$OPTARG ;;
+		r)	RUNS=$OPTARG ;;
+		o)	OPTS=$OPTARG ;;
+		*)	exit 1 ;;
+	esac
+done
+
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+	set -- 100 1000 10000 100000
+fi
+
+for f in "$B1B" "$CAPTURE"; do
+	if [ ! -x "$f" ]; then
+		echo "$0: not found (run make first?): $f" >&2
+		exit 1
+	fi
+done
+
+TMP=$(mktemp -d)
+B1B_PID=
+
+cleanup() {
+	if [ -n "$B1B_PID" ]; then
+		kill "$B1B_PID" 2>/dev/null || :
+		wait "$B1B_PID" 2>/dev/null || :
+	fi
+	ip netns del $NS 2>/dev/null || :
+	rm -rf "$TMP"
+}
+
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+nsip() {
+	ip -n $NS "$@"
+}
+
+# Bond, bridge, and slaves (whose peers are left unattached)
+ip netns add $NS
+nsip link set lo up
+nsip link add bond0 type bond mode active-backup miimon 100
+nsip link add br0 type bridge
+
+for i in 0 1; do
+	nsip link add s$i type veth peer name p$i
+	nsip link set s$i master bond0
+	nsip link set p$i up
+done
+
+nsip link set bond0 master br0
+nsip link set bond0 up
+nsip link set br0 up
+
+# Static FDB entries on ep0 (a veth, so that its peer can be brought up)
+fill_fdb() {
+	nsip link del ep0 2>/dev/null || :
+	nsip link add ep0 type veth peer name ep0p
+	nsip link set ep0p up
+	nsip link set ep0 master br0 up
+
+	awk -v n="$1" 'BEGIN {
+		for (i = 1; i <= n; ++i) {
+			printf "fdb add 02:00:00:%02x:%02x:%02x dev ep0 " \
+				"master static\n", \
+				int(i / 65536) % 256, int(i / 256) % 256, \
+				i % 256
+		}
+	}' > "$TMP/fdb"
+
+	ip netns exec $NS bridge -batch "$TMP/fdb"
+}
+
+start_b1b() {
+	rm -f "$TMP/ctl"
+	# shellcheck disable=SC2086
+	ip netns exec $NS "$B1B" -e -c "$TMP/ctl" $OPTS bond0 &
+	B1B_PID=$!
+
+	i=0
+	while [ ! -S "$TMP/ctl" ]; do
+		if ! kill -0 "$B1B_PID" 2>/dev/null || [ $i -eq 50 ]; then
+			echo "$0: b1b failed to start" >&2
+			exit 1
+		fi
+		sleep 0.1
+		i=$((i + 1))
+	done
+}
+
+stop_b1b() {
+	kill "$B1B_PID"
+	wait "$B1B_PID" || :
+	B1B_PID=
+}
+
+for n in "$@"; do
+
+	fill_fdb "$n"
+	start_b1b
+
+	for r in $(seq 1 "$RUNS"); do
+
+		active=$(ip netns exec $NS \
+				cat /sys/class/net/bond0/bonding/active_slave)
+		if [ "$active" = s0 ]; then
+			next=1
+		else
+			next=0
+		fi
+
+		ip netns exec $NS "$CAPTURE" -i p$next -n "$n" \
+			-f /sys/class/net/bond0/bonding/active_slave=s$next \
+			| sed "s/^{/{\"run\":$r,/"
+
+		# Let the bond settle before the next failover
+		sleep 1
+	done
+
+	stop_b1b
+done